@@ -0,0 +1,279 @@
+/* cejson-alloc.h – NUMA-local, huge-page backed allocations for large parser buffers */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_ALLOC_H
+#define CEJSON_ALLOC_H
+
+#include "cejson.h"
+
+#include <errno.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Big node tapes, stacks, source windows and indexes are touched once,
+ * sequentially, and then read at random. On a multi-socket host they should
+ * live on the node of the thread that parses into them, and on huge pages to
+ * keep TLB misses down. Small requests (< JSON_ALLOC_MIN_MMAP) just use
+ * malloc(). Every mapping path falls back silently: no hugetlbfs pool means
+ * transparent huge pages, no THP means normal pages, no NUMA means no policy.
+ *
+ * json_free_large() must be given the same size that was allocated.
+ */
+
+#define JSON_ALLOC_HUGE     0x1     /* MAP_HUGETLB, else MADV_HUGEPAGE */
+#define JSON_ALLOC_LOCAL    0x2     /* prefer the calling thread's NUMA node */
+#define JSON_ALLOC_DEFAULT  (JSON_ALLOC_HUGE | JSON_ALLOC_LOCAL)
+
+#ifndef JSON_ALLOC_MIN_MMAP
+#define JSON_ALLOC_MIN_MMAP (1024 * 1024)
+#endif
+#define JSON_HUGE_PAGE      (2ULL * 1024 * 1024)
+
+static inline size_t json_alloc_round(size_t bytes)
+{
+    return (bytes + JSON_HUGE_PAGE - 1) & ~(size_t)(JSON_HUGE_PAGE - 1);
+}
+
+#ifdef __linux__
+/* Preferred (not strict) policy so a full node spills over instead of failing */
+static inline void json_alloc_bind_local(void* mem, size_t len)
+{
+#if defined(SYS_getcpu) && defined(SYS_mbind)
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= 64) return;
+    unsigned long mask = 1UL << node;
+    (void)syscall(SYS_mbind, mem, len, 1 /* MPOL_PREFERRED */, &mask, 64UL, 0U);
+#else
+    (void)mem; (void)len;
+#endif
+}
+#endif
+
+static inline void* json_alloc_large(size_t bytes, unsigned flags)
+{
+    if (bytes < JSON_ALLOC_MIN_MMAP) return malloc(bytes);
+
+#ifdef __linux__
+    size_t len = json_alloc_round(bytes);
+    void* mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (flags & JSON_ALLOC_HUGE)
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (mem == MAP_FAILED) {
+        /* over-map by one huge page and trim, so THP can back the whole range */
+        char* raw = mmap(NULL, len + JSON_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return NULL;
+        char* aligned = (char*)json_alloc_round((size_t)raw);
+        if (aligned > raw) munmap(raw, (size_t)(aligned - raw));
+        munmap(aligned + len, (size_t)(raw + JSON_HUGE_PAGE - aligned));
+        mem = aligned;
+#ifdef MADV_HUGEPAGE
+        if (flags & JSON_ALLOC_HUGE) (void)madvise(mem, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    /* before the first touch, so the pages fault in on the right node */
+    if (flags & JSON_ALLOC_LOCAL) json_alloc_bind_local(mem, len);
+    return mem;
+#else
+    (void)flags;
+    return malloc(bytes);
+#endif
+}
+
+static inline void json_free_large(void* mem, size_t bytes)
+{
+    if (!mem) return;
+#ifdef __linux__
+    if (bytes >= JSON_ALLOC_MIN_MMAP) { munmap(mem, json_alloc_round(bytes)); return; }
+#endif
+    (void)bytes;
+    free(mem);
+}
+
+/* The three parser arrays in one go; stack_cap 0 means compact nesting that grows as needed */
+typedef struct {
+    JsonNode* nodes;
+    uint32_t* stack;
+    uint8_t*  expecting_key;
+    uint64_t  nodes_cap;
+    uint64_t  stack_cap;
+    JsonNest  nest;
+} JsonParserBuffers;
+
+static inline void json_free_parser_buffers(JsonParserBuffers* b)
+{
+    json_free_large(b->nodes, b->nodes_cap * sizeof(JsonNode));
+    json_free_large(b->stack, b->stack_cap * sizeof(uint32_t));
+    json_free_large(b->expecting_key, b->stack_cap * sizeof(uint8_t));
+    json_nest_free(&b->nest);
+    memset(b, 0, sizeof(*b));
+}
+
+static inline bool json_alloc_parser_buffers(JsonParserBuffers* b, uint64_t nodes_cap, uint64_t stack_cap, unsigned flags)
+{
+    memset(b, 0, sizeof(*b));
+    b->nodes_cap = nodes_cap;
+    b->stack_cap = stack_cap;
+    b->nodes = json_alloc_large(nodes_cap * sizeof(JsonNode), flags);
+    if (!stack_cap) {
+        if (b->nodes) return true;
+    } else {
+        b->stack = json_alloc_large(stack_cap * sizeof(uint32_t), flags);
+        b->expecting_key = json_alloc_large(stack_cap * sizeof(uint8_t), flags);
+        if (b->nodes && b->stack && b->expecting_key) return true;
+    }
+    json_free_parser_buffers(b);
+    return false;
+}
+
+/* json_init() on freshly allocated buffers */
+static inline void json_init_buffers(JsonParser* p, JsonParserBuffers* b)
+{
+    if (!b->stack_cap) json_init_nest(p, b->nodes, b->nodes_cap, &b->nest);
+    else json_init(p, b->nodes, b->nodes_cap, b->stack, b->stack_cap, b->expecting_key);
+}
+
+/* ====================== FILE-BACKED TAPE  ====================== */
+
+/*
+ * For documents whose tape won't fit in memory: the node array is a shared
+ * mapping of an unlinked temporary file, grown by JSON_TAPE_EXTENT at a time
+ * (ftruncate + mremap) whenever json_feed() runs out of room. The mapping is
+ * marked sequential while parsing, and each completed extent is handed to
+ * writeback straight away so dirty pages don't pile up. The kernel can then
+ * page the tape out instead of the OOM killer stepping in.
+ *
+ *     JsonTape t;
+ *     json_tape_open(&t, NULL, 0);            // $TMPDIR or /tmp, default extent
+ *     json_init_nest(&p, NULL, 0, &nest);     // or json_init(), any nesting
+ *     json_tape_attach(&p, &t);
+ *     ... json_feed() / json_finish() ...
+ *     json_tape_parsed(&t);                   // back to normal paging for traversal
+ *     ... accessors, serializer: p.nodes is the mapping ...
+ *     json_tape_close(&t);
+ *
+ * Growing can move the mapping, so node pointers taken during a json_feed()
+ * are stale after the next one; after parsing the tape stays put. Linux only;
+ * elsewhere json_tape_open() fails with ENOSYS.
+ */
+
+#ifndef JSON_TAPE_EXTENT
+#define JSON_TAPE_EXTENT (64ULL * 1024 * 1024)    /* bytes added per growth */
+#endif
+
+typedef struct {
+    int       fd;
+    JsonNode* nodes;
+    uint64_t  cap;                  /* nodes mapped */
+    uint64_t  extent;               /* nodes per growth, a whole number of pages */
+    uint64_t  flushed;              /* nodes already handed to writeback */
+    uint64_t  grows;
+} JsonTape;
+
+static inline void json_tape_close(JsonTape* t)
+{
+#ifdef __linux__
+    if (t->nodes) munmap(t->nodes, t->cap * sizeof(JsonNode));
+    if (t->fd >= 0) close(t->fd);
+#endif
+    memset(t, 0, sizeof(*t));
+    t->fd = -1;
+}
+
+#ifdef __linux__
+static inline bool json_tape_resize(JsonTape* t, uint64_t cap)
+{
+    size_t old_len = t->cap * sizeof(JsonNode), len = cap * sizeof(JsonNode);
+    if (ftruncate(t->fd, (off_t)len) != 0) return false;
+    void* mem = t->nodes
+        ? (void*)syscall(SYS_mremap, t->nodes, old_len, len, 1 /* MREMAP_MAYMOVE */)
+        : mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+    if (mem == MAP_FAILED) return false;
+    (void)madvise(mem, len, MADV_SEQUENTIAL);
+
+    /* everything below the old end is written (bar container fixups): start its writeback now */
+    if (t->cap > t->flushed) {
+        (void)syscall(SYS_sync_file_range, t->fd, (off_t)(t->flushed * sizeof(JsonNode)),
+                      (off_t)((t->cap - t->flushed) * sizeof(JsonNode)), 2U /* SYNC_FILE_RANGE_WRITE */);
+        t->flushed = t->cap;
+    }
+    t->nodes = mem;
+    t->cap = cap;
+    return true;
+}
+#endif
+
+/* Creates the backing file in dir (NULL: $TMPDIR or /tmp); extent_bytes 0 means JSON_TAPE_EXTENT */
+static inline bool json_tape_open(JsonTape* t, const char* dir, uint64_t extent_bytes)
+{
+    memset(t, 0, sizeof(*t));
+    t->fd = -1;
+#ifdef __linux__
+    if (!dir) dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+    char path[4096];
+    if ((size_t)snprintf(path, sizeof(path), "%s/cejson-tape-XXXXXX", dir) >= sizeof(path)) return false;
+    if ((t->fd = mkstemp(path)) < 0) return false;
+    unlink(path);
+
+    /* 512 nodes = 3 pages of 4 KiB, so extents always end on a page boundary */
+    t->extent = ((extent_bytes ? extent_bytes : JSON_TAPE_EXTENT) / sizeof(JsonNode) + 511) & ~511ULL;
+    if (json_tape_resize(t, t->extent)) return true;
+    json_tape_close(t);
+    return false;
+#else
+    (void)dir; (void)extent_bytes;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+/* p->grow hook */
+static inline bool json_tape_grow(JsonParser* p, uint64_t need)
+{
+    JsonTape* t = p->grow_ctx;
+    if (p->nodes != t->nodes) return false;         /* relayout/extract swapped the tape out */
+#ifdef __linux__
+    uint64_t cap = t->cap;
+    while (cap < need) cap += t->extent;
+    if (cap > (uint64_t)UINT32_MAX + 1 || !json_tape_resize(t, cap)) return false;
+    t->grows++;
+    p->nodes = t->nodes;
+    p->nodes_cap = t->cap;
+    return true;
+#else
+    (void)need;
+    return false;
+#endif
+}
+
+/* After json_init*(): parse into the tape instead of the caller's array */
+static inline void json_tape_attach(JsonParser* p, JsonTape* t)
+{
+    p->nodes = t->nodes;
+    p->nodes_cap = t->cap;
+    p->grow = json_tape_grow;
+    p->grow_ctx = t;
+}
+
+/* Parsing is done: traversal reads the tape at random, drop the sequential hint */
+static inline void json_tape_parsed(JsonTape* t)
+{
+#ifdef __linux__
+    if (t->nodes) (void)madvise(t->nodes, t->cap * sizeof(JsonNode), MADV_NORMAL);
+#else
+    (void)t;
+#endif
+}
+
+#endif /* CEJSON_ALLOC_H */
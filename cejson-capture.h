@@ -0,0 +1,172 @@
+/* cejson-capture.h – record the chunking and timing of a live feed, load it back for replay */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_CAPTURE_H
+#define CEJSON_CAPTURE_H
+
+#include "cejson.h"
+#include <time.h>
+
+/*
+ * A capture is two files: <base>.data holds the bytes exactly as they
+ * arrived, <base>.feeds holds one record per chunk. A record is the chunk
+ * length and the nanoseconds since the previous chunk arrived, both as LEB128
+ * varints, after a 5-byte header ("CJFT" plus a version byte). A typical
+ * record takes 4-6 bytes.
+ *
+ * Capturing: call json_capture_chunk() wherever data is handed to json_feed()
+ * (or use json_capture_feed(), which does both). Replaying:
+ * json_feedtrace_load() reads both files back, with arrival times made
+ * relative to the first chunk.
+ */
+
+#define JSON_CAPTURE_MAGIC   "CJFT"
+#define JSON_CAPTURE_VERSION 1
+
+typedef struct {
+    FILE*    data;
+    FILE*    feeds;
+    uint64_t last_ns;
+    uint64_t chunks;
+    uint64_t bytes;
+} JsonCapture;
+
+typedef struct {
+    char*     data;
+    uint64_t  len;
+    uint64_t* chunk_len;
+    uint64_t* arrival_ns;           /* since the first chunk */
+    uint64_t  chunks;
+} JsonFeedTrace;
+
+static inline uint64_t json_capture_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline FILE* json_capture_fopen(const char* base, const char* ext, const char* mode)
+{
+    char path[4096];
+    if ((size_t)snprintf(path, sizeof(path), "%s%s", base, ext) >= sizeof(path)) return NULL;
+    return fopen(path, mode);
+}
+
+static inline bool json_capture_put_varint(FILE* f, uint64_t v)
+{
+    uint8_t b[10];
+    int n = 0;
+    do {
+        b[n] = (uint8_t)(v & 0x7F);
+        v >>= 7;
+        if (v) b[n] |= 0x80;
+        n++;
+    } while (v);
+    return fwrite(b, 1, (size_t)n, f) == (size_t)n;
+}
+
+static inline bool json_capture_get_varint(FILE* f, uint64_t* v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) return false;
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+static inline bool json_capture_open(JsonCapture* c, const char* base)
+{
+    memset(c, 0, sizeof(*c));
+    c->data = json_capture_fopen(base, ".data", "wb");
+    c->feeds = json_capture_fopen(base, ".feeds", "wb");
+    if (!c->data || !c->feeds ||
+        fwrite(JSON_CAPTURE_MAGIC, 1, 4, c->feeds) != 4 || putc(JSON_CAPTURE_VERSION, c->feeds) == EOF) {
+        if (c->data) fclose(c->data);
+        if (c->feeds) fclose(c->feeds);
+        c->data = c->feeds = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* Records one chunk as it arrives */
+static inline bool json_capture_chunk(JsonCapture* c, const char* data, uint64_t len)
+{
+    uint64_t now = json_capture_now();
+    uint64_t delta = c->chunks ? now - c->last_ns : 0;
+    c->last_ns = now;
+    c->chunks++;
+    c->bytes += len;
+    return json_capture_put_varint(c->feeds, len) && json_capture_put_varint(c->feeds, delta) &&
+           (!len || fwrite(data, 1, (size_t)len, c->data) == (size_t)len);
+}
+
+/* json_feed() that records the chunk first; a failed record does not stop the parse */
+static inline bool json_capture_feed(JsonCapture* c, JsonParser* p, const char* data, uint64_t len)
+{
+    json_capture_chunk(c, data, len);
+    return json_feed(p, data, len);
+}
+
+static inline bool json_capture_close(JsonCapture* c)
+{
+    bool ok = true;
+    if (c->data && fclose(c->data) != 0) ok = false;
+    if (c->feeds && fclose(c->feeds) != 0) ok = false;
+    c->data = c->feeds = NULL;
+    return ok;
+}
+
+static inline void json_feedtrace_free(JsonFeedTrace* t)
+{
+    free(t->data);
+    free(t->chunk_len);
+    free(t->arrival_ns);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Loads <base>.data and <base>.feeds; false if either is missing or they disagree on the length */
+static inline bool json_feedtrace_load(JsonFeedTrace* t, const char* base)
+{
+    memset(t, 0, sizeof(*t));
+    FILE* feeds = json_capture_fopen(base, ".feeds", "rb");
+    FILE* data = json_capture_fopen(base, ".data", "rb");
+    bool ok = feeds && data;
+
+    char magic[5];
+    ok = ok && fread(magic, 1, 5, feeds) == 5 && memcmp(magic, JSON_CAPTURE_MAGIC, 4) == 0 &&
+         magic[4] == JSON_CAPTURE_VERSION;
+
+    uint64_t cap = 0, at = 0, len, delta;
+    while (ok && json_capture_get_varint(feeds, &len)) {
+        if (!json_capture_get_varint(feeds, &delta)) { ok = false; break; }
+        if (t->chunks == cap) {
+            cap = cap ? cap * 2 : 1024;
+            uint64_t* l = realloc(t->chunk_len, cap * sizeof(uint64_t));
+            if (l) t->chunk_len = l;
+            uint64_t* a = realloc(t->arrival_ns, cap * sizeof(uint64_t));
+            if (a) t->arrival_ns = a;
+            if (!l || !a) { ok = false; break; }
+        }
+        at += delta;
+        t->chunk_len[t->chunks] = len;
+        t->arrival_ns[t->chunks++] = at;
+        t->len += len;
+    }
+
+    if (ok) {
+        t->data = malloc(t->len + 1);
+        ok = t->data && fread(t->data, 1, (size_t)t->len, data) == t->len && getc(data) == EOF;
+        if (ok) t->data[t->len] = '\0';
+    }
+    if (feeds) fclose(feeds);
+    if (data) fclose(data);
+    if (!ok) json_feedtrace_free(t);
+    return ok;
+}
+
+#endif /* CEJSON_CAPTURE_H */
@@ -0,0 +1,302 @@
+/* cejson-export.c – stream NDJSON into CSV/TSV: projection per record, parallel
+   batches, rows written in input order through the NDJSON writer */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cejson.h"
+#include "cejson-alloc.h"
+#include "cejson-ndjson.h"
+#include "cejson-export.h"
+
+#define BLOCK_SIZE  (4 * 1024 * 1024)
+#define MAX_COLUMNS 1024
+
+/* A run of whole input lines; seq orders the output */
+typedef struct Block {
+    struct Block* next;
+    char*         data;
+    uint64_t      len, cap;
+    uint64_t      seq;
+} Block;
+
+typedef struct {
+    pthread_mutex_t mu;
+    pthread_cond_t  has_work;       /* workers wait for blocks */
+    pthread_cond_t  has_free;       /* the reader waits for an empty block */
+    Block*          work_head;
+    Block*          work_tail;
+    Block*          free;
+    bool            done;
+
+    const JsonProjection* proj;
+    JsonExportFormat      fmt;
+    JsonNdjsonWriter*     out;
+    atomic_uint_fast64_t  rows, failed;
+} Pipeline;
+
+typedef struct {
+    Pipeline*         pl;
+    JsonParserBuffers bufs;
+    pthread_t         tid;
+} Worker;
+
+static bool ensure_buffers(Worker* w, uint64_t line_len)
+{
+    /* worst case is one node per two input bytes ("[1,1,...") */
+    uint64_t need = line_len / 2 + 64;
+    if (w->bufs.nodes_cap >= need) return true;
+    json_free_parser_buffers(&w->bufs);
+    return json_alloc_parser_buffers(&w->bufs, need, need, JSON_ALLOC_DEFAULT);
+}
+
+static void export_block(Worker* w, JsonNdjsonLocal* l, const JsonNode** cells, StringBuf* scratch, const Block* b)
+{
+    Pipeline* pl = w->pl;
+    uint64_t rows = 0, failed = 0;
+    const char* s = b->data;
+    const char* end = b->data + b->len;
+
+    json_ndjson_begin(l, b->seq);
+    while (s < end) {
+        const char* nl = memchr(s, '\n', (size_t)(end - s));
+        const char* e = nl ? nl : end;
+        const char* t = s;
+        while (t < e && (*t == ' ' || *t == '\t' || *t == '\r')) t++;
+        if (t == e) { s = e + 1; continue; }
+
+        JsonParser p;
+        uint64_t len = (uint64_t)(e - s);
+        if (!ensure_buffers(w, len)) { failed++; s = e + 1; continue; }
+        json_init_buffers(&p, &w->bufs);
+        p.quiet = true;             /* bad lines are counted, not printed */
+        if (!json_feed(&p, s, len) || !json_finish(&p)) { failed++; s = e + 1; continue; }
+        p.buffer = s;
+
+        StringBuf* sb = json_ndjson_buf(l);
+        ssize_t mark = sb ? sb->size : 0;
+        if (sb && json_export_row(sb, pl->proj, &p, NULL, pl->fmt, cells, scratch)) {
+            json_ndjson_record_done(l);
+            rows++;
+        } else {
+            if (sb) { sb->size = mark; sb->data[mark] = '\0'; }
+            failed++;
+        }
+        s = e + 1;
+    }
+    json_ndjson_end(l);
+    atomic_fetch_add(&pl->rows, rows);
+    atomic_fetch_add(&pl->failed, failed);
+}
+
+static void* worker_main(void* arg)
+{
+    Worker* w = arg;
+    Pipeline* pl = w->pl;
+    JsonNdjsonLocal l;
+    StringBuf scratch;
+    const JsonNode** cells = malloc(pl->proj->n_columns * sizeof(*cells));
+    json_ndjson_local_init(&l, pl->out);
+    stringbuf_init(&scratch, 4096);
+
+    for (;;) {
+        pthread_mutex_lock(&pl->mu);
+        while (!pl->work_head && !pl->done) pthread_cond_wait(&pl->has_work, &pl->mu);
+        Block* b = pl->work_head;
+        if (b) {
+            pl->work_head = b->next;
+            if (!pl->work_head) pl->work_tail = NULL;
+        }
+        pthread_mutex_unlock(&pl->mu);
+        if (!b) break;
+
+        if (cells) export_block(w, &l, cells, &scratch, b);
+        else { json_ndjson_begin(&l, b->seq); json_ndjson_end(&l); }
+
+        pthread_mutex_lock(&pl->mu);
+        b->next = pl->free;
+        pl->free = b;
+        pthread_cond_signal(&pl->has_free);
+        pthread_mutex_unlock(&pl->mu);
+    }
+
+    json_ndjson_local_free(&l);
+    stringbuf_free(&scratch);
+    free(cells);
+    return NULL;
+}
+
+/* Reads every input into blocks and queues them; returns false on a read error */
+static bool read_inputs(Pipeline* pl, char** files, int n_files, uint64_t* seq)
+{
+    bool ok = true;
+    for (int f = 0; f < (n_files ? n_files : 1); ++f) {
+        const char* path = n_files ? files[f] : "-";
+        int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+        if (fd < 0) { perror(path); ok = false; continue; }
+
+        JsonNdjsonReader r;
+        json_ndjson_reader_init(&r, fd);
+        for (;;) {
+            pthread_mutex_lock(&pl->mu);
+            while (!pl->free) pthread_cond_wait(&pl->has_free, &pl->mu);
+            Block* b = pl->free;
+            pl->free = b->next;
+            pthread_mutex_unlock(&pl->mu);
+
+            JSON_TRACE_BEGIN("read");
+            int64_t n = json_ndjson_read(&r, &b->data, &b->cap);
+            JSON_TRACE_END("read");
+            if (n <= 0) {
+                if (n < 0) { perror(path); ok = false; }
+                pthread_mutex_lock(&pl->mu);
+                b->next = pl->free;
+                pl->free = b;
+                pthread_mutex_unlock(&pl->mu);
+                break;
+            }
+
+            b->len = (uint64_t)n;
+            b->seq = (*seq)++;
+            b->next = NULL;
+            pthread_mutex_lock(&pl->mu);
+            if (pl->work_tail) pl->work_tail->next = b; else pl->work_head = b;
+            pl->work_tail = b;
+            pthread_cond_signal(&pl->has_work);
+            pthread_mutex_unlock(&pl->mu);
+        }
+        json_ndjson_reader_free(&r);
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    return ok;
+}
+
+/* Splits "a,b['x,y'],c" on commas outside brackets, in place */
+static int split_columns(char* spec, const char** cols, int n)
+{
+    int depth = 0;
+    char quote = 0;
+    if (n < MAX_COLUMNS && *spec) cols[n++] = spec;
+    for (char* c = spec; *c; ++c) {
+        if (quote) { if (*c == quote) quote = 0; continue; }
+        if (*c == '\'' || *c == '"') quote = *c;
+        else if (*c == '[') depth++;
+        else if (*c == ']') depth--;
+        else if (*c == ',' && !depth && n < MAX_COLUMNS) { *c = '\0'; cols[n++] = c + 1; }
+    }
+    return n;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s -c col[,col...] [-f csv|tsv] [-H] [-t threads] [-v] [file.ndjson ...]\n", prog);
+    fprintf(stderr, " -c  column paths (a.b, a[0], ['odd.key']); repeatable\n");
+    fprintf(stderr, " -f  output format (default csv)\n");
+    fprintf(stderr, " -H  no header row\n");
+    fprintf(stderr, " -t  worker threads (default: online CPUs)\n");
+    fprintf(stderr, " -v  print row / error counts to stderr\n");
+    fprintf(stderr, "Reads stdin when no file (or -) is given. Output goes to stdout in input order.\n");
+}
+
+int main(int argc, char** argv)
+{
+    static const char* columns[MAX_COLUMNS];
+    int n_columns = 0;
+    JsonExportFormat fmt = JSON_EXPORT_CSV;
+    bool header = true, verbose = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg_start = 1;
+
+    for (; arg_start < argc && argv[arg_start][0] == '-' && argv[arg_start][1]; arg_start++) {
+        if (!strcmp(argv[arg_start], "-c") && arg_start + 1 < argc) n_columns = split_columns(argv[++arg_start], columns, n_columns);
+        else if (!strcmp(argv[arg_start], "-f") && arg_start + 1 < argc) {
+            const char* f = argv[++arg_start];
+            if (!strcmp(f, "csv")) fmt = JSON_EXPORT_CSV;
+            else if (!strcmp(f, "tsv")) fmt = JSON_EXPORT_TSV;
+            else { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[arg_start], "-H")) header = false;
+        else if (!strcmp(argv[arg_start], "-v")) verbose = true;
+        else if (!strcmp(argv[arg_start], "-t") && arg_start + 1 < argc) threads = strtol(argv[++arg_start], NULL, 10);
+        else { usage(argv[0]); return 1; }
+    }
+    if (!n_columns) { usage(argv[0]); return 1; }
+    if (threads < 1) threads = 1;
+
+    JsonProjection proj;
+    if (!json_projection_compile(&proj, columns, (uint32_t)n_columns)) {
+        fprintf(stderr, "Bad column path '%s' at offset %zu\n", columns[proj.bad_column], proj.error_pos);
+        return 1;
+    }
+
+    JsonNdjsonWriter out;
+    if (!json_ndjson_open(&out, STDOUT_FILENO, JSON_NDJSON_ORDERED)) { perror("writer"); return 1; }
+
+    Pipeline pl = { .proj = &proj, .fmt = fmt, .out = &out };
+    pthread_mutex_init(&pl.mu, NULL);
+    pthread_cond_init(&pl.has_work, NULL);
+    pthread_cond_init(&pl.has_free, NULL);
+
+    /* two blocks per worker: one being exported, one queued */
+    long n_blocks = 2 * threads + 1;
+    Block* blocks = calloc((size_t)n_blocks, sizeof(Block));
+    if (!blocks) { perror("calloc"); return 1; }
+    for (long i = 0; i < n_blocks; ++i) {
+        blocks[i].cap = BLOCK_SIZE;
+        blocks[i].data = malloc(BLOCK_SIZE);
+        if (!blocks[i].data) { perror("malloc"); return 1; }
+        blocks[i].next = pl.free;
+        pl.free = &blocks[i];
+    }
+
+    /* the header is batch 0 */
+    uint64_t seq = 0;
+    JsonNdjsonLocal hl;
+    json_ndjson_local_init(&hl, &out);
+    json_ndjson_begin(&hl, seq++);
+    if (header) {
+        StringBuf* sb = json_ndjson_buf(&hl);
+        if (sb && json_export_header(sb, columns, (uint32_t)n_columns, fmt)) json_ndjson_record_done(&hl);
+    }
+    json_ndjson_end(&hl);
+    json_ndjson_local_free(&hl);
+
+    Worker* workers = calloc((size_t)threads, sizeof(Worker));
+    if (!workers) { perror("calloc"); return 1; }
+    long started = 0;
+    for (; started < threads; ++started) {
+        workers[started].pl = &pl;
+        if (pthread_create(&workers[started].tid, NULL, worker_main, &workers[started]) != 0) break;
+    }
+    if (!started) { perror("pthread_create"); return 1; }
+
+    bool ok = read_inputs(&pl, &argv[arg_start], argc - arg_start, &seq);
+
+    pthread_mutex_lock(&pl.mu);
+    pl.done = true;
+    pthread_cond_broadcast(&pl.has_work);
+    pthread_mutex_unlock(&pl.mu);
+    for (long t = 0; t < started; ++t) {
+        pthread_join(workers[t].tid, NULL);
+        json_free_parser_buffers(&workers[t].bufs);
+    }
+    if (!json_ndjson_close(&out)) { perror("write"); ok = false; }
+
+    if (verbose)
+        fprintf(stderr, "%llu rows, %llu bad lines, %llu bytes written\n",
+                (unsigned long long)atomic_load(&pl.rows), (unsigned long long)atomic_load(&pl.failed),
+                (unsigned long long)out.bytes);
+
+    for (long i = 0; i < n_blocks; ++i) free(blocks[i].data);
+    free(blocks);
+    free(workers);
+    json_projection_free(&proj);
+    pthread_cond_destroy(&pl.has_free);
+    pthread_cond_destroy(&pl.has_work);
+    pthread_mutex_destroy(&pl.mu);
+    return ok && !atomic_load(&pl.failed) ? 0 : 2;
+}
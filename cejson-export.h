@@ -0,0 +1,138 @@
+/* cejson-export.h – flatten records into CSV / TSV rows */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_EXPORT_H
+#define CEJSON_EXPORT_H
+
+#include "cejson.h"
+#include "cejson-ndjson.h"
+
+/*
+ * One row per record, one cell per JsonProjection column:
+ *   string     – unescaped to UTF-8, then CSV-quoted / TSV-escaped if needed
+ *   number     – source text
+ *   true/false – as is
+ *   null, missing – empty cell
+ *   object/array – compact JSON text, quoted like a string
+ *
+ * CSV follows RFC 4180: a cell is quoted only if it holds the delimiter, a
+ * quote, CR or LF, and quotes are doubled. TSV uses the \t \n \r \\ escapes.
+ * The scan for "anything special" runs 8 bytes at a time; most cells have
+ * nothing to do and are copied straight from the source buffer.
+ */
+
+typedef enum {
+    JSON_EXPORT_CSV = 0,
+    JSON_EXPORT_TSV
+} JsonExportFormat;
+
+/* Offset of the first byte that needs quoting or escaping (or that is a JSON escape when raw), len if none */
+static inline uint64_t json_export_scan(const char* s, uint64_t len, JsonExportFormat fmt, bool raw)
+{
+    bool csv = fmt == JSON_EXPORT_CSV;
+    uint8_t a = csv ? '"' : '\\';
+    uint8_t b = csv ? ',' : '\\';
+    uint8_t c3 = csv && !raw ? '"' : '\\';
+    uint64_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, s + i, 8);
+        uint64_t hit = json_swar_eq(v, a) | json_swar_eq(v, b) | json_swar_eq(v, c3) | json_swar_ctrl(v);
+        if (hit) return i + (uint64_t)(__builtin_ctzll(hit) >> 3);
+    }
+    for (; i < len; ++i) {
+        uint8_t c = (uint8_t)s[i];
+        if (c == a || c == b || c == c3 || c < 0x20) return i;
+    }
+    return len;
+}
+
+/* Appends s as one cell; raw means s is JSON string content with escapes still in it */
+static inline bool json_export_text(StringBuf* sb, const char* s, uint64_t len, JsonExportFormat fmt, bool raw)
+{
+    uint64_t i = json_export_scan(s, len, fmt, raw);
+    if (i == len) return !len || stringbuf_append(sb, s, (ssize_t)len);
+
+    /* worst case: every source byte doubles, plus the quotes */
+    if (!stringbuf_reserve(sb, sb->size + (ssize_t)(2 * len + 8))) return false;
+    char* o = sb->data + sb->size;
+    bool csv = fmt == JSON_EXPORT_CSV;
+    if (csv) *o++ = '"';
+    memcpy(o, s, i);
+    o += i;
+
+    while (i < len) {
+        char buf[4];
+        int n = 1;
+        buf[0] = s[i];
+        if (raw && s[i] == '\\') n = json_decode_escape(s, len, &i, buf);
+        else i++;
+
+        for (int k = 0; k < n; ++k) {
+            char c = buf[k];
+            if (csv) {
+                if (c == '"') *o++ = '"';
+                *o++ = c;
+            } else if (c == '\t') { *o++ = '\\'; *o++ = 't'; }
+            else if (c == '\n')   { *o++ = '\\'; *o++ = 'n'; }
+            else if (c == '\r')   { *o++ = '\\'; *o++ = 'r'; }
+            else if (c == '\\')   { *o++ = '\\'; *o++ = '\\'; }
+            else *o++ = c;
+        }
+    }
+    if (csv) *o++ = '"';
+    sb->size = o - sb->data;
+    sb->data[sb->size] = '\0';
+    return true;
+}
+
+/* scratch holds the compact JSON of container cells; it is cleared, never freed */
+static inline bool json_export_cell(StringBuf* sb, JsonParser* p, const JsonNode* n, JsonExportFormat fmt, StringBuf* scratch)
+{
+    if (!n) return true;
+    const char* src = n->strval ? n->strval : p->buffer + n->offset;
+    switch (n->type) {
+    case JSON_STRING:
+        return json_export_text(sb, src, n->len, fmt, true);
+    case JSON_NUMBER_INT:
+    case JSON_NUMBER_FLOAT:
+        return stringbuf_append(sb, src, (ssize_t)n->len);
+    case JSON_TRUE:
+        return stringbuf_append(sb, "true", 4);
+    case JSON_FALSE:
+        return stringbuf_append(sb, "false", 5);
+    case JSON_OBJECT:
+    case JSON_ARRAY:
+        stringbuf_clear(scratch);
+        if (json_dump_node_buf(p, n, scratch, 0, false) < 0) return false;
+        return json_export_text(sb, scratch->data, (uint64_t)scratch->size, fmt, false);
+    default:
+        return true;
+    }
+}
+
+static inline char json_export_delim(JsonExportFormat fmt) { return fmt == JSON_EXPORT_CSV ? ',' : '\t'; }
+
+/* Column names as given to json_projection_compile() */
+static inline bool json_export_header(StringBuf* sb, const char* const* columns, uint32_t n, JsonExportFormat fmt)
+{
+    for (uint32_t i = 0; i < n; ++i) {
+        if (i && !stringbuf_append_char(sb, json_export_delim(fmt))) return false;
+        if (!json_export_text(sb, columns[i], strlen(columns[i]), fmt, false)) return false;
+    }
+    return stringbuf_append_char(sb, '\n');
+}
+
+/* One row for the record at root (NULL = document root). cells has pj->n_columns slots. */
+static inline bool json_export_row(StringBuf* sb, const JsonProjection* pj, JsonParser* p, const JsonNode* root,
+                                   JsonExportFormat fmt, const JsonNode** cells, StringBuf* scratch)
+{
+    json_projection_resolve(pj, p, root, cells);
+    for (uint32_t i = 0; i < pj->n_columns; ++i) {
+        if (i && !stringbuf_append_char(sb, json_export_delim(fmt))) return false;
+        if (!json_export_cell(sb, p, cells[i], fmt, scratch)) return false;
+    }
+    return stringbuf_append_char(sb, '\n');
+}
+
+#endif /* CEJSON_EXPORT_H */
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <time.h>
 #include "cejson.h"
+#include "cejson-alloc.h"
+#include "cejson-pipeline.h"
 
 static inline uint64_t json_estimate_node_count(uint64_t input_bytes)
 {
@@ -18,12 +20,21 @@ static inline uint64_t json_estimate_node_count(uint64_t input_bytes)
     return nodes;
 }
 
+static const char* scan_name(uint8_t scan)
+{
+    static const char* const names[] = { "plain", "strings", "ws", "strings+ws" };
+    return names[scan & (JSON_SCAN_STRINGS | JSON_SCAN_WS)];
+}
+
 int main(int argc, char **argv)
 {
     srand(time(NULL));
     bool dump_json = false;
     bool network_emulation = false;
     bool verbose = false;
+    bool adaptive = false;
+    const char* tape_dir = NULL;
+    bool pipelined = false;
 
     /* Parse options */
     int arg_start = 1;
@@ -31,17 +42,23 @@ int main(int argc, char **argv)
         if (strcmp(argv[i], "-d") == 0) { dump_json = true; arg_start++; }
         else if (strcmp(argv[i], "-v") == 0) { verbose = true; arg_start++; }
         else if (strcmp(argv[i], "-nw") == 0) { network_emulation = true; arg_start++; }
+        else if (strcmp(argv[i], "-a") == 0) { adaptive = true; arg_start++; }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) { tape_dir = argv[++i]; arg_start += 2; }
+        else if (strcmp(argv[i], "-p") == 0) { pipelined = true; arg_start++; }
         else if (argv[i][0] == '-') {
-            fprintf(stderr, "Usage: %s [-d] [-nw] [-v] <file1.json> [file2.json ...]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-a] [-d] [-nw] [-p] [-t dir] [-v] <file1.json> [file2.json ...]\n", argv[0]);
+            fprintf(stderr, " -a  adaptive feed: pick scan fast paths from sampled input\n");
             fprintf(stderr, " -d  dump pretty-printed JSON\n");
             fprintf(stderr, " -nw network emulation (8–4096 byte chunks)\n");
+            fprintf(stderr, " -p  pipelined: read + index on a second thread while this one parses\n");
+            fprintf(stderr, " -t  parse into a file-backed tape in dir (documents bigger than RAM)\n");
             fprintf(stderr, " -v  verbose output\n");
             return 1;
         } else break;
     }
 
     if (arg_start >= argc) {
-        fprintf(stderr, "Usage: %s [-v] [-d] [-nw] <file1.json> [file2.json ...]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-a] [-v] [-d] [-nw] [-p] [-t dir] <file1.json> [file2.json ...]\n", argv[0]);
         return 1;
     }
 
@@ -66,44 +83,70 @@ int main(int argc, char **argv)
 
         /* Smart pre-allocation based on file size */
         uint64_t estimated_nodes = json_estimate_node_count(total_len);
-        uint64_t node_cap  = estimated_nodes;
-        uint64_t stack_cap = estimated_nodes / 8 + 1024;  /* Stack depth rarely > nodes/8 */
-
-        JsonNode *nodes = malloc(node_cap * sizeof(JsonNode));
-        uint32_t *stack = malloc(stack_cap * sizeof(uint32_t));
-        uint8_t  *expecting_key_stack = malloc(stack_cap * sizeof(uint8_t));
+        uint64_t node_cap  = tape_dir ? 64 : estimated_nodes;   /* the tape grows by itself */
 
-        if (!nodes || !stack || !expecting_key_stack) {
+        /* Huge-page, NUMA-local buffers: big tapes are TLB-bound otherwise. Compact
+           nesting (stack_cap 0) grows as deep as the file goes. */
+        JsonParserBuffers bufs;
+        if (!json_alloc_parser_buffers(&bufs, node_cap, 0, JSON_ALLOC_DEFAULT)) {
             fprintf(stderr, "Failed to allocate parser buffers for %s (~%llu nodes)\n",
                     filename, (unsigned long long)estimated_nodes);
-            free(nodes); free(stack); free(expecting_key_stack);
             fclose(fp);
             continue;
         }
 
-        char *full_json = malloc(total_len + 1);
+        char *full_json = json_alloc_large(total_len + 1, JSON_ALLOC_DEFAULT);
         if (!full_json) {
             printf("Malloc failed for %s (%llu bytes)\n", filename, (unsigned long long)total_len);
-            free(nodes); free(stack); free(expecting_key_stack);
+            json_free_parser_buffers(&bufs);
             fclose(fp);
             continue;
         }
 
-        size_t read_len = fread(full_json, 1, total_len, fp);
-        fclose(fp);
+        /* pipelined: stage A reads the file while the parse runs */
+        JSON_TRACE_BEGIN("read");
+        size_t read_len = pipelined ? total_len : fread(full_json, 1, total_len, fp);
+        JSON_TRACE_END("read");
 
         if (read_len != total_len) {
+            fclose(fp);
             printf("Read failed for %s\n", filename);
-            free(full_json); free(nodes); free(stack); free(expecting_key_stack);
+            json_free_large(full_json, total_len + 1); json_free_parser_buffers(&bufs);
             continue;
         }
         full_json[total_len] = '\0';
 
         JsonParser p = {0,0};
-        json_init(&p, nodes, node_cap, stack, stack_cap, expecting_key_stack);
+        json_init_buffers(&p, &bufs);
+        JsonTape tape = { .fd = -1 };
+        if (tape_dir) {
+            if (!json_tape_open(&tape, tape_dir, 0)) {
+                perror("json_tape_open");
+                fclose(fp);
+                json_free_large(full_json, total_len + 1); json_free_parser_buffers(&bufs);
+                continue;
+            }
+            json_tape_attach(&p, &tape);
+        }
 
         clock_t start = clock();
+        struct timespec wall_start, wall_end;
+        clock_gettime(CLOCK_MONOTONIC, &wall_start);
         size_t offset = 0;
+        JSON_TRACE_BEGIN("parse");
+
+        bool parse_ok = false;
+        if (pipelined) {
+            JsonPipeline pl;
+            /* stdio may have read ahead while sizing the file; stage A reads the fd from the start */
+            if (lseek(fileno(fp), 0, SEEK_SET) != 0 || !json_pipe_start(&pl, fileno(fp), full_json, total_len)) perror("json_pipe_start");
+            else if (!(parse_ok = json_pipe_parse(&pl, &p))) {
+                if (pl.error) printf("Read failed for %s: %s\n", filename, strerror(pl.error));
+                else printf("Parse error %s at pos %llu in %s\n", JsonErrorStr[p.error], (unsigned long long)p.error_pos, filename);
+            }
+            offset = total_len;
+        }
+        fclose(fp);
 
         while (offset < total_len) {
             size_t remaining = total_len - offset;
@@ -113,7 +156,9 @@ int main(int argc, char **argv)
 
             if (chunk_size > remaining) chunk_size = remaining;
 
-            if (!json_feed(&p, full_json + offset, chunk_size)) {
+            bool fed = adaptive ? json_feed_auto(&p, full_json + offset, chunk_size)
+                                : json_feed(&p, full_json + offset, chunk_size);
+            if (!fed) {
                 if (p.error) {
                     printf("Parse error %s at pos %llu in %s\n",
                            JsonErrorStr[p.error], p.error_pos, filename);
@@ -123,27 +168,33 @@ int main(int argc, char **argv)
             offset += chunk_size;
         }
 
-        bool parse_ok = false;
-        if (!p.error) {
+        if (!pipelined && !p.error) {
             parse_ok = json_finish(&p);
             if (!parse_ok) {
                 printf("JSON incomplete or invalid in %s\n", filename);
             }
         }
 
+        JSON_TRACE_END("parse");
+        if (tape_dir) json_tape_parsed(&tape);
         clock_t end = clock();
-        double cpu_time = ((double)(end - start)) / CLOCKS_PER_SEC;
+        clock_gettime(CLOCK_MONOTONIC, &wall_end);
+        /* two threads: CPU time would count both stages */
+        double cpu_time = pipelined ? (double)(wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9
+                                    : ((double)(end - start)) / CLOCKS_PER_SEC;
         double mb = total_len / (1024.0 * 1024.0);
         double speed = cpu_time > 0.0 ? mb / cpu_time : 0.0;
 
         if (parse_ok && verbose) {
-            fprintf(stderr, "Parsed %s to %llu nodes (%llu allocated) | %.2f MB/s (%.3f sec) | alloc: %llu nodes [%s]\n",
+            fprintf(stderr, "Parsed %s to %llu nodes (%llu allocated) | %.2f MB/s (%.3f sec) | alloc: %llu nodes [%s%s%s]\n",
                     filename,
                     (unsigned long long)p.nodes_len,
 					estimated_nodes,
                     speed, cpu_time,
-                    (unsigned long long)node_cap,
-                    network_emulation ? "net emu" : "full speed");
+                    (unsigned long long)(tape_dir ? tape.cap : node_cap),
+                    pipelined ? "pipelined" : network_emulation ? "net emu" : "full speed",
+                    adaptive ? ", scan: " : "",
+                    adaptive ? scan_name(p.scan) : "");
         }
 
         if (parse_ok && dump_json) {
@@ -156,10 +207,9 @@ int main(int argc, char **argv)
 			}
         }
 
-        free(full_json);
-        free(nodes);
-        free(stack);
-        free(expecting_key_stack);
+        json_tape_close(&tape);
+        json_free_large(full_json, total_len + 1);
+        json_free_parser_buffers(&bufs);
     }
 
     return 0;
@@ -0,0 +1,243 @@
+/* cejson-http.h – feed a Transfer-Encoding: chunked body to json_feed() straight from the receive buffers */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_HTTP_H
+#define CEJSON_HTTP_H
+
+#include "cejson.h"
+
+/*
+ * The de-framer walks chunk-size lines, extensions, CRLFs and trailers as
+ * they arrive, split anywhere across receive buffers, and hands each chunk's
+ * payload bytes to json_feed() where they lie. The body is never reassembled.
+ * Node offsets count body bytes, framing excluded.
+ *
+ *     JsonHttpChunked h;
+ *     json_http_init(&h, true);
+ *     for (each recv()'d buffer) {
+ *         int64_t used = json_http_feed(&h, &p, buf, n);
+ *         if (used < 0) -> 400 (h.error: framing, p.error: JSON)
+ *         if (h.state == JSON_HTTP_DONE) -> buf + used starts the next request
+ *     }
+ *     json_http_finish(&h, &p);
+ *
+ * With keep_segments, every payload span is recorded (body offset, pointer,
+ * length) so values can be read without a contiguous copy:
+ * json_http_text() returns a pointer into the receive buffer a value lies in,
+ * and copies only values that straddle two chunks. Those buffers must then
+ * outlive the lookups. json_http_flatten() builds the contiguous body for
+ * code that wants p->buffer (serialize, path queries) and is the only copy.
+ */
+
+typedef enum {
+    JSON_HTTP_SIZE = 0,             /* hex digits of the chunk size */
+    JSON_HTTP_EXT,                  /* ;name=value extensions, skipped */
+    JSON_HTTP_SIZE_LF,
+    JSON_HTTP_DATA,
+    JSON_HTTP_DATA_CR,
+    JSON_HTTP_DATA_LF,
+    JSON_HTTP_TRAILER,              /* trailer field lines after the last chunk */
+    JSON_HTTP_TRAILER_LF,
+    JSON_HTTP_DONE
+} JsonHttpState;
+
+#define JSON_HTTP_ERR_NONE      0
+#define JSON_HTTP_ERR_FRAMING   1   /* not valid chunked framing */
+#define JSON_HTTP_ERR_SIZE      2   /* chunk size over 2^60 */
+#define JSON_HTTP_ERR_NOMEM     3
+
+typedef struct {
+    uint64_t    off;                /* body offset */
+    const char* data;
+    uint64_t    len;
+} JsonHttpSeg;
+
+typedef struct {
+    JsonHttpState state;
+    uint64_t    remaining;          /* chunk size while reading it, then payload bytes left */
+    uint32_t    digits;
+    uint32_t    line_len;           /* current trailer line */
+    uint64_t    body_len;
+    uint64_t    chunks;
+    int         error;
+
+    bool        keep_segments;
+    JsonHttpSeg* segs;
+    uint64_t    segs_len, segs_cap;
+} JsonHttpChunked;
+
+static inline void json_http_init(JsonHttpChunked* h, bool keep_segments)
+{
+    memset(h, 0, sizeof(*h));
+    h->keep_segments = keep_segments;
+}
+
+/* Ready for the next body; the segment table is kept for reuse */
+static inline void json_http_reset(JsonHttpChunked* h)
+{
+    JsonHttpSeg* segs = h->segs;
+    uint64_t cap = h->segs_cap;
+    bool keep = h->keep_segments;
+    memset(h, 0, sizeof(*h));
+    h->keep_segments = keep;
+    h->segs = segs;
+    h->segs_cap = cap;
+}
+
+static inline void json_http_free(JsonHttpChunked* h)
+{
+    free(h->segs);
+    memset(h, 0, sizeof(*h));
+}
+
+static inline bool json_http_add_seg(JsonHttpChunked* h, const char* data, uint64_t len)
+{
+    if (h->segs_len && h->segs[h->segs_len - 1].data + h->segs[h->segs_len - 1].len == data) {
+        h->segs[h->segs_len - 1].len += len;        /* same buffer, no framing between */
+        return true;
+    }
+    if (h->segs_len == h->segs_cap) {
+        uint64_t cap = h->segs_cap ? h->segs_cap * 2 : 16;
+        JsonHttpSeg* s = realloc(h->segs, cap * sizeof(JsonHttpSeg));
+        if (!s) return false;
+        h->segs = s;
+        h->segs_cap = cap;
+    }
+    h->segs[h->segs_len++] = (JsonHttpSeg){ h->body_len, data, len };
+    return true;
+}
+
+static inline int json_http_hex(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * De-frames data[0..len) and feeds the payload to p. Returns the bytes used:
+ * len, or less once the terminating chunk and trailers are complete (the rest
+ * belongs to the next message). -1 on a framing error (h->error) or when
+ * json_feed() fails (p->error).
+ */
+static inline int64_t json_http_feed(JsonHttpChunked* h, JsonParser* p, const char* data, uint64_t len)
+{
+    uint64_t pos = 0;
+    if (h->error) return -1;
+    while (pos < len && h->state != JSON_HTTP_DONE) {
+        if (h->state == JSON_HTTP_DATA) {
+            uint64_t n = len - pos < h->remaining ? len - pos : h->remaining;
+            if (h->keep_segments && !json_http_add_seg(h, data + pos, n)) { h->error = JSON_HTTP_ERR_NOMEM; return -1; }
+            if (!json_feed(p, data + pos, n)) return -1;
+            h->body_len += n;
+            h->remaining -= n;
+            pos += n;
+            if (!h->remaining) h->state = JSON_HTTP_DATA_CR;
+            continue;
+        }
+
+        char c = data[pos++];
+        switch (h->state) {
+        case JSON_HTTP_SIZE: {
+            int d = json_http_hex(c);
+            if (d >= 0) {
+                if (h->remaining >> 60) { h->error = JSON_HTTP_ERR_SIZE; return -1; }
+                h->remaining = h->remaining << 4 | (uint64_t)d;
+                h->digits++;
+                break;
+            }
+            if (!h->digits) goto bad;
+            if (c == ';' || c == ' ' || c == '\t') h->state = JSON_HTTP_EXT;
+            else if (c == '\r') h->state = JSON_HTTP_SIZE_LF;
+            else goto bad;
+            break;
+        }
+        case JSON_HTTP_EXT:
+            if (c == '\r') h->state = JSON_HTTP_SIZE_LF;
+            else if (c == '\n') goto bad;
+            break;
+        case JSON_HTTP_SIZE_LF:
+            if (c != '\n') goto bad;
+            h->digits = 0;
+            h->chunks++;
+            h->state = h->remaining ? JSON_HTTP_DATA : JSON_HTTP_TRAILER;
+            break;
+        case JSON_HTTP_DATA_CR:
+            if (c != '\r') goto bad;
+            h->state = JSON_HTTP_DATA_LF;
+            break;
+        case JSON_HTTP_DATA_LF:
+            if (c != '\n') goto bad;
+            h->state = JSON_HTTP_SIZE;
+            break;
+        case JSON_HTTP_TRAILER:
+            if (c == '\r') h->state = JSON_HTTP_TRAILER_LF;
+            else if (c == '\n') goto bad;
+            else h->line_len++;
+            break;
+        case JSON_HTTP_TRAILER_LF:
+            if (c != '\n') goto bad;
+            h->state = h->line_len ? JSON_HTTP_TRAILER : JSON_HTTP_DONE;
+            h->line_len = 0;
+            break;
+        default:
+            goto bad;
+        }
+    }
+    return (int64_t)pos;
+
+bad:
+    h->error = JSON_HTTP_ERR_FRAMING;
+    return -1;
+}
+
+/* The body is complete and is one JSON document */
+static inline bool json_http_finish(JsonHttpChunked* h, JsonParser* p)
+{
+    if (h->error) return false;
+    if (h->state != JSON_HTTP_DONE) { h->error = JSON_HTTP_ERR_FRAMING; return false; }
+    return json_finish(p);
+}
+
+/* Body bytes [off, off + len): a pointer into the receive buffer holding them, or a copy in scratch if they span two */
+static inline const char* json_http_text(const JsonHttpChunked* h, uint64_t off, uint64_t len, StringBuf* scratch)
+{
+    if (!h->segs_len || off + len > h->body_len) return NULL;
+    uint64_t lo = 0, hi = h->segs_len - 1;
+    while (lo < hi) {                           /* last segment starting at or before off */
+        uint64_t mid = (lo + hi + 1) / 2;
+        if (h->segs[mid].off <= off) lo = mid;
+        else hi = mid - 1;
+    }
+    const JsonHttpSeg* s = &h->segs[lo];
+    if (off + len <= s->off + s->len) return s->data + (off - s->off);
+
+    if (!stringbuf_reserve(scratch, (ssize_t)len + 1)) return NULL;
+    scratch->size = 0;
+    for (uint64_t at = off; at < off + len; ++s) {
+        uint64_t skip = at - s->off, n = s->len - skip;
+        if (n > off + len - at) n = off + len - at;
+        memcpy(scratch->data + scratch->size, s->data + skip, n);
+        scratch->size += (ssize_t)n;
+        at += n;
+    }
+    scratch->data[scratch->size] = '\0';
+    return scratch->data;
+}
+
+/* A node's source text (a string's without the quotes) */
+static inline const char* json_http_node_text(const JsonHttpChunked* h, const JsonNode* n, StringBuf* scratch)
+{
+    return json_http_text(h, n->offset, n->len, scratch);
+}
+
+/* Copies the body into out (body_len bytes) and points p at it, for code that reads p->buffer */
+static inline void json_http_flatten(const JsonHttpChunked* h, JsonParser* p, char* out)
+{
+    for (uint64_t i = 0; i < h->segs_len; ++i) memcpy(out + h->segs[i].off, h->segs[i].data, h->segs[i].len);
+    p->buffer = out;
+    p->buf_len = h->body_len;
+}
+
+#endif /* CEJSON_HTTP_H */
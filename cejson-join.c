@@ -0,0 +1,546 @@
+/* cejson-join.c – join an NDJSON stream against a (smaller) NDJSON build file on
+   a key path. The build side goes into a hash table of byte spans; the probe
+   side is parsed in parallel and matched members are spliced in as raw text.
+   A build file larger than the memory budget is hash-partitioned to disk
+   together with the probe side and joined one partition at a time. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cejson.h"
+#include "cejson-alloc.h"
+#include "cejson-ndjson.h"
+#include "cejson-join.h"
+
+#define BLOCK_SIZE      (4 * 1024 * 1024)
+#define DEFAULT_MEMORY  (1024ULL * 1024 * 1024)
+#define PART_BUF        (256 * 1024)     /* most buffered per worker and partition before a write */
+#define MIN_PART_BUF    (16 * 1024)
+#define MAX_PARTS       1024
+#define MAX_FIELDS      256
+
+typedef struct Block {
+    struct Block* next;
+    char*         data;
+    uint64_t      len, cap;
+    uint64_t      seq;
+} Block;
+
+typedef struct Worker Worker;
+
+/* One parallel pass over an input: the reader queues blocks, workers run process() on them */
+typedef struct {
+    pthread_mutex_t mu;
+    pthread_cond_t  has_work;
+    pthread_cond_t  has_free;
+    Block*          work_head;
+    Block*          work_tail;
+    Block*          free;
+    bool            done;
+    void          (*process)(Worker*, Block*);
+
+    /* probe */
+    const JsonJoinTable*  table;
+    const JsonProjection* probe_key;
+    bool                  outer;
+    JsonNdjsonWriter*     out;
+
+    /* partition */
+    const JsonProjection* part_key;
+    int*                  part_fds;
+    pthread_mutex_t*      part_mu;
+    uint32_t              n_parts;
+    uint64_t              part_buf;     /* flush threshold, from the -M budget */
+
+    atomic_uint_fast64_t  records, matched, emitted, failed;
+} Pass;
+
+struct Worker {
+    Pass*             pass;
+    JsonParserBuffers bufs;
+    JsonNdjsonLocal   local;
+    StringBuf         scratch;
+    StringBuf*        parts;        /* partition mode: one buffer per partition */
+    uint8_t*          key;
+    uint64_t          key_cap;
+    pthread_t         tid;
+};
+
+/* ------------------------------------------------------------------ */
+
+static bool write_all(int fd, const char* s, uint64_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, s, (size_t)len);
+        if (n < 0) return false;
+        s += n;
+        len -= (uint64_t)n;
+    }
+    return true;
+}
+
+/* Parses one line and encodes the key at kp into w->key; false if the line doesn't parse */
+static bool parse_key(Worker* w, JsonParser* p, const JsonProjection* kp, const char* line, uint64_t len, uint32_t* key_len)
+{
+    uint64_t need = len / 2 + 64;
+    if (w->bufs.nodes_cap < need) {
+        json_free_parser_buffers(&w->bufs);
+        if (!json_alloc_parser_buffers(&w->bufs, need, need, JSON_ALLOC_DEFAULT)) return false;
+    }
+    if (w->key_cap < len + 16) {
+        free(w->key);
+        w->key_cap = len + 16;
+        if (!(w->key = malloc(w->key_cap))) { w->key_cap = 0; return false; }
+    }
+    json_init_buffers(p, &w->bufs);
+    p->quiet = true;                /* unparseable records are counted, not printed */
+    if (!json_feed(p, line, len) || !json_finish(p)) return false;
+    p->buffer = line;
+
+    const JsonNode* cell;
+    json_projection_resolve(kp, p, NULL, &cell);
+    *key_len = json_key_encode(p, cell, w->key, &w->scratch);
+    return true;
+}
+
+/* Steps *s over the next non-blank line in [*s, end); false when there is none left */
+static bool next_line(const char** s, const char* end, const char** line, uint64_t* len)
+{
+    while (*s < end) {
+        const char* nl = memchr(*s, '\n', (size_t)(end - *s));
+        const char* e = nl ? nl : end;
+        const char* t = *s;
+        *line = *s;
+        *s = e + 1;
+        while (t < e && (*t == ' ' || *t == '\t' || *t == '\r')) t++;
+        if (t < e) { *len = (uint64_t)(e - *line); return true; }
+    }
+    return false;
+}
+
+static void probe_block(Worker* w, Block* b)
+{
+    Pass* ps = w->pass;
+    uint64_t records = 0, matched = 0, emitted = 0, failed = 0, len;
+    const char *s = b->data, *end = b->data + b->len, *line;
+
+    json_ndjson_begin(&w->local, b->seq);
+    while (next_line(&s, end, &line, &len)) {
+        JsonParser p;
+        uint32_t klen;
+        records++;
+        if (!parse_key(w, &p, ps->probe_key, line, len, &klen)) {
+            failed++;
+            continue;
+        }
+
+        /* like SQL, a null or missing key matches nothing */
+        uint64_t h = json_join_hash(w->key, klen);
+        uint32_t r = w->key[0] == JSON_KEY_NULL ? JSON_JOIN_NONE : json_join_find(ps->table, w->key, klen, h);
+        if (r == JSON_JOIN_NONE) {
+            if (ps->outer) { json_ndjson_write_raw(&w->local, line, len); emitted++; }
+            continue;
+        }
+        matched++;
+        for (; r != JSON_JOIN_NONE; r = json_join_next(ps->table, r, w->key, klen, h)) {
+            StringBuf* sb = json_ndjson_buf(&w->local);
+            ssize_t mark = sb ? sb->size : 0;
+            if (sb && json_join_splice(sb, &p, ps->table, r)) {
+                json_ndjson_record_done(&w->local);
+                emitted++;
+            } else {
+                if (sb) { sb->size = mark; sb->data[mark] = '\0'; }
+                failed++;
+                break;
+            }
+        }
+    }
+    json_ndjson_end(&w->local);
+    atomic_fetch_add(&ps->records, records);
+    atomic_fetch_add(&ps->matched, matched);
+    atomic_fetch_add(&ps->emitted, emitted);
+    atomic_fetch_add(&ps->failed, failed);
+}
+
+static bool flush_part(Pass* ps, uint32_t i, StringBuf* sb)
+{
+    if (!sb->size) return true;
+    pthread_mutex_lock(&ps->part_mu[i]);
+    bool ok = write_all(ps->part_fds[i], sb->data, (uint64_t)sb->size);
+    pthread_mutex_unlock(&ps->part_mu[i]);
+    stringbuf_clear(sb);
+    return ok;
+}
+
+/* Routes each line to partition (key hash >> 40) % n; unparseable lines go to partition 0 */
+static void partition_block(Worker* w, Block* b)
+{
+    Pass* ps = w->pass;
+    uint64_t records = 0, failed = 0, len;
+    const char *s = b->data, *end = b->data + b->len, *line;
+
+    while (next_line(&s, end, &line, &len)) {
+        JsonParser p;
+        uint32_t klen;
+        uint32_t part = 0;
+        records++;
+        if (parse_key(w, &p, ps->part_key, line, len, &klen))
+            part = (uint32_t)((json_join_hash(w->key, klen) >> 40) % ps->n_parts);
+        else
+            failed++;
+        StringBuf* sb = &w->parts[part];
+        /* allocated on first use: a worker only pays for the partitions its records hash to */
+        if ((!sb->data && !stringbuf_init(sb, ps->part_buf + 4096)) ||
+            !stringbuf_append(sb, line, (ssize_t)len) || !stringbuf_append_char(sb, '\n') ||
+            ((uint64_t)sb->size >= ps->part_buf && !flush_part(ps, part, sb)))
+            failed++;
+    }
+    atomic_fetch_add(&ps->records, records);
+    atomic_fetch_add(&ps->failed, failed);
+}
+
+static void* worker_main(void* arg)
+{
+    Worker* w = arg;
+    Pass* ps = w->pass;
+    for (;;) {
+        pthread_mutex_lock(&ps->mu);
+        while (!ps->work_head && !ps->done) pthread_cond_wait(&ps->has_work, &ps->mu);
+        Block* b = ps->work_head;
+        if (b) {
+            ps->work_head = b->next;
+            if (!ps->work_head) ps->work_tail = NULL;
+        }
+        pthread_mutex_unlock(&ps->mu);
+        if (!b) break;
+
+        ps->process(w, b);
+
+        pthread_mutex_lock(&ps->mu);
+        b->next = ps->free;
+        ps->free = b;
+        pthread_cond_signal(&ps->has_free);
+        pthread_mutex_unlock(&ps->mu);
+    }
+    if (w->parts)
+        for (uint32_t i = 0; i < ps->n_parts; ++i) flush_part(ps, i, &w->parts[i]);
+    return NULL;
+}
+
+/* Streams fd through the pass on n_workers threads. *seq numbers the blocks (output order). */
+static bool run_pass(Pass* ps, Worker* workers, long n_workers, int fd, const char* name, uint64_t* seq)
+{
+    bool ok = true;
+    ps->done = false;
+    long started = 0;
+    for (; started < n_workers; ++started) {
+        workers[started].pass = ps;
+        if (pthread_create(&workers[started].tid, NULL, worker_main, &workers[started]) != 0) break;
+    }
+    if (!started) return false;
+
+    JsonNdjsonReader r;
+    json_ndjson_reader_init(&r, fd);
+    for (;;) {
+        pthread_mutex_lock(&ps->mu);
+        while (!ps->free) pthread_cond_wait(&ps->has_free, &ps->mu);
+        Block* b = ps->free;
+        ps->free = b->next;
+        pthread_mutex_unlock(&ps->mu);
+
+        JSON_TRACE_BEGIN("read");
+        int64_t n = json_ndjson_read(&r, &b->data, &b->cap);
+        JSON_TRACE_END("read");
+        if (n <= 0) {
+            if (n < 0) { perror(name); ok = false; }
+            pthread_mutex_lock(&ps->mu);
+            b->next = ps->free;
+            ps->free = b;
+            pthread_mutex_unlock(&ps->mu);
+            break;
+        }
+        b->len = (uint64_t)n;
+        b->seq = (*seq)++;
+        b->next = NULL;
+        pthread_mutex_lock(&ps->mu);
+        if (ps->work_tail) ps->work_tail->next = b; else ps->work_head = b;
+        ps->work_tail = b;
+        pthread_cond_signal(&ps->has_work);
+        pthread_mutex_unlock(&ps->mu);
+    }
+    json_ndjson_reader_free(&r);
+
+    pthread_mutex_lock(&ps->mu);
+    ps->done = true;
+    pthread_cond_broadcast(&ps->has_work);
+    pthread_mutex_unlock(&ps->mu);
+    for (long t = 0; t < started; ++t) pthread_join(workers[t].tid, NULL);
+    return ok;
+}
+
+/* Reads a whole file (or what's left of an fd) into memory */
+static char* slurp(int fd, uint64_t* len)
+{
+    uint64_t cap = 1 << 20, n = 0;
+    char* buf = malloc(cap);
+    while (buf) {
+        if (n == cap) {
+            char* mem = realloc(buf, cap * 2);
+            if (!mem) { free(buf); return NULL; }
+            buf = mem;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + n, (size_t)(cap - n));
+        if (r < 0) { free(buf); return NULL; }
+        if (r == 0) break;
+        n += (uint64_t)r;
+    }
+    *len = n;
+    return buf;
+}
+
+static bool build_table(JsonJoinTable* t, const char* data, uint64_t len)
+{
+    JSON_TRACE_SCOPE("build");
+    const char *s = data, *end = data + len, *line;
+    uint64_t n;
+    while (next_line(&s, end, &line, &n))
+        if (!json_join_add(t, line, n)) return false;
+    return json_join_seal(t);
+}
+
+static int make_temp(const char* dir)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/cejson-join-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);
+    return fd;
+}
+
+static uint64_t parse_size(const char* s)
+{
+    char* end;
+    double v = strtod(s, &end);
+    switch (*end) {
+    case 'k': case 'K': v *= 1024; break;
+    case 'm': case 'M': v *= 1024 * 1024; break;
+    case 'g': case 'G': v *= 1024 * 1024 * 1024; break;
+    default: break;
+    }
+    return v > 0 ? (uint64_t)v : 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s -b build.ndjson -k key [-K probe_key] [-f field,...] [-l] [-M size] [-T tmpdir] [-t threads] [-v] [probe.ndjson ...]\n", prog);
+    fprintf(stderr, " -b  build side (the smaller file)\n");
+    fprintf(stderr, " -k  key path in build records (a.b, a[0], ['odd.key'])\n");
+    fprintf(stderr, " -K  key path in probe records (default: same as -k)\n");
+    fprintf(stderr, " -f  build members to splice in (default: all but a top-level key)\n");
+    fprintf(stderr, " -l  left outer join: keep probe records without a match\n");
+    fprintf(stderr, " -M  memory for the build table, e.g. 512M (default 1G); larger builds are partitioned\n");
+    fprintf(stderr, " -T  directory for partition files (default $TMPDIR or /tmp)\n");
+    fprintf(stderr, " -t  worker threads (default: online CPUs)\n");
+    fprintf(stderr, " -v  print counts to stderr\n");
+    fprintf(stderr, "Reads the probe side from stdin when no file (or -) is given.\n");
+}
+
+int main(int argc, char** argv)
+{
+    static const char* fields[MAX_FIELDS];
+    uint32_t n_fields = 0;
+    const char *build_path = NULL, *key = NULL, *probe_key = NULL;
+    const char* tmpdir = getenv("TMPDIR");
+    uint64_t memory = DEFAULT_MEMORY;
+    bool outer = false, verbose = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg_start = 1;
+
+    for (; arg_start < argc && argv[arg_start][0] == '-' && argv[arg_start][1]; arg_start++) {
+        const char* a = argv[arg_start];
+        bool has = arg_start + 1 < argc;
+        if (!strcmp(a, "-b") && has) build_path = argv[++arg_start];
+        else if (!strcmp(a, "-k") && has) key = argv[++arg_start];
+        else if (!strcmp(a, "-K") && has) probe_key = argv[++arg_start];
+        else if (!strcmp(a, "-f") && has) {
+            for (char* f = strtok(argv[++arg_start], ","); f && n_fields < MAX_FIELDS; f = strtok(NULL, ","))
+                fields[n_fields++] = f;
+        }
+        else if (!strcmp(a, "-l")) outer = true;
+        else if (!strcmp(a, "-v")) verbose = true;
+        else if (!strcmp(a, "-M") && has) memory = parse_size(argv[++arg_start]);
+        else if (!strcmp(a, "-T") && has) tmpdir = argv[++arg_start];
+        else if (!strcmp(a, "-t") && has) threads = strtol(argv[++arg_start], NULL, 10);
+        else { usage(argv[0]); return 1; }
+    }
+    if (!build_path || !key || !memory) { usage(argv[0]); return 1; }
+    if (!probe_key) probe_key = key;
+    if (threads < 1) threads = 1;
+    if (!tmpdir || !*tmpdir) tmpdir = "/tmp";
+
+    JsonProjection bkey, pkey;
+    if (!json_projection_compile(&bkey, &key, 1)) { fprintf(stderr, "Bad key path '%s'\n", key); return 1; }
+    if (!json_projection_compile(&pkey, &probe_key, 1)) { fprintf(stderr, "Bad key path '%s'\n", probe_key); return 1; }
+
+    int build_fd = open(build_path, O_RDONLY);
+    struct stat st;
+    if (build_fd < 0 || fstat(build_fd, &st) != 0) { perror(build_path); return 1; }
+
+    /* the table costs roughly as much again as the records it indexes */
+    uint64_t build_bytes = (uint64_t)st.st_size;
+    uint32_t n_parts = 1;
+    if (build_bytes * 2 > memory) {
+        uint64_t want = (build_bytes * 2 + memory - 1) / memory * 2;
+        n_parts = want > MAX_PARTS ? MAX_PARTS : (uint32_t)want;
+    }
+
+    JsonNdjsonWriter out;
+    if (!json_ndjson_open(&out, STDOUT_FILENO, JSON_NDJSON_ORDERED)) { perror("writer"); return 1; }
+
+    Pass ps = { .probe_key = &pkey, .outer = outer, .out = &out, .n_parts = n_parts };
+    pthread_mutex_init(&ps.mu, NULL);
+    pthread_cond_init(&ps.has_work, NULL);
+    pthread_cond_init(&ps.has_free, NULL);
+
+    long n_blocks = 2 * threads + 1;
+    Block* blocks = calloc((size_t)n_blocks, sizeof(Block));
+    Worker* workers = calloc((size_t)threads, sizeof(Worker));
+    if (!blocks || !workers) { perror("calloc"); return 1; }
+    for (long i = 0; i < n_blocks; ++i) {
+        blocks[i].cap = BLOCK_SIZE;
+        if (!(blocks[i].data = malloc(BLOCK_SIZE))) { perror("malloc"); return 1; }
+        blocks[i].next = ps.free;
+        ps.free = &blocks[i];
+    }
+    for (long t = 0; t < threads; ++t) {
+        json_ndjson_local_init(&workers[t].local, &out);
+        if (!stringbuf_init(&workers[t].scratch, 4096)) { perror("malloc"); return 1; }
+    }
+
+    int n_probe = argc - arg_start;
+    uint64_t seq = 0, build_records = 0, build_failed = 0;
+    bool ok = true;
+
+    if (n_parts == 1) {
+        /* everything fits: one table, one parallel pass per probe input */
+        uint64_t len;
+        char* data = slurp(build_fd, &len);
+        JsonJoinTable table;
+        json_join_init(&table, &bkey, n_fields ? fields : NULL, n_fields);
+        if (!data || !build_table(&table, data, len)) { perror(build_path); return 1; }
+        build_records = table.n;
+        build_failed = table.failed;
+        ps.table = &table;
+        ps.process = probe_block;
+
+        for (int f = 0; ok && f < (n_probe ? n_probe : 1); ++f) {
+            const char* path = n_probe ? argv[arg_start + f] : "-";
+            int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+            if (fd < 0) { perror(path); ok = false; break; }
+            ok = run_pass(&ps, workers, threads, fd, path, &seq);
+            if (fd != STDIN_FILENO) close(fd);
+        }
+        json_join_free(&table);
+        free(data);
+    } else {
+        /* Grace join: hash-partition both sides, then join partition by partition */
+        int* build_parts = malloc(n_parts * sizeof(int));
+        int* probe_parts = malloc(n_parts * sizeof(int));
+        ps.part_mu = malloc(n_parts * sizeof(pthread_mutex_t));
+        if (!build_parts || !probe_parts || !ps.part_mu) { perror("malloc"); return 1; }
+        for (uint32_t i = 0; i < n_parts; ++i) {
+            build_parts[i] = make_temp(tmpdir);
+            probe_parts[i] = make_temp(tmpdir);
+            if (build_parts[i] < 0 || probe_parts[i] < 0) { perror(tmpdir); return 1; }
+            pthread_mutex_init(&ps.part_mu[i], NULL);
+        }
+        /* every worker may end up holding a buffer per partition: keep them all within a quarter of -M */
+        ps.part_buf = memory / 4 / ((uint64_t)threads * n_parts);
+        if (ps.part_buf > PART_BUF) ps.part_buf = PART_BUF;
+        if (ps.part_buf < MIN_PART_BUF) ps.part_buf = MIN_PART_BUF;
+        for (long t = 0; t < threads; ++t) {
+            workers[t].parts = calloc(n_parts, sizeof(StringBuf));
+            if (!workers[t].parts) { perror("calloc"); return 1; }
+        }
+
+        uint64_t part_seq = 0;
+        ps.process = partition_block;
+        ps.part_key = &bkey;
+        ps.part_fds = build_parts;
+        JSON_TRACE_BEGIN("partition");
+        ok = run_pass(&ps, workers, threads, build_fd, build_path, &part_seq);
+        ps.part_key = &pkey;
+        ps.part_fds = probe_parts;
+        for (int f = 0; ok && f < (n_probe ? n_probe : 1); ++f) {
+            const char* path = n_probe ? argv[arg_start + f] : "-";
+            int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+            if (fd < 0) { perror(path); ok = false; break; }
+            ok = run_pass(&ps, workers, threads, fd, path, &part_seq);
+            if (fd != STDIN_FILENO) close(fd);
+        }
+        JSON_TRACE_END("partition");
+        atomic_store(&ps.records, 0);
+        atomic_store(&ps.failed, 0);
+
+        ps.process = probe_block;
+        for (uint32_t i = 0; ok && i < n_parts; ++i) {
+            uint64_t len;
+            char* data = lseek(build_parts[i], 0, SEEK_SET) == 0 ? slurp(build_parts[i], &len) : NULL;
+            JsonJoinTable table;
+            json_join_init(&table, &bkey, n_fields ? fields : NULL, n_fields);
+            if (!data || !build_table(&table, data, len)) { perror("partition"); ok = false; }
+            build_records += table.n;
+            build_failed += table.failed;
+            ps.table = &table;
+            if (ok && lseek(probe_parts[i], 0, SEEK_SET) == 0)
+                ok = run_pass(&ps, workers, threads, probe_parts[i], "partition", &seq);
+            json_join_free(&table);
+            free(data);
+        }
+
+        for (uint32_t i = 0; i < n_parts; ++i) {
+            close(build_parts[i]);
+            close(probe_parts[i]);
+            pthread_mutex_destroy(&ps.part_mu[i]);
+        }
+        for (long t = 0; t < threads; ++t) {
+            for (uint32_t i = 0; i < n_parts; ++i) stringbuf_free(&workers[t].parts[i]);
+            free(workers[t].parts);
+        }
+        free(build_parts);
+        free(probe_parts);
+        free(ps.part_mu);
+    }
+    close(build_fd);
+
+    for (long t = 0; t < threads; ++t) {
+        json_ndjson_local_free(&workers[t].local);
+        json_free_parser_buffers(&workers[t].bufs);
+        stringbuf_free(&workers[t].scratch);
+        free(workers[t].key);
+    }
+    if (!json_ndjson_close(&out)) { perror("write"); ok = false; }
+
+    if (verbose)
+        fprintf(stderr, "build: %llu records (%llu skipped), %u partition(s); probe: %llu records, %llu matched, "
+                        "%llu unparseable; %llu records written\n",
+                (unsigned long long)build_records, (unsigned long long)build_failed, n_parts,
+                (unsigned long long)atomic_load(&ps.records), (unsigned long long)atomic_load(&ps.matched),
+                (unsigned long long)atomic_load(&ps.failed), (unsigned long long)atomic_load(&ps.emitted));
+
+    for (long i = 0; i < n_blocks; ++i) free(blocks[i].data);
+    free(blocks);
+    free(workers);
+    json_projection_free(&bkey);
+    json_projection_free(&pkey);
+    pthread_cond_destroy(&ps.has_free);
+    pthread_cond_destroy(&ps.has_work);
+    pthread_mutex_destroy(&ps.mu);
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,228 @@
+/* cejson-join.h – hash join of NDJSON records on an extracted key */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_JOIN_H
+#define CEJSON_JOIN_H
+
+#include "cejson.h"
+#include "cejson-alloc.h"
+#include "cejson-ndjson.h"
+
+/*
+ * Build side: json_join_add() parses each record once, encodes its key with
+ * json_key_encode() and keeps only byte spans into the record: the key and the
+ * members to splice ("name":value, exactly as written). The records must stay
+ * in memory as long as the table. json_join_seal() then builds the buckets.
+ *
+ * Probe side: json_join_find() / json_join_next() walk the build records with
+ * an equal key, in build order, and json_join_splice() writes the probe
+ * record with those members appended before its closing brace. Nothing is
+ * reserialized; a splice is a handful of memcpy()s.
+ *
+ * Splice members are the build record's top-level members named in fields,
+ * or all of them except the key when fields is NULL (and the key is a
+ * top-level member).
+ *
+ * Build records whose key is null or missing are indexed like any other; a
+ * caller wanting SQL semantics skips probes whose key starts with JSON_KEY_NULL.
+ */
+
+#define JSON_JOIN_NONE UINT32_MAX
+
+typedef struct {
+    const char* s;
+    uint32_t    len;
+} JsonSpan;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t key_off;               /* into keys */
+    uint32_t key_len;
+    uint32_t span, n_spans;         /* into spans */
+    uint32_t next;                  /* same bucket, build order */
+} JsonJoinRec;
+
+typedef struct {
+    const JsonProjection* key;
+    const char* const*    fields;
+    uint32_t              n_fields;
+
+    JsonJoinRec* recs;
+    uint64_t     n, recs_cap;
+    JsonSpan*    spans;
+    uint64_t     n_spans, spans_cap;
+    uint8_t*     keys;
+    uint64_t     keys_len, keys_cap;
+    uint32_t*    buckets;
+    uint64_t     cap;               /* power of two, 0 until sealed */
+
+    JsonParserBuffers bufs;
+    StringBuf    scratch;
+    uint64_t     failed;            /* build records that didn't parse or aren't objects */
+} JsonJoinTable;
+
+static inline uint64_t json_join_hash(const uint8_t* key, uint32_t len)
+{
+    return json_key_hash(key, len);
+}
+
+static inline void json_join_init(JsonJoinTable* t, const JsonProjection* key, const char* const* fields, uint32_t n_fields)
+{
+    memset(t, 0, sizeof(*t));
+    t->key = key;
+    t->fields = fields;
+    t->n_fields = n_fields;
+    stringbuf_init(&t->scratch, 4096);
+}
+
+static inline void json_join_free(JsonJoinTable* t)
+{
+    free(t->recs);
+    free(t->spans);
+    free(t->keys);
+    free(t->buckets);
+    json_free_parser_buffers(&t->bufs);
+    stringbuf_free(&t->scratch);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Bytes held by the table itself (not the records it points into) */
+static inline uint64_t json_join_bytes(const JsonJoinTable* t)
+{
+    return t->recs_cap * sizeof(JsonJoinRec) + t->spans_cap * sizeof(JsonSpan) + t->keys_cap + t->cap * sizeof(uint32_t);
+}
+
+static inline bool json_join_grow(void** mem, uint64_t* cap, uint64_t need, size_t elem)
+{
+    if (need <= *cap) return true;
+    uint64_t ncap = *cap ? *cap : 1024;
+    while (ncap < need) ncap *= 2;
+    void* m = realloc(*mem, ncap * elem);
+    if (!m) return false;
+    *mem = m;
+    *cap = ncap;
+    return true;
+}
+
+static inline bool json_join_keep_member(const JsonJoinTable* t, JsonParser* p, const JsonNode* key)
+{
+    const char* k = p->buffer + key->offset;
+    if (t->fields) {
+        for (uint32_t i = 0; i < t->n_fields; ++i)
+            if (strlen(t->fields[i]) == key->len && memcmp(t->fields[i], k, key->len) == 0) return true;
+        return false;
+    }
+    const JsonPath* kp = &t->key->paths[0];
+    if (kp->steps_len != 1 || kp->steps[0].op != JP_CHILD) return true;
+    return !(kp->steps[0].name_len == key->len && memcmp(kp->steps[0].name, k, key->len) == 0);
+}
+
+/* Indexes one build record (no trailing newline needed). Returns false only on allocation failure. */
+static inline bool json_join_add(JsonJoinTable* t, const char* rec, uint64_t len)
+{
+    JsonParser p;
+    uint64_t need = len / 2 + 64;
+    if (t->bufs.nodes_cap < need) {
+        json_free_parser_buffers(&t->bufs);
+        if (!json_alloc_parser_buffers(&t->bufs, need, need, JSON_ALLOC_DEFAULT)) return false;
+    }
+    json_init_buffers(&p, &t->bufs);
+    p.quiet = true;                 /* counted in t->failed */
+    if (!json_feed(&p, rec, len) || !json_finish(&p) || p.nodes[0].type != JSON_OBJECT) { t->failed++; return true; }
+    p.buffer = rec;
+
+    const JsonNode* cell;
+    json_projection_resolve(t->key, &p, NULL, &cell);
+    if (!json_join_grow((void**)&t->keys, &t->keys_cap, t->keys_len + len + 16, 1) ||
+        !json_join_grow((void**)&t->recs, &t->recs_cap, t->n + 1, sizeof(JsonJoinRec)) ||
+        !json_join_grow((void**)&t->spans, &t->spans_cap, t->n_spans + p.nodes[0].children, sizeof(JsonSpan)))
+        return false;
+
+    JsonJoinRec* r = &t->recs[t->n++];
+    r->key_off = t->keys_len;
+    r->key_len = json_key_encode(&p, cell, t->keys + t->keys_len, &t->scratch);
+    r->hash = json_join_hash(t->keys + r->key_off, r->key_len);
+    r->span = (uint32_t)t->n_spans;
+    r->n_spans = 0;
+    r->next = JSON_JOIN_NONE;
+    t->keys_len += r->key_len;
+
+    const JsonNode* key = json_first_child(&p, &p.nodes[0]);
+    for (uint32_t i = 0; i < p.nodes[0].children; ++i) {
+        const JsonNode* val = json_next_sibling(&p, key);
+        const char* vs;
+        uint64_t vlen;
+        if (json_join_keep_member(t, &p, key) && json_raw_span(&p, val, &vs, &vlen)) {
+            const char* start = p.buffer + key->offset - 1;
+            t->spans[t->n_spans++] = (JsonSpan){ start, (uint32_t)(vs + vlen - start) };
+            r->n_spans++;
+        }
+        key = json_next_sibling(&p, val);
+    }
+    return true;
+}
+
+/* Builds the buckets; call once after the last json_join_add() */
+static inline bool json_join_seal(JsonJoinTable* t)
+{
+    uint64_t cap = 16;
+    while (cap < t->n * 2) cap *= 2;
+    free(t->buckets);
+    t->buckets = malloc(cap * sizeof(uint32_t));
+    if (!t->buckets) { t->cap = 0; return false; }
+    t->cap = cap;
+    memset(t->buckets, 0xff, cap * sizeof(uint32_t));
+    /* pushing in reverse leaves every chain in build order */
+    for (uint64_t i = t->n; i-- > 0; ) {
+        uint64_t b = t->recs[i].hash & (cap - 1);
+        t->recs[i].next = t->buckets[b];
+        t->buckets[b] = (uint32_t)i;
+    }
+    return true;
+}
+
+static inline uint32_t json_join_match(const JsonJoinTable* t, uint32_t i, const uint8_t* key, uint32_t len, uint64_t h)
+{
+    for (; i != JSON_JOIN_NONE; i = t->recs[i].next) {
+        const JsonJoinRec* r = &t->recs[i];
+        if (r->hash == h && r->key_len == len && memcmp(t->keys + r->key_off, key, len) == 0) return i;
+    }
+    return JSON_JOIN_NONE;
+}
+
+/* First build record with this encoded key, JSON_JOIN_NONE if none */
+static inline uint32_t json_join_find(const JsonJoinTable* t, const uint8_t* key, uint32_t len, uint64_t h)
+{
+    if (!t->cap) return JSON_JOIN_NONE;
+    return json_join_match(t, t->buckets[h & (t->cap - 1)], key, len, h);
+}
+
+static inline uint32_t json_join_next(const JsonJoinTable* t, uint32_t i, const uint8_t* key, uint32_t len, uint64_t h)
+{
+    return json_join_match(t, t->recs[i].next, key, len, h);
+}
+
+/*
+ * Appends the probe record (parsed into p, root an object) with build record
+ * r's members spliced in, plus a newline.
+ */
+static inline bool json_join_splice(StringBuf* out, JsonParser* p, const JsonJoinTable* t, uint32_t r)
+{
+    const JsonNode* root = &p->nodes[0];
+    const char* s;
+    uint64_t len;
+    if (root->type != JSON_OBJECT || !json_raw_span(p, root, &s, &len)) return false;
+
+    const JsonJoinRec* rec = &t->recs[r];
+    bool comma = root->children > 0;
+    if (len > 1 && !stringbuf_append(out, s, (ssize_t)(len - 1))) return false;
+    for (uint32_t i = 0; i < rec->n_spans; ++i) {
+        const JsonSpan* sp = &t->spans[rec->span + i];
+        if (comma && !stringbuf_append_char(out, ',')) return false;
+        if (!stringbuf_append(out, sp->s, sp->len)) return false;
+        comma = true;
+    }
+    return stringbuf_append(out, "}\n", 2);
+}
+
+#endif /* CEJSON_JOIN_H */
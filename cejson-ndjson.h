@@ -0,0 +1,658 @@
+/* cejson-ndjson.h – parallel NDJSON output: thread-local serialization, one writev() thread */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_NDJSON_H
+#define CEJSON_NDJSON_H
+
+#include "cejson.h"
+#include "cejson-path.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * Producers serialize records into their own chunk (a StringBuf from a shared
+ * free list) without touching any lock. Full chunks are queued for a single
+ * writer thread, which gathers everything ready into one writev().
+ *
+ * Each producer works on batches: json_ndjson_begin(l, seq), any number of
+ * json_ndjson_write()/write_raw(), json_ndjson_end(l). With JSON_NDJSON_ORDERED
+ * batches reach the fd in seq order (0, 1, 2, ... – every seq must be ended
+ * exactly once, empty batches included); a batch larger than a chunk is
+ * streamed out in parts and never held whole. Without it, chunks are written
+ * in arrival order and seq is ignored.
+ *
+ * At most JSON_NDJSON_MAX_PENDING chunks are queued; producers block beyond
+ * that, except for the chunk the ordered writer is waiting on.
+ */
+
+#define JSON_NDJSON_ORDERED     0x1
+
+#ifndef JSON_NDJSON_CHUNK
+#define JSON_NDJSON_CHUNK       (256 * 1024)
+#endif
+#ifndef JSON_NDJSON_MAX_PENDING
+#define JSON_NDJSON_MAX_PENDING 64
+#endif
+#ifndef JSON_NDJSON_IOV
+#define JSON_NDJSON_IOV         64              /* chunks per writev(), well under IOV_MAX */
+#endif
+
+typedef struct JsonNdjsonChunk {
+    struct JsonNdjsonChunk* next;
+    StringBuf sb;
+    uint64_t  seq;
+    uint64_t  records;
+    uint32_t  part;
+    bool      last;                 /* final part of batch seq */
+} JsonNdjsonChunk;
+
+typedef struct {
+    int             fd;
+    unsigned        flags;
+    pthread_t       thread;
+    pthread_mutex_t mu;
+    pthread_cond_t  ready;          /* writer waits for chunks */
+    pthread_cond_t  space;          /* producers wait for queue room */
+    JsonNdjsonChunk* head;          /* submitted, arrival order */
+    JsonNdjsonChunk* tail;
+    JsonNdjsonChunk* free;
+    uint32_t        pending;
+    uint64_t        next_seq;       /* ordered mode: next batch / part due */
+    uint32_t        next_part;
+    bool            closing;
+    int             error;          /* errno of the first failed write */
+    uint64_t        bytes;
+    uint64_t        records;
+} JsonNdjsonWriter;
+
+/* One per producer thread */
+typedef struct {
+    JsonNdjsonWriter* w;
+    JsonNdjsonChunk*  cur;
+    uint64_t seq;
+    uint32_t part;
+} JsonNdjsonLocal;
+
+static inline bool json_ndjson_due(const JsonNdjsonWriter* w, const JsonNdjsonChunk* c)
+{
+    return c->seq == w->next_seq && c->part == w->next_part;
+}
+
+/* Unlinks the next writable chunk; caller holds mu */
+static inline JsonNdjsonChunk* json_ndjson_take(JsonNdjsonWriter* w)
+{
+    JsonNdjsonChunk** best = NULL;
+    for (JsonNdjsonChunk** c = &w->head; *c; c = &(*c)->next) {
+        if (!(w->flags & JSON_NDJSON_ORDERED) || json_ndjson_due(w, *c)) { best = c; break; }
+        /* closing with a gap in the sequence: drain what's left in order */
+        if (w->closing && (!best || (*c)->seq < (*best)->seq ||
+                           ((*c)->seq == (*best)->seq && (*c)->part < (*best)->part)))
+            best = c;
+    }
+    if (!best) return NULL;
+
+    JsonNdjsonChunk* c = *best;
+    *best = c->next;
+    if (w->tail == c) {
+        w->tail = NULL;
+        for (JsonNdjsonChunk* t = w->head; t; t = t->next) w->tail = t;
+    }
+    c->next = NULL;
+    if (c->last) { w->next_seq = c->seq + 1; w->next_part = 0; }
+    else         { w->next_seq = c->seq;     w->next_part = c->part + 1; }
+    return c;
+}
+
+static inline bool json_ndjson_writev(int fd, struct iovec* iov, int n)
+{
+    while (n > 0) {
+        ssize_t r = writev(fd, iov, n);
+        if (r < 0) { if (errno == EINTR) continue; return false; }
+        while (n > 0 && (size_t)r >= iov->iov_len) { r -= (ssize_t)iov->iov_len; iov++; n--; }
+        if (n > 0) { iov->iov_base = (char*)iov->iov_base + r; iov->iov_len -= (size_t)r; }
+    }
+    return true;
+}
+
+static inline void* json_ndjson_thread(void* arg)
+{
+    JsonNdjsonWriter* w = arg;
+    JsonNdjsonChunk* batch[JSON_NDJSON_IOV];
+    struct iovec iov[JSON_NDJSON_IOV];
+
+    pthread_mutex_lock(&w->mu);
+    for (;;) {
+        int n = 0;
+        while (n < JSON_NDJSON_IOV && (batch[n] = json_ndjson_take(w))) n++;
+        if (!n) {
+            if (w->closing && !w->head) break;
+            pthread_cond_wait(&w->ready, &w->mu);
+            continue;
+        }
+        pthread_mutex_unlock(&w->mu);
+
+        int niov = 0;
+        uint64_t bytes = 0, records = 0;
+        for (int i = 0; i < n; ++i) {
+            records += batch[i]->records;
+            if (!batch[i]->sb.size) continue;
+            iov[niov++] = (struct iovec){ batch[i]->sb.data, (size_t)batch[i]->sb.size };
+            bytes += (uint64_t)batch[i]->sb.size;
+        }
+        bool ok = json_ndjson_writev(w->fd, iov, niov);
+        int err = ok ? 0 : errno;
+
+        pthread_mutex_lock(&w->mu);
+        if (ok) { w->bytes += bytes; w->records += records; }
+        else if (!w->error) w->error = err;
+        for (int i = 0; i < n; ++i) {
+            stringbuf_clear(&batch[i]->sb);
+            batch[i]->next = w->free;
+            w->free = batch[i];
+        }
+        w->pending -= (uint32_t)n;
+        pthread_cond_broadcast(&w->space);
+    }
+    pthread_mutex_unlock(&w->mu);
+    return NULL;
+}
+
+/* Starts the writer thread. fd stays owned by the caller. */
+static inline bool json_ndjson_open(JsonNdjsonWriter* w, int fd, unsigned flags)
+{
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->flags = flags;
+    pthread_mutex_init(&w->mu, NULL);
+    pthread_cond_init(&w->ready, NULL);
+    pthread_cond_init(&w->space, NULL);
+    if (pthread_create(&w->thread, NULL, json_ndjson_thread, w) == 0) return true;
+    pthread_cond_destroy(&w->space);
+    pthread_cond_destroy(&w->ready);
+    pthread_mutex_destroy(&w->mu);
+    return false;
+}
+
+/* Drains the queue and stops the writer. All producers must have ended their batches. */
+static inline bool json_ndjson_close(JsonNdjsonWriter* w)
+{
+    pthread_mutex_lock(&w->mu);
+    w->closing = true;
+    pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->mu);
+    pthread_join(w->thread, NULL);
+
+    for (JsonNdjsonChunk* c = w->free; c; ) {
+        JsonNdjsonChunk* next = c->next;
+        stringbuf_free(&c->sb);
+        free(c);
+        c = next;
+    }
+    w->free = NULL;
+    pthread_cond_destroy(&w->space);
+    pthread_cond_destroy(&w->ready);
+    pthread_mutex_destroy(&w->mu);
+    return w->error == 0;
+}
+
+static inline void json_ndjson_local_init(JsonNdjsonLocal* l, JsonNdjsonWriter* w)
+{
+    memset(l, 0, sizeof(*l));
+    l->w = w;
+}
+
+/* Drops an unfinished chunk (after an error); ended batches are already queued */
+static inline void json_ndjson_local_free(JsonNdjsonLocal* l)
+{
+    if (l->cur) { stringbuf_free(&l->cur->sb); free(l->cur); l->cur = NULL; }
+}
+
+static inline JsonNdjsonChunk* json_ndjson_chunk(JsonNdjsonLocal* l)
+{
+    if (likely(l->cur != NULL)) return l->cur;
+
+    JsonNdjsonWriter* w = l->w;
+    pthread_mutex_lock(&w->mu);
+    JsonNdjsonChunk* c = w->free;
+    if (c) w->free = c->next;
+    pthread_mutex_unlock(&w->mu);
+
+    if (!c) {
+        c = malloc(sizeof(*c));
+        if (!c) return NULL;
+        if (!stringbuf_init(&c->sb, JSON_NDJSON_CHUNK + 4096)) { free(c); return NULL; }
+    }
+    c->next = NULL;
+    c->seq = l->seq;
+    c->part = l->part;
+    c->records = 0;
+    c->last = false;
+    return l->cur = c;
+}
+
+/* Queues the current chunk, waiting for room unless the ordered writer needs exactly this one */
+static inline bool json_ndjson_submit(JsonNdjsonLocal* l, bool last)
+{
+    JsonNdjsonWriter* w = l->w;
+    JsonNdjsonChunk* c = json_ndjson_chunk(l);
+    if (!c) return false;
+    c->last = last;
+
+    pthread_mutex_lock(&w->mu);
+    while (!w->error && w->pending >= JSON_NDJSON_MAX_PENDING &&
+           !((w->flags & JSON_NDJSON_ORDERED) && json_ndjson_due(w, c)))
+        pthread_cond_wait(&w->space, &w->mu);
+    bool ok = !w->error;
+    if (ok) {
+        if (w->tail) w->tail->next = c; else w->head = c;
+        w->tail = c;
+        w->pending++;
+        pthread_cond_signal(&w->ready);
+    }
+    pthread_mutex_unlock(&w->mu);
+
+    if (!ok) return false;
+    l->cur = NULL;
+    l->part = last ? 0 : l->part + 1;
+    return true;
+}
+
+/* Starts batch seq (ignored by an unordered writer) */
+static inline void json_ndjson_begin(JsonNdjsonLocal* l, uint64_t seq)
+{
+    l->seq = seq;
+    l->part = 0;
+    if (l->cur) { l->cur->seq = seq; l->cur->part = 0; }
+}
+
+/* Ends the batch; in ordered mode this is what lets seq + 1 through */
+static inline bool json_ndjson_end(JsonNdjsonLocal* l)
+{
+    if (!(l->w->flags & JSON_NDJSON_ORDERED) && (!l->cur || !l->cur->sb.size)) return true;
+    return json_ndjson_submit(l, true);
+}
+
+/*
+ * For callers that format their own lines (CSV rows, original record bytes):
+ * append one complete record to json_ndjson_buf(), then json_ndjson_record_done().
+ */
+static inline StringBuf* json_ndjson_buf(JsonNdjsonLocal* l)
+{
+    JsonNdjsonChunk* c = json_ndjson_chunk(l);
+    return c ? &c->sb : NULL;
+}
+
+static inline bool json_ndjson_record_done(JsonNdjsonLocal* l)
+{
+    l->cur->records++;
+    if (l->cur->sb.size < JSON_NDJSON_CHUNK) return true;
+    return json_ndjson_submit(l, false);
+}
+
+/* Appends one already formatted line; the newline is added if missing */
+static inline bool json_ndjson_write_raw(JsonNdjsonLocal* l, const char* line, uint64_t len)
+{
+    JsonNdjsonChunk* c = json_ndjson_chunk(l);
+    if (!c || (len && !stringbuf_append(&c->sb, line, (ssize_t)len))) return false;
+    if ((!len || line[len - 1] != '\n') && !stringbuf_append_char(&c->sb, '\n')) return false;
+    return json_ndjson_record_done(l);
+}
+
+/* Serializes node (compact) as one line; NULL means the document root */
+static inline bool json_ndjson_write(JsonNdjsonLocal* l, JsonParser* p, const JsonNode* node)
+{
+    JsonNdjsonChunk* c = json_ndjson_chunk(l);
+    if (!c) return false;
+    ssize_t mark = c->sb.size;
+    if (json_dump_node_buf(p, node ? node : &p->nodes[0], &c->sb, 0, false) < 0 ||
+        !stringbuf_append_char(&c->sb, '\n')) {
+        c->sb.size = mark;          /* no half records on the wire */
+        c->sb.data[mark] = '\0';
+        return false;
+    }
+    return json_ndjson_record_done(l);
+}
+
+/* ---------------------------------------------------------------- */
+/* Input: line-aligned blocks from a file descriptor                */
+/* ---------------------------------------------------------------- */
+
+typedef struct {
+    int      fd;
+    char*    tail;              /* partial last line, carried into the next block */
+    uint64_t tail_len, tail_cap;
+    bool     eof;
+} JsonNdjsonReader;
+
+static inline void json_ndjson_reader_init(JsonNdjsonReader* r, int fd)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+}
+
+static inline void json_ndjson_reader_free(JsonNdjsonReader* r)
+{
+    free(r->tail);
+    r->tail = NULL;
+}
+
+/*
+ * Fills *buf (malloc'd, *cap bytes; grown if a single line is longer) with
+ * whole lines. Returns the byte count, 0 once the input is exhausted, -1 on a
+ * read error or allocation failure. The last line of a file may lack its '\n'.
+ */
+static inline int64_t json_ndjson_read(JsonNdjsonReader* r, char** buf, uint64_t* cap)
+{
+    if (r->eof && !r->tail_len) return 0;
+    if (*cap < r->tail_len + 4096) {
+        uint64_t ncap = MAX(*cap * 2, r->tail_len + 4096);
+        char* mem = realloc(*buf, ncap);
+        if (!mem) return -1;
+        *buf = mem;
+        *cap = ncap;
+    }
+    if (r->tail_len) memcpy(*buf, r->tail, r->tail_len);
+    uint64_t len = r->tail_len, scanned = r->tail_len;
+    const char* nl = NULL;
+    r->tail_len = 0;
+
+    for (;;) {
+        while (!r->eof && len < *cap) {
+            ssize_t n = read(r->fd, *buf + len, (size_t)(*cap - len));
+            if (n < 0) { if (errno == EINTR) continue; return -1; }
+            if (n == 0) r->eof = true;
+            len += (uint64_t)n;
+        }
+        if (r->eof) return (int64_t)len;
+
+        for (const char* s = *buf + len; s > *buf + scanned; )
+            if (*--s == '\n') { nl = s; break; }
+        if (nl) break;
+
+        /* one line longer than the buffer */
+        scanned = len;
+        char* mem = realloc(*buf, *cap * 2);
+        if (!mem) return -1;
+        *buf = mem;
+        *cap *= 2;
+    }
+
+    const char* end = nl + 1;
+    uint64_t keep = (uint64_t)(end - *buf);
+    r->tail_len = len - keep;
+    if (r->tail_len > r->tail_cap) {
+        char* mem = realloc(r->tail, r->tail_len);
+        if (!mem) return -1;
+        r->tail = mem;
+        r->tail_cap = r->tail_len;
+    }
+    memcpy(r->tail, end, r->tail_len);
+    return (int64_t)keep;
+}
+
+/* ---------------------------------------------------------------- */
+/* Keys: string unescaping and an order-preserving key encoding     */
+/* ---------------------------------------------------------------- */
+
+static inline uint32_t json_hex4(const char* s, bool* ok)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = s[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v |= (uint32_t)(c - 'A' + 10);
+        else *ok = false;
+    }
+    return v;
+}
+
+/*
+ * Decodes the escape at s[*i] == '\\' into out (up to 4 bytes), advancing *i
+ * past it. Lone or malformed surrogates become U+FFFD.
+ */
+static inline int json_decode_escape(const char* s, uint64_t len, uint64_t* i, char* out)
+{
+    uint64_t k = *i + 1;
+    if (k >= len) { *i = len; return 0; }
+    char e = s[k];
+    *i = k + 1;
+    switch (e) {
+    case 'b': out[0] = '\b'; return 1;
+    case 'f': out[0] = '\f'; return 1;
+    case 'n': out[0] = '\n'; return 1;
+    case 'r': out[0] = '\r'; return 1;
+    case 't': out[0] = '\t'; return 1;
+    case 'u': break;
+    default:  out[0] = e;    return 1;      /* \" \\ \/ */
+    }
+
+    bool ok = k + 5 <= len;
+    uint32_t cp = ok ? json_hex4(s + k + 1, &ok) : 0;
+    if (!ok) { *i = len; return json_utf8_put(out, 0xFFFD); }
+    *i = k + 5;
+    if (cp >= 0xD800 && cp < 0xDC00) {
+        bool lo_ok = *i + 6 <= len && s[*i] == '\\' && s[*i + 1] == 'u';
+        uint32_t lo = lo_ok ? json_hex4(s + *i + 2, &lo_ok) : 0;
+        if (lo_ok && lo >= 0xDC00 && lo < 0xE000) {
+            *i += 6;
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        } else {
+            cp = 0xFFFD;
+        }
+    } else if (cp >= 0xDC00 && cp < 0xE000) {
+        cp = 0xFFFD;
+    }
+    return json_utf8_put(out, cp);
+}
+
+/*
+ * Encodes a value so that memcmp() orders and equates keys:
+ *   missing / null < false < true < numbers < strings < objects, arrays
+ * Numbers become 8 order-preserving bytes of their double value (so 1 == 1.0),
+ * strings their unescaped UTF-8, containers their compact JSON. out must have
+ * room for the value's source length + 16 bytes. n NULL means missing.
+ */
+enum { JSON_KEY_NULL = 0, JSON_KEY_FALSE, JSON_KEY_TRUE, JSON_KEY_NUMBER, JSON_KEY_STRING, JSON_KEY_CONTAINER };
+
+static inline uint32_t json_key_encode(JsonParser* p, const JsonNode* n, uint8_t* out, StringBuf* scratch)
+{
+    if (!n || n->type == JSON_NULL) { out[0] = JSON_KEY_NULL; return 1; }
+    const char* src = n->type != JSON_OBJECT && n->strval ? n->strval : p->buffer + n->offset;
+
+    switch (n->type) {
+    case JSON_FALSE: out[0] = JSON_KEY_FALSE; return 1;
+    case JSON_TRUE:  out[0] = JSON_KEY_TRUE;  return 1;
+    case JSON_NUMBER_INT:
+    case JSON_NUMBER_FLOAT: {
+        double d = 0;
+        json_as_number(p, n, &d);
+        if (d == 0) d = 0;              /* -0 == 0 */
+        uint64_t bits;
+        memcpy(&bits, &d, 8);
+        bits = (bits >> 63) ? ~bits : bits ^ (1ULL << 63);
+        out[0] = JSON_KEY_NUMBER;
+        for (int i = 0; i < 8; ++i) out[1 + i] = (uint8_t)(bits >> (56 - 8 * i));
+        return 9;
+    }
+    case JSON_STRING: {
+        uint8_t* o = out;
+        *o++ = JSON_KEY_STRING;
+        for (uint64_t i = 0; i < n->len; ) {
+            if (src[i] != '\\') { *o++ = (uint8_t)src[i++]; continue; }
+            o += json_decode_escape(src, n->len, &i, (char*)o);
+        }
+        return (uint32_t)(o - out);
+    }
+    default:
+        stringbuf_clear(scratch);
+        out[0] = JSON_KEY_CONTAINER;
+        if (json_dump_node_buf(p, n, scratch, 0, false) < 0) return 1;
+        memcpy(out + 1, scratch->data, (size_t)scratch->size);
+        return 1 + (uint32_t)scratch->size;
+    }
+}
+
+/* Hash of a json_key_encode()d key, shared by the join table, its partitions and cejson-shard */
+static inline uint64_t json_key_hash(const uint8_t* key, uint32_t len)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    for (uint32_t i = 0; i < len; ++i) {
+        h ^= key[i];
+        h *= 0x100000001B3ULL;
+    }
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+/* ---------------------------------------------------------------- */
+/* Projection: pull a fixed set of fields out of each record        */
+/* ---------------------------------------------------------------- */
+
+/*
+ * The columns are compiled into a trie of path steps (JSONPath syntax limited
+ * to .name, ['name'] and [n]; a leading $ is optional). Resolving a record
+ * walks only the objects and arrays on those paths: members that no column
+ * wants are skipped over whole subtrees at a time, and an object scan stops
+ * as soon as every wanted member was seen.
+ */
+
+typedef struct {
+    const JsonPathStep* step;       /* NULL for the root */
+    uint32_t child, sibling;        /* trie links, 0 = none */
+    uint32_t n_children;
+    int32_t  column;                /* first column ending here, -1 if none */
+} JsonProjNode;
+
+typedef struct {
+    JsonPath*     paths;            /* one per column, owns the names */
+    uint32_t      n_columns;
+    JsonProjNode* nodes;
+    uint32_t      nodes_len;
+    int32_t*      alias;            /* column -> earlier column with the same path, or -1 */
+    uint32_t      bad_column;       /* compile error: which column ... */
+    size_t        error_pos;        /* ... and where in it */
+} JsonProjection;
+
+static inline void json_projection_free(JsonProjection* pj)
+{
+    for (uint32_t i = 0; i < pj->n_columns; ++i) json_path_free(&pj->paths[i]);
+    free(pj->paths);
+    free(pj->nodes);
+    free(pj->alias);
+    memset(pj, 0, sizeof(*pj));
+}
+
+static inline bool json_projection_same_step(const JsonPathStep* a, const JsonPathStep* b)
+{
+    if (a->op != b->op) return false;
+    if (a->op == JP_INDEX) return a->from == b->from;
+    return a->hash == b->hash && a->name_len == b->name_len && memcmp(a->name, b->name, a->name_len) == 0;
+}
+
+static inline bool json_projection_compile(JsonProjection* pj, const char* const* columns, uint32_t n)
+{
+    memset(pj, 0, sizeof(*pj));
+    pj->paths = calloc(n ? n : 1, sizeof(JsonPath));
+    pj->alias = malloc((n ? n : 1) * sizeof(int32_t));
+    uint32_t cap = 1;
+    for (uint32_t i = 0; i < n; ++i) cap += (uint32_t)strlen(columns[i]) + 1;   /* >= steps + 1 */
+    pj->nodes = calloc(cap, sizeof(JsonProjNode));
+    if (!pj->paths || !pj->alias || !pj->nodes) { json_projection_free(pj); return false; }
+    pj->nodes[0].column = -1;
+    pj->nodes_len = 1;
+
+    for (uint32_t c = 0; c < n; ++c) {
+        JsonPath* jp = &pj->paths[c];
+        pj->n_columns = c + 1;
+        pj->bad_column = c;
+        const char* col = columns[c];
+        bool bare = *col && *col != '$' && *col != '.' && *col != '[';
+        char* expr = malloc(strlen(col) + 2);
+        if (!expr) goto fail;
+        if (bare) { expr[0] = '.'; strcpy(expr + 1, col); } else strcpy(expr, col);
+        bool compiled = json_path_compile(jp, expr);
+        free(expr);
+        if (!compiled) { if (bare && jp->error_pos) jp->error_pos--; goto fail; }
+
+        uint32_t t = 0;
+        for (uint32_t s = 0; s < jp->steps_len; ++s) {
+            const JsonPathStep* st = &jp->steps[s];
+            if (st->descendant || (st->op != JP_CHILD && (st->op != JP_INDEX || st->from < 0))) goto fail;
+
+            uint32_t k = pj->nodes[t].child;
+            while (k && !json_projection_same_step(pj->nodes[k].step, st)) k = pj->nodes[k].sibling;
+            if (!k) {
+                k = pj->nodes_len++;
+                pj->nodes[k] = (JsonProjNode){ .step = st, .sibling = pj->nodes[t].child, .column = -1 };
+                pj->nodes[t].child = k;
+                pj->nodes[t].n_children++;
+            }
+            t = k;
+        }
+        pj->alias[c] = pj->nodes[t].column;
+        if (pj->nodes[t].column < 0) pj->nodes[t].column = (int32_t)c;
+    }
+    return true;
+
+fail:
+    {
+        uint32_t bad = pj->bad_column;
+        size_t pos = pj->paths[bad].error_pos;      /* 0 for an unsupported step */
+        json_projection_free(pj);
+        pj->bad_column = bad;
+        pj->error_pos = pos;
+    }
+    return false;
+}
+
+static inline void json_projection_walk(const JsonProjection* pj, JsonParser* p, uint32_t t,
+                                        const JsonNode* n, const JsonNode** out)
+{
+    const JsonProjNode* tn = &pj->nodes[t];
+    if (tn->column >= 0) out[tn->column] = n;
+    if (!tn->child) return;
+
+    uint32_t want = tn->n_children;
+    if (n->type == JSON_OBJECT) {
+        const JsonNode* key = json_first_child(p, n);
+        for (uint32_t i = 0; i < n->children && want; ++i) {
+            const JsonNode* val = json_next_sibling(p, key);
+            uint32_t h = key->hash & JSON_HASH_MASK;
+            const char* kb = key->strval ? key->strval : p->buffer + key->offset;
+            for (uint32_t k = tn->child; k; k = pj->nodes[k].sibling) {
+                const JsonPathStep* st = pj->nodes[k].step;
+                if (st->op == JP_CHILD && st->hash == h && st->name_len == key->len &&
+                    memcmp(kb, st->name, st->name_len) == 0) {
+                    json_projection_walk(pj, p, k, val, out);
+                    want--;
+                    break;
+                }
+            }
+            key = json_next_sibling(p, val);
+        }
+    } else if (n->type == JSON_ARRAY) {
+        for (uint32_t k = tn->child; k; k = pj->nodes[k].sibling) {
+            const JsonPathStep* st = pj->nodes[k].step;
+            if (st->op != JP_INDEX || st->from >= (int64_t)n->children) continue;
+            json_projection_walk(pj, p, k, json_get_array_element(p, n, (uint32_t)st->from), out);
+        }
+    }
+}
+
+/* out[i] = the node for column i, NULL when the record doesn't have it. root NULL = document root. */
+static inline void json_projection_resolve(const JsonProjection* pj, JsonParser* p, const JsonNode* root, const JsonNode** out)
+{
+    memset(out, 0, pj->n_columns * sizeof(*out));
+    if (!p->nodes_len) return;
+    json_projection_walk(pj, p, 0, root ? root : &p->nodes[0], out);
+    for (uint32_t i = 0; i < pj->n_columns; ++i)
+        if (pj->alias[i] >= 0) out[i] = out[pj->alias[i]];
+}
+
+#endif /* CEJSON_NDJSON_H */
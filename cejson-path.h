@@ -0,0 +1,799 @@
+/* cejson-path.h – compiled JSONPath queries over a parsed cejson tape */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_PATH_H
+#define CEJSON_PATH_H
+
+#include "cejson.h"
+
+/*
+ * Supported syntax:
+ *   $                 root
+ *   .name ['name']    child member
+ *   .* [*]            all children
+ *   [n] [-n]          array element (negative counts from the end)
+ *   [a:b]             array slice, either bound optional
+ *   ..name ..* ..[x]  descendant search
+ *   [?(@.a.b op lit)] filter on children, op is == != < <= > >=, lit is a
+ *                     number, 'string', "string", true, false or null.
+ *                     [?(@.a)] tests for existence.
+ *
+ * Names are matched against the raw (still escaped) key bytes on the tape.
+ */
+
+typedef enum {
+    JP_CHILD = 0,
+    JP_WILDCARD,
+    JP_INDEX,
+    JP_SLICE,
+    JP_FILTER
+} JsonPathOp;
+
+typedef enum {
+    JP_CMP_EXISTS = 0,
+    JP_CMP_EQ,
+    JP_CMP_NE,
+    JP_CMP_LT,
+    JP_CMP_LE,
+    JP_CMP_GT,
+    JP_CMP_GE
+} JsonPathCmp;
+
+typedef struct JsonPathStep {
+    uint8_t     op;
+    bool        descendant;     /* step was written with ".." */
+    uint32_t    hash;           /* masked key hash for JP_CHILD */
+    const char* name;
+    uint32_t    name_len;
+    int64_t     from, to;       /* JP_INDEX uses from; JP_SLICE uses [from, to) */
+    bool        has_from, has_to;
+
+    /* JP_FILTER: relative path from @, comparison and literal */
+    struct JsonPathStep* rel;
+    uint32_t    rel_len;
+    uint8_t     cmp;
+    uint8_t     lit_type;       /* JSON_NUMBER_FLOAT, JSON_STRING, JSON_TRUE, JSON_FALSE, JSON_NULL */
+    double      lit_num;
+    const char* lit_str;
+    uint32_t    lit_len;
+} JsonPathStep;
+
+typedef struct {
+    char*         text;         /* private copy of the expression, names point into it */
+    JsonPathStep* steps;
+    uint32_t      steps_len;
+    uint32_t      steps_cap;
+    size_t        error_pos;    /* offset of the first bad character when compile fails */
+
+    /* scratch reused by every json_path_eval() call */
+    JsonNodeVec   cur, next, scan;
+} JsonPath;
+
+/* ---------------------------------------------------------------- */
+/* Compiler                                                         */
+/* ---------------------------------------------------------------- */
+
+static inline JsonPathStep* json_path_add_step(JsonPathStep** steps, uint32_t* len, uint32_t* cap)
+{
+    if (*len >= *cap) {
+        uint32_t newcap = *cap ? *cap * 2 : 8;
+        JsonPathStep* mem = realloc(*steps, newcap * sizeof(JsonPathStep));
+        if (!mem) return NULL;
+        *steps = mem;
+        *cap = newcap;
+    }
+    JsonPathStep* st = &(*steps)[(*len)++];
+    memset(st, 0, sizeof(*st));
+    return st;
+}
+
+static inline void json_path_set_name(JsonPathStep* st, const char* name, uint32_t len)
+{
+    st->op = JP_CHILD;
+    st->name = name;
+    st->name_len = len;
+    st->hash = json_compute_hash_len(name, len) & JSON_HASH_MASK;
+}
+
+static inline bool json_path_parse_int(const char** s, int64_t* out)
+{
+    const char* c = *s;
+    bool neg = (*c == '-');
+    if (neg) c++;
+    if (*c < '0' || *c > '9') return false;
+    int64_t v = 0;
+    while (*c >= '0' && *c <= '9') v = v * 10 + (*c++ - '0');
+    *out = neg ? -v : v;
+    *s = c;
+    return true;
+}
+
+/* Quoted name or string literal; s points at the opening quote. Returns the raw span. */
+static inline bool json_path_parse_quoted(const char** s, const char** str, uint32_t* len)
+{
+    char q = **s;
+    const char* c = *s + 1;
+    const char* start = c;
+    while (*c && *c != q) {
+        if (*c == '\\' && c[1]) c++;
+        c++;
+    }
+    if (*c != q) return false;
+    *str = start;
+    *len = (uint32_t)(c - start);
+    *s = c + 1;
+    return true;
+}
+
+static inline bool json_path_is_name_char(char c)
+{
+    return c && c != '.' && c != '[' && c != ']' && c != ' ' && c != ')' &&
+           c != '=' && c != '!' && c != '<' && c != '>';
+}
+
+static inline void json_path_skip_ws(const char** s) { while (**s == ' ') (*s)++; }
+
+/* Relative path after @ inside a filter: only .name, ['name'] and [n] */
+static inline bool json_path_compile_rel(JsonPathStep* f, const char** s)
+{
+    uint32_t cap = 0;
+    const char* c = *s;
+    for (;;) {
+        if (*c == '.' && json_path_is_name_char(c[1])) {
+            const char* name = ++c;
+            while (json_path_is_name_char(*c)) c++;
+            JsonPathStep* st = json_path_add_step(&f->rel, &f->rel_len, &cap);
+            if (!st) return false;
+            json_path_set_name(st, name, (uint32_t)(c - name));
+        } else if (*c == '[' && (c[1] == '\'' || c[1] == '"')) {
+            const char* name; uint32_t len;
+            c++;
+            if (!json_path_parse_quoted(&c, &name, &len) || *c != ']') { *s = c; return false; }
+            c++;
+            JsonPathStep* st = json_path_add_step(&f->rel, &f->rel_len, &cap);
+            if (!st) return false;
+            json_path_set_name(st, name, len);
+        } else if (*c == '[') {
+            c++;
+            JsonPathStep* st = json_path_add_step(&f->rel, &f->rel_len, &cap);
+            if (!st) return false;
+            st->op = JP_INDEX;
+            if (!json_path_parse_int(&c, &st->from) || *c != ']') { *s = c; return false; }
+            c++;
+        } else {
+            break;
+        }
+    }
+    *s = c;
+    return true;
+}
+
+/* Filter body after "[?(" up to and including ")]" */
+static inline bool json_path_compile_filter(JsonPathStep* f, const char** s)
+{
+    const char* c = *s;
+    json_path_skip_ws(&c);
+    if (*c++ != '@') { *s = c - 1; return false; }
+    if (!json_path_compile_rel(f, &c)) { *s = c; return false; }
+    json_path_skip_ws(&c);
+
+    f->op = JP_FILTER;
+    f->cmp = JP_CMP_EXISTS;
+    if      (c[0] == '=' && c[1] == '=') { f->cmp = JP_CMP_EQ; c += 2; }
+    else if (c[0] == '!' && c[1] == '=') { f->cmp = JP_CMP_NE; c += 2; }
+    else if (c[0] == '<' && c[1] == '=') { f->cmp = JP_CMP_LE; c += 2; }
+    else if (c[0] == '>' && c[1] == '=') { f->cmp = JP_CMP_GE; c += 2; }
+    else if (c[0] == '<')                { f->cmp = JP_CMP_LT; c += 1; }
+    else if (c[0] == '>')                { f->cmp = JP_CMP_GT; c += 1; }
+
+    if (f->cmp != JP_CMP_EXISTS) {
+        json_path_skip_ws(&c);
+        if (*c == '\'' || *c == '"') {
+            f->lit_type = JSON_STRING;
+            if (!json_path_parse_quoted(&c, &f->lit_str, &f->lit_len)) { *s = c; return false; }
+        } else if (!strncmp(c, "true", 4))  { f->lit_type = JSON_TRUE;  c += 4; }
+        else if (!strncmp(c, "false", 5))   { f->lit_type = JSON_FALSE; c += 5; }
+        else if (!strncmp(c, "null", 4))    { f->lit_type = JSON_NULL;  c += 4; }
+        else {
+            char* end;
+            f->lit_type = JSON_NUMBER_FLOAT;
+            f->lit_num = strtod(c, &end);
+            if (end == c) { *s = c; return false; }
+            c = end;
+        }
+        json_path_skip_ws(&c);
+    }
+    if (c[0] != ')' || c[1] != ']') { *s = c; return false; }
+    *s = c + 2;
+    return true;
+}
+
+static inline void json_path_free(JsonPath* jp)
+{
+    for (uint32_t i = 0; i < jp->steps_len; ++i) free(jp->steps[i].rel);
+    free(jp->steps);
+    free(jp->text);
+    json_nodevec_free(&jp->cur);
+    json_nodevec_free(&jp->next);
+    json_nodevec_free(&jp->scan);
+    memset(jp, 0, sizeof(*jp));
+}
+
+/* Compile expr into an execution plan. On failure jp->error_pos marks the offending character. */
+static inline bool json_path_compile(JsonPath* jp, const char* expr)
+{
+    memset(jp, 0, sizeof(*jp));
+    size_t n = strlen(expr);
+    jp->text = malloc(n + 1);
+    if (!jp->text) return false;
+    memcpy(jp->text, expr, n + 1);
+
+    const char* c = jp->text;
+    if (*c == '$') c++;
+
+    while (*c) {
+        bool desc = false;
+        JsonPathStep* st;
+
+        if (c[0] == '.' && c[1] == '.') { desc = true; c += 2; }
+        else if (c[0] == '.') c++;
+        else if (c[0] != '[') goto fail;
+
+        st = json_path_add_step(&jp->steps, &jp->steps_len, &jp->steps_cap);
+        if (!st) goto fail;
+        st->descendant = desc;
+
+        if (*c == '*') { st->op = JP_WILDCARD; c++; continue; }
+        if (*c != '[') {
+            const char* name = c;
+            while (json_path_is_name_char(*c)) c++;
+            if (c == name) goto fail;
+            json_path_set_name(st, name, (uint32_t)(c - name));
+            continue;
+        }
+
+        c++;   /* '[' */
+        if (c[0] == '*' && c[1] == ']') { st->op = JP_WILDCARD; c += 2; continue; }
+        if (*c == '\'' || *c == '"') {
+            const char* name; uint32_t len;
+            if (!json_path_parse_quoted(&c, &name, &len) || *c != ']') goto fail;
+            c++;
+            json_path_set_name(st, name, len);
+            continue;
+        }
+        if (c[0] == '?' && c[1] == '(') {
+            c += 2;
+            if (!json_path_compile_filter(st, &c)) goto fail;
+            continue;
+        }
+
+        st->op = JP_INDEX;
+        st->has_from = json_path_parse_int(&c, &st->from);
+        if (*c == ':') {
+            c++;
+            st->op = JP_SLICE;
+            st->has_to = json_path_parse_int(&c, &st->to);
+        } else if (!st->has_from) {
+            goto fail;
+        }
+        if (*c++ != ']') { c--; goto fail; }
+    }
+    return true;
+
+fail:
+    {
+        size_t pos = (size_t)(c - jp->text);
+        json_path_free(jp);
+        jp->error_pos = pos;
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------- */
+/* Executor                                                         */
+/* ---------------------------------------------------------------- */
+
+static inline bool json_path_is_container(const JsonNode* n)
+{
+    return n->type == JSON_OBJECT || n->type == JSON_ARRAY;
+}
+
+static inline JsonNode* json_path_member(JsonParser* p, const JsonNode* obj, const JsonPathStep* st)
+{
+    if (obj->type != JSON_OBJECT || !json_bloom_may_contain(obj, json_key_bloom(st->hash))) return NULL;
+    JsonNode* key = json_first_child(p, obj);
+    for (uint32_t i = 0; i < obj->children; ++i) {
+        JsonNode* val = json_next_sibling(p, key);
+        if (key->hash == st->hash && key->len == st->name_len &&
+            memcmp(key->strval ? key->strval : p->buffer + key->offset, st->name, st->name_len) == 0)
+            return val;
+        key = json_next_sibling(p, val);
+    }
+    return NULL;
+}
+
+static inline JsonNode* json_path_element(JsonParser* p, const JsonNode* arr, int64_t i)
+{
+    if (arr->type != JSON_ARRAY) return NULL;
+    if (i < 0) i += arr->children;
+    if (i < 0 || i >= (int64_t)arr->children) return NULL;
+    return json_get_array_element(p, arr, (uint32_t)i);
+}
+
+static inline bool json_path_filter_match(JsonParser* p, const JsonNode* v, const JsonPathStep* f)
+{
+    for (uint32_t i = 0; v && i < f->rel_len; ++i) {
+        const JsonPathStep* r = &f->rel[i];
+        v = (r->op == JP_CHILD) ? json_path_member(p, v, r) : json_path_element(p, v, r->from);
+    }
+    if (!v) return false;
+    if (f->cmp == JP_CMP_EXISTS) return true;
+
+    int c;
+    switch (f->lit_type) {
+        case JSON_NUMBER_FLOAT: {
+            double d;
+            if (!json_as_number(p, v, &d)) return f->cmp == JP_CMP_NE;
+            c = (d > f->lit_num) - (d < f->lit_num);
+            break;
+        }
+        case JSON_STRING: {
+            if (v->type != JSON_STRING) return f->cmp == JP_CMP_NE;
+            const char* s = v->strval ? v->strval : p->buffer + v->offset;
+            uint32_t n = v->len < f->lit_len ? v->len : f->lit_len;
+            c = memcmp(s, f->lit_str, n);
+            if (c == 0) c = (v->len > f->lit_len) - (v->len < f->lit_len);
+            break;
+        }
+        default:
+            c = (v->type == f->lit_type) ? 0 : 1;
+            if (f->cmp != JP_CMP_EQ && f->cmp != JP_CMP_NE) return false;
+            break;
+    }
+
+    switch (f->cmp) {
+        case JP_CMP_EQ: return c == 0;
+        case JP_CMP_NE: return c != 0;
+        case JP_CMP_LT: return c < 0;
+        case JP_CMP_LE: return c <= 0;
+        case JP_CMP_GT: return c > 0;
+        case JP_CMP_GE: return c >= 0;
+    }
+    return false;
+}
+
+/* Apply one non-descendant step to a single context node */
+static inline bool json_path_apply(JsonParser* p, const JsonNode* n, const JsonPathStep* st, JsonNodeVec* out)
+{
+    switch (st->op) {
+        case JP_CHILD: {
+            JsonNode* v = json_path_member(p, n, st);
+            return !v || json_nodevec_push(out, (uint32_t)(v - p->nodes));
+        }
+        case JP_INDEX: {
+            JsonNode* v = json_path_element(p, n, st->from);
+            return !v || json_nodevec_push(out, (uint32_t)(v - p->nodes));
+        }
+        case JP_SLICE: {
+            if (n->type != JSON_ARRAY) return true;
+            int64_t cnt = n->children;
+            int64_t a = st->has_from ? st->from : 0, b = st->has_to ? st->to : cnt;
+            if (a < 0) a += cnt;
+            if (b < 0) b += cnt;
+            if (a < 0) a = 0;
+            if (b > cnt) b = cnt;
+            JsonNode* v = json_first_child(p, n);
+            for (int64_t i = 0; i < b; ++i, v = json_next_sibling(p, v))
+                if (i >= a && !json_nodevec_push(out, (uint32_t)(v - p->nodes))) return false;
+            return true;
+        }
+        case JP_WILDCARD:
+        case JP_FILTER: {
+            if (!json_path_is_container(n)) return true;
+            bool obj = (n->type == JSON_OBJECT);
+            JsonNode* v = json_first_child(p, n);
+            for (uint32_t i = 0; i < n->children; ++i) {
+                if (obj) v = json_next_sibling(p, v);           /* step over the key */
+                if ((st->op == JP_WILDCARD || json_path_filter_match(p, v, st)) &&
+                    !json_nodevec_push(out, (uint32_t)(v - p->nodes)))
+                    return false;
+                v = json_next_sibling(p, v);
+            }
+            return true;
+        }
+    }
+    return true;
+}
+
+/*
+ * ..name – one linear pass over the subtree comparing the key hashes stored on
+ * the tape. A small stack of (subtree end, next key slot) pairs tells keys apart
+ * from string values without recursing.
+ */
+static inline bool json_path_scan_keys(JsonPath* jp, JsonParser* p, uint32_t root,
+                                       const JsonPathStep* st, JsonNodeVec* out)
+{
+    const JsonNode* nodes = p->nodes;
+    JsonNodeVec* stk = &jp->scan;
+    uint32_t end = root + 1 + nodes[root].hash;
+
+    stk->len = 0;
+    if (!json_nodevec_push(stk, end) ||
+        !json_nodevec_push(stk, nodes[root].type == JSON_OBJECT ? root + 1 : UINT32_MAX))
+        return false;
+
+    for (uint32_t i = root + 1; i < end; ++i) {
+        while (stk->idx[stk->len - 2] <= i) stk->len -= 2;
+
+        const JsonNode* n = &nodes[i];
+        uint32_t* slot = &stk->idx[stk->len - 1];
+        if (*slot == i) {
+            const JsonNode* v = n + 1;
+            *slot = i + 2 + (json_path_is_container(v) ? v->hash : 0);
+            if (n->hash == st->hash && n->len == st->name_len &&
+                memcmp(n->strval ? n->strval : p->buffer + n->offset, st->name, st->name_len) == 0 &&
+                !json_nodevec_push(out, i + 1))
+                return false;
+            continue;
+        }
+        if (json_path_is_container(n)) {
+            if (!json_nodevec_push(stk, i + 1 + n->hash) ||
+                !json_nodevec_push(stk, n->type == JSON_OBJECT ? i + 1 : UINT32_MAX))
+                return false;
+        }
+    }
+    return true;
+}
+
+static inline int json_path_cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * BFS tapes (json_relayout) have no contiguous subtrees: walk the containers
+ * breadth-first with jp->scan as the queue, then drop duplicates produced by
+ * nested context nodes.
+ */
+static inline bool json_path_descend_bfs(JsonPath* jp, JsonParser* p, const JsonPathStep* st, JsonNodeVec* out)
+{
+    JsonNodeVec* q = &jp->scan;
+    json_nodevec_clear(q);
+    for (uint64_t k = 0; k < jp->cur.len; ++k)
+        if (json_path_is_container(&p->nodes[jp->cur.idx[k]]) && !json_nodevec_push(q, jp->cur.idx[k])) return false;
+
+    for (uint64_t k = 0; k < q->len; ++k) {
+        const JsonNode* n = &p->nodes[q->idx[k]];
+        if (!json_path_apply(p, n, st, out)) return false;
+        if (!n->children) continue;
+        for (uint32_t i = n->hash, e = n->hash + (uint32_t)json_child_slots(n); i < e; ++i)
+            if (json_path_is_container(&p->nodes[i]) && !json_nodevec_push(q, i)) return false;
+    }
+
+    if (out->len > 1) {
+        uint64_t w = 1;
+        qsort(out->idx, out->len, sizeof(uint32_t), json_path_cmp_u32);
+        for (uint64_t k = 1; k < out->len; ++k)
+            if (out->idx[k] != out->idx[w - 1]) out->idx[w++] = out->idx[k];
+        out->len = w;
+    }
+    return true;
+}
+
+static inline bool json_path_descend(JsonPath* jp, JsonParser* p, const JsonPathStep* st, JsonNodeVec* out)
+{
+    JsonNodeVec* cur = &jp->cur;
+    uint32_t covered = 0;     /* tape index up to which subtrees were already searched */
+
+    if (p->layout == JSON_LAYOUT_BFS) return json_path_descend_bfs(jp, p, st, out);
+
+    /* Nested context nodes would be searched twice – sort and skip covered subtrees */
+    qsort(cur->idx, cur->len, sizeof(uint32_t), json_path_cmp_u32);
+
+    for (uint64_t k = 0; k < cur->len; ++k) {
+        uint32_t c = cur->idx[k];
+        const JsonNode* n = &p->nodes[c];
+        if (c < covered || !json_path_is_container(n)) continue;
+        covered = c + 1 + n->hash;
+
+        if (st->op == JP_CHILD) {
+            if (!json_path_scan_keys(jp, p, c, st, out)) return false;
+            continue;
+        }
+        /* Everything else: apply the step to every container in the subtree, in tape order */
+        for (uint32_t i = c; i < covered; ++i) {
+            if (json_path_is_container(&p->nodes[i]) && !json_path_apply(p, &p->nodes[i], st, out))
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Run a compiled query from root (NULL = document root). Matching node indices
+ * are written to out, which is cleared first. Returns the number of matches.
+ */
+static inline uint64_t json_path_eval(JsonPath* jp, JsonParser* p, const JsonNode* root, JsonNodeVec* out)
+{
+    json_nodevec_clear(out);
+    if (!root) root = json_root(p);
+    if (!root) return 0;
+
+    JsonNodeVec* cur = &jp->cur;
+    JsonNodeVec* next = &jp->next;
+    json_nodevec_clear(cur);
+    if (!json_nodevec_push(cur, (uint32_t)(root - p->nodes))) return 0;
+
+    for (uint32_t s = 0; s < jp->steps_len && cur->len; ++s) {
+        const JsonPathStep* st = &jp->steps[s];
+        json_nodevec_clear(next);
+
+        if (st->descendant) {
+            if (!json_path_descend(jp, p, st, next)) return 0;
+        } else {
+            for (uint64_t k = 0; k < cur->len; ++k)
+                if (!json_path_apply(p, &p->nodes[cur->idx[k]], st, next)) return 0;
+        }
+
+        JsonNodeVec tmp = *cur; *cur = *next; *next = tmp;
+    }
+
+    for (uint64_t k = 0; k < cur->len; ++k)
+        if (!json_nodevec_push(out, cur->idx[k])) break;
+    return out->len;
+}
+
+/* ---------------------------------------------------------------- */
+/* Full-path index: one probe per deep lookup                       */
+/* ---------------------------------------------------------------- */
+
+/*
+ * Every value in the document is keyed by a 64-bit hash of its full path, built
+ * from the parent's path hash and either a 64-bit hash of the key's bytes or
+ * the array index. Lookups of "a.b[2].c" hash the path and probe once,
+ * independent of depth; a hit on a member is confirmed against its key bytes.
+ */
+typedef struct {
+    uint64_t hash;
+    uint32_t node;      /* UINT32_MAX marks an empty slot */
+    uint32_t key;       /* the member's key node, UINT32_MAX for the root and array elements */
+} JsonPathIndexSlot;
+
+typedef struct {
+    JsonPathIndexSlot* slots;
+    uint64_t           cap;     /* power of two */
+    uint64_t           len;
+} JsonPathIndex;
+
+#define JSON_PATH_INDEX_SEED 0x6A09E667F3BCC909ULL
+
+static inline uint64_t json_path_index_mix(uint64_t parent, uint64_t x)
+{
+    uint64_t h = parent + 0x9E3779B97F4A7C15ULL * (x + 1);
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+/* FNV-1a over the raw key bytes: the 28-bit tape hash is too narrow to tell keys apart here */
+static inline uint64_t json_path_index_name(const char* s, size_t len)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < len; ++i) h = (h ^ (uint8_t)s[i]) * 0x100000001B3ULL;
+    return h;
+}
+
+static inline uint64_t json_path_index_key(uint64_t parent, uint64_t name_hash) { return json_path_index_mix(parent, name_hash); }
+static inline uint64_t json_path_index_elem(uint64_t parent, uint64_t i)        { return json_path_index_mix(parent, ~i); }
+
+static inline const char* json_path_index_key_text(const JsonParser* p, uint32_t key)
+{
+    const JsonNode* k = &p->nodes[key];
+    return k->strval ? k->strval : p->buffer + k->offset;
+}
+
+/* Does slot s hold the member named name[0..len)? NULL name matches anything. */
+static inline bool json_path_index_same_key(const JsonParser* p, const JsonPathIndexSlot* s, const char* name, uint32_t len)
+{
+    if (!name) return true;
+    if (s->key == UINT32_MAX) return false;
+    return p->nodes[s->key].len == len && memcmp(json_path_index_key_text(p, s->key), name, len) == 0;
+}
+
+/* A repeated key replaces the earlier member, as in json_get_object_value() */
+static inline void json_path_index_put(JsonPathIndex* ix, const JsonParser* p, uint64_t h, uint32_t key, uint32_t node)
+{
+    uint64_t mask = ix->cap - 1;
+    uint64_t i = h & mask;
+    const char* name = key == UINT32_MAX ? NULL : json_path_index_key_text(p, key);
+    uint32_t len = key == UINT32_MAX ? 0 : p->nodes[key].len;
+    while (ix->slots[i].node != UINT32_MAX) {
+        if (ix->slots[i].hash == h && (ix->slots[i].key == UINT32_MAX) == (key == UINT32_MAX) &&
+            json_path_index_same_key(p, &ix->slots[i], name, len)) {
+            ix->slots[i].node = node;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    ix->slots[i] = (JsonPathIndexSlot){ h, node, key };
+    ix->len++;
+}
+
+static inline uint64_t json_path_index_key_at(uint64_t parent, const JsonParser* p, uint32_t key)
+{
+    return json_path_index_key(parent, json_path_index_name(json_path_index_key_text(p, key), p->nodes[key].len));
+}
+
+static inline void json_path_index_free(JsonPathIndex* ix)
+{
+    free(ix->slots);
+    memset(ix, 0, sizeof(*ix));
+}
+
+/* One pass over the tape. The table is sized for the whole document at load factor <= 0.5. */
+static inline bool json_path_index_build(JsonPathIndex* ix, JsonParser* p)
+{
+    JSON_TRACE_SCOPE("json_path_index_build");
+    typedef struct { uint32_t end, slot, count; bool obj; uint64_t hash; } Frame;
+
+    memset(ix, 0, sizeof(*ix));
+    if (!p->nodes_len) return false;
+
+    ix->cap = 64;
+    while (ix->cap < p->nodes_len * 2) ix->cap <<= 1;
+    ix->slots = malloc(ix->cap * sizeof(JsonPathIndexSlot));
+    if (!ix->slots) return false;
+    for (uint64_t i = 0; i < ix->cap; ++i) ix->slots[i].node = UINT32_MAX;
+
+    uint64_t frames_cap = 64, depth = 0;
+    Frame* frames = malloc(frames_cap * sizeof(Frame));
+    if (!frames) { json_path_index_free(ix); return false; }
+
+    const JsonNode* nodes = p->nodes;
+    uint32_t n_end = (uint32_t)p->nodes_len;
+
+    if (p->layout == JSON_LAYOUT_BFS) {
+        /* parents precede children: carry each container's path hash in a side array */
+        uint64_t* ph = malloc(p->nodes_len * sizeof(uint64_t));
+        if (!ph) { free(frames); json_path_index_free(ix); return false; }
+        ph[0] = JSON_PATH_INDEX_SEED;
+        json_path_index_put(ix, p, ph[0], UINT32_MAX, 0);
+        for (uint32_t i = 0; i < n_end; ++i) {
+            const JsonNode* n = &nodes[i];
+            if (!json_path_is_container(n)) continue;
+            for (uint32_t k = 0; k < n->children; ++k) {
+                uint32_t v = (n->type == JSON_OBJECT) ? n->hash + 2 * k + 1 : n->hash + k;
+                uint32_t key = (n->type == JSON_OBJECT) ? v - 1 : UINT32_MAX;
+                ph[v] = (n->type == JSON_OBJECT) ? json_path_index_key_at(ph[i], p, key)
+                                                 : json_path_index_elem(ph[i], k);
+                json_path_index_put(ix, p, ph[v], key, v);
+            }
+        }
+        free(ph);
+        free(frames);
+        return true;
+    }
+
+    for (uint32_t i = 0; i < n_end; ++i) {
+        while (depth && frames[depth - 1].end <= i) depth--;
+
+        uint64_t h;
+        uint32_t v = i, key = UINT32_MAX;
+        if (!depth) {
+            if (i != 0) break;              /* trailing nodes after the root value */
+            h = JSON_PATH_INDEX_SEED;
+        } else {
+            Frame* f = &frames[depth - 1];
+            if (f->slot != i) continue;     /* inside a child subtree that is not a container */
+            if (f->obj) {
+                key = i;
+                h = json_path_index_key_at(f->hash, p, key);
+                v = i + 1;
+            } else {
+                h = json_path_index_elem(f->hash, f->count++);
+            }
+            f->slot = v + 1 + (json_path_is_container(&nodes[v]) ? nodes[v].hash : 0);
+        }
+
+        json_path_index_put(ix, p, h, key, v);
+
+        if (json_path_is_container(&nodes[v])) {
+            if (depth == frames_cap) {
+                Frame* mem = realloc(frames, 2 * frames_cap * sizeof(Frame));
+                if (!mem) { free(frames); json_path_index_free(ix); return false; }
+                frames = mem;
+                frames_cap *= 2;
+            }
+            frames[depth++] = (Frame){ .end = v + 1 + nodes[v].hash, .slot = v + 1,
+                                       .obj = nodes[v].type == JSON_OBJECT, .hash = h };
+        }
+        i = v;
+    }
+
+    free(frames);
+    return true;
+}
+
+/* Path hash, plus the last segment's name (NULL when the path ends in an index or is the root) */
+static inline bool json_path_index_hash_name(const char* path, uint64_t* out, const char** last, uint32_t* last_len)
+{
+    const char* c = path;
+    uint64_t h = JSON_PATH_INDEX_SEED;
+
+    if (*c == '$') c++;
+    if (*c == '.') c++;
+    *last = NULL;
+    *last_len = 0;
+
+    while (*c) {
+        if (*c == '[') {
+            c++;
+            if (*c == '\'' || *c == '"') {
+                const char* name; uint32_t len;
+                if (!json_path_parse_quoted(&c, &name, &len) || *c != ']') return false;
+                h = json_path_index_key(h, json_path_index_name(name, len));
+                *last = name;
+                *last_len = len;
+            } else {
+                int64_t i;
+                if (!json_path_parse_int(&c, &i) || i < 0 || *c != ']') return false;
+                h = json_path_index_elem(h, (uint64_t)i);
+                *last = NULL;
+            }
+            c++;
+        } else {
+            const char* name = c;
+            while (*c && *c != '.' && *c != '[') c++;
+            if (c == name) return false;
+            h = json_path_index_key(h, json_path_index_name(name, (size_t)(c - name)));
+            *last = name;
+            *last_len = (uint32_t)(c - name);
+        }
+        if (*c == '.') {
+            c++;
+            if (!*c) return false;
+        }
+    }
+    *out = h;
+    return true;
+}
+
+/*
+ * Hash a path such as "a.b[2].c", "$.a.b" or "a['x.y']". Compute it once and
+ * keep it next to the lookup site; the hash is stable for every document.
+ * Returns false on a malformed path.
+ */
+static inline bool json_path_index_hash(const char* path, uint64_t* out)
+{
+    const char* last;
+    uint32_t last_len;
+    return json_path_index_hash_name(path, out, &last, &last_len);
+}
+
+/* Probe for h; with a name, only a member under that key matches */
+static inline JsonNode* json_path_index_probe(const JsonPathIndex* ix, JsonParser* p, uint64_t h, const char* name, uint32_t len)
+{
+    if (!ix->cap) return NULL;
+    uint64_t mask = ix->cap - 1;
+    for (uint64_t i = h & mask; ix->slots[i].node != UINT32_MAX; i = (i + 1) & mask) {
+        if (ix->slots[i].hash == h && json_path_index_same_key(p, &ix->slots[i], name, len)) return &p->nodes[ix->slots[i].node];
+    }
+    return NULL;
+}
+
+/* Probe with a precomputed path hash */
+static inline JsonNode* json_path_index_find(const JsonPathIndex* ix, JsonParser* p, uint64_t h)
+{
+    return json_path_index_probe(ix, p, h, NULL, 0);
+}
+
+static inline JsonNode* json_path_index_get(const JsonPathIndex* ix, JsonParser* p, const char* path)
+{
+    uint64_t h;
+    const char* last;
+    uint32_t last_len;
+    return json_path_index_hash_name(path, &h, &last, &last_len) ? json_path_index_probe(ix, p, h, last, last_len) : NULL;
+}
+
+#endif /* CEJSON_PATH_H */
@@ -0,0 +1,239 @@
+/* cejson-pipeline.h – read + index on one thread, json_feed on another */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_PIPELINE_H
+#define CEJSON_PIPELINE_H
+
+#include "cejson.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * A single stream parsed by two threads. Stage A reads the next block from
+ * the fd into the caller's text buffer and builds its JsonChunkIndex: quote /
+ * backslash, non-whitespace and newline bitmaps, 16 bytes per SSE2 compare.
+ * Stage B (the caller) takes finished blocks off a lock-free single-producer /
+ * single-consumer ring and runs json_feed_indexed() over them, so strings and
+ * whitespace cost a bit scan instead of a byte loop. Reads, indexing and
+ * parsing of consecutive blocks overlap.
+ *
+ * The text buffer holds the whole stream, as the tape's offsets point into
+ * it; only the index slots are recycled. The stream must fit in text_cap
+ * (ENOBUFS otherwise).
+ *
+ *     JsonPipeline pl;
+ *     json_pipe_start(&pl, fd, text, text_cap);
+ *     bool ok = json_pipe_parse(&pl, &p);        // feeds every block, then json_finish()
+ *     json_pipe_stop(&pl);                       // joins stage A; pl.error holds its errno
+ */
+
+#ifndef JSON_PIPE_BLOCK
+#define JSON_PIPE_BLOCK (256 * 1024)      /* bytes per block, a multiple of 64 */
+#endif
+#define JSON_PIPE_SLOTS 8                 /* blocks in flight, a power of two */
+#define JSON_PIPE_WORDS (JSON_PIPE_BLOCK / 64)
+
+typedef struct {
+    const char*    data;
+    uint64_t       len;
+    JsonChunkIndex ix;
+} JsonPipeBlock;
+
+typedef struct {
+    int            fd;
+    char*          text;
+    uint64_t       text_cap;
+    uint64_t       text_len;        /* stage A's; final once done is set */
+
+    JsonPipeBlock  blocks[JSON_PIPE_SLOTS];
+    uint64_t*      bitmaps;         /* 3 * JSON_PIPE_WORDS per slot */
+
+    _Atomic uint64_t head;          /* blocks published by A */
+    _Atomic uint64_t tail;          /* blocks released by B */
+    _Atomic bool     done;          /* A has published its last block */
+    _Atomic bool     stop;          /* B gave up, A should stop waiting */
+    int            error;           /* errno from stage A, 0 if the stream ended cleanly */
+
+    uint64_t       waits_a, waits_b;    /* times A found the ring full / B found it empty */
+    pthread_t      thread;
+    bool           running;
+} JsonPipeline;
+
+/* Bit i of out[] for byte i of s[0..len), for the three bitmaps. len is padded to a whole word with clear bits. */
+static inline void json_pipe_index(const char* s, uint64_t len, uint64_t* quotes, uint64_t* solid, uint64_t* lines)
+{
+    uint64_t words = (len + 63) / 64;
+    for (uint64_t w = 0; w < words; ++w) {
+        const char* b = s + w * 64;
+        uint64_t q = 0, ws = 0, nl = 0;
+        if ((w + 1) * 64 <= len) {
+#if defined(__SSE2__)
+            for (int k = 0; k < 4; ++k) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(b + k * 16));
+                __m128i cr = _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), lf = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+                __m128i quote = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+                __m128i blank = _mm_or_si128(_mm_or_si128(cr, lf),
+                                             _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+                q  |= (uint64_t)(uint16_t)_mm_movemask_epi8(quote) << (k * 16);
+                ws |= (uint64_t)(uint16_t)_mm_movemask_epi8(blank) << (k * 16);
+                nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(cr, lf)) << (k * 16);
+            }
+#else
+            for (int k = 0; k < 8; ++k) {
+                uint64_t v;
+                memcpy(&v, b + k * 8, 8);
+                uint64_t cr = json_swar_eq(v, '\r') | json_swar_eq(v, '\n');
+                uint64_t quote = json_swar_eq(v, '"') | json_swar_eq(v, '\\');
+                uint64_t blank = cr | json_swar_eq(v, ' ') | json_swar_eq(v, '\t');
+                /* high bit of each byte -> one bit per byte */
+                q  |= (((quote >> 7) * 0x0102040810204080ULL) >> 56) << (k * 8);
+                ws |= (((blank >> 7) * 0x0102040810204080ULL) >> 56) << (k * 8);
+                nl |= (((cr >> 7) * 0x0102040810204080ULL) >> 56) << (k * 8);
+            }
+#endif
+        } else {
+            for (uint64_t i = 0; w * 64 + i < len; ++i) {
+                char c = b[i];
+                q  |= (uint64_t)(c == '"' || c == '\\') << i;
+                ws |= (uint64_t)(c == ' ' || c == '\t' || c == '\n' || c == '\r') << i;
+                nl |= (uint64_t)(c == '\n' || c == '\r') << i;
+            }
+            ws |= len % 64 ? ~0ULL << (len % 64) : 0;     /* spare bits must not look solid */
+        }
+        quotes[w] = q;
+        solid[w] = ~ws;
+        lines[w] = nl;
+    }
+}
+
+/* Spin briefly, then give the core away: with one core the other stage needs it to make progress */
+static inline void json_pipe_wait(uint32_t* spins)
+{
+    if (++*spins < 64) {
+#if defined(__SSE2__)
+        _mm_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+static inline void* json_pipe_stage_a(void* arg)
+{
+    JsonPipeline* pl = arg;
+    for (uint64_t h = 0; !atomic_load_explicit(&pl->stop, memory_order_relaxed); ++h) {
+        uint32_t spins = 0;
+        while (h - atomic_load_explicit(&pl->tail, memory_order_acquire) >= JSON_PIPE_SLOTS) {
+            if (atomic_load_explicit(&pl->stop, memory_order_relaxed)) goto out;
+            if (!spins) pl->waits_a++;
+            json_pipe_wait(&spins);
+        }
+
+        /* fill the block, short reads from pipes and sockets included */
+        uint64_t want = pl->text_cap - pl->text_len < JSON_PIPE_BLOCK ? pl->text_cap - pl->text_len : JSON_PIPE_BLOCK;
+        char* at = pl->text + pl->text_len;
+        uint64_t got = 0;
+        while (got < want) {
+            ssize_t n = read(pl->fd, at + got, (size_t)(want - got));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) { pl->error = errno; break; }
+            if (n == 0) break;
+            got += (uint64_t)n;
+        }
+        if (!got && !pl->error && want < JSON_PIPE_BLOCK) {
+            char probe;
+            if (read(pl->fd, &probe, 1) > 0) pl->error = ENOBUFS;     /* more input than text_cap */
+        }
+        if (!got) break;
+
+        uint64_t slot = h & (JSON_PIPE_SLOTS - 1);
+        uint64_t* m = pl->bitmaps + slot * 3 * JSON_PIPE_WORDS;
+        json_pipe_index(at, got, m, m + JSON_PIPE_WORDS, m + 2 * JSON_PIPE_WORDS);
+        pl->blocks[slot].data = at;
+        pl->blocks[slot].len = got;
+        pl->text_len += got;
+        atomic_store_explicit(&pl->head, h + 1, memory_order_release);
+        if (pl->error) break;
+    }
+out:
+    atomic_store_explicit(&pl->done, true, memory_order_release);
+    return NULL;
+}
+
+static inline bool json_pipe_start(JsonPipeline* pl, int fd, char* text, uint64_t text_cap)
+{
+    memset(pl, 0, sizeof(*pl));
+    pl->fd = fd;
+    pl->text = text;
+    pl->text_cap = text_cap;
+    pl->bitmaps = malloc((size_t)JSON_PIPE_SLOTS * 3 * JSON_PIPE_WORDS * sizeof(uint64_t));
+    if (!pl->bitmaps) return false;
+    for (int i = 0; i < JSON_PIPE_SLOTS; ++i) {
+        uint64_t* m = pl->bitmaps + (size_t)i * 3 * JSON_PIPE_WORDS;
+        pl->blocks[i].ix = (JsonChunkIndex){ m, m + JSON_PIPE_WORDS, m + 2 * JSON_PIPE_WORDS };
+    }
+    if (pthread_create(&pl->thread, NULL, json_pipe_stage_a, pl) != 0) {
+        free(pl->bitmaps);
+        pl->bitmaps = NULL;
+        return false;
+    }
+    pl->running = true;
+    return true;
+}
+
+/* Stage B: the next indexed block, NULL at the end of the stream. Give it back with json_pipe_release(). */
+static inline const JsonPipeBlock* json_pipe_next(JsonPipeline* pl)
+{
+    uint64_t t = atomic_load_explicit(&pl->tail, memory_order_relaxed);
+    uint32_t spins = 0;
+    for (;;) {
+        bool done = atomic_load_explicit(&pl->done, memory_order_acquire);
+        if (t < atomic_load_explicit(&pl->head, memory_order_acquire)) return &pl->blocks[t & (JSON_PIPE_SLOTS - 1)];
+        if (done) return NULL;
+        if (!spins) pl->waits_b++;
+        json_pipe_wait(&spins);
+    }
+}
+
+static inline void json_pipe_release(JsonPipeline* pl)
+{
+    atomic_fetch_add_explicit(&pl->tail, 1, memory_order_release);
+}
+
+/* Joins stage A; safe to call early (a failed parse) and more than once */
+static inline void json_pipe_stop(JsonPipeline* pl)
+{
+    if (pl->running) {
+        atomic_store_explicit(&pl->stop, true, memory_order_relaxed);
+        pthread_join(pl->thread, NULL);
+        pl->running = false;
+    }
+    free(pl->bitmaps);
+    pl->bitmaps = NULL;
+}
+
+/* Feeds the whole stream to p and finishes it; p->buffer / buf_len then cover the text read */
+static inline bool json_pipe_parse(JsonPipeline* pl, JsonParser* p)
+{
+    const JsonPipeBlock* b;
+    bool ok = true;
+    while (ok && (b = json_pipe_next(pl))) {
+        ok = json_feed_indexed(p, b->data, b->len, &b->ix);
+        json_pipe_release(pl);
+    }
+    json_pipe_stop(pl);                     /* text_len and error are final */
+    ok = ok && !pl->error && json_finish(p);
+    p->buffer = pl->text;
+    p->buf_len = pl->text_len;
+    return ok;
+}
+
+#endif /* CEJSON_PIPELINE_H */
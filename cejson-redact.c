@@ -0,0 +1,82 @@
+/* cejson-redact.c – stdin to stdout with members dropped, masked or renamed; constant memory */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "cejson.h"
+#include "cejson-redact.h"
+
+#define READ_SIZE (256 * 1024)
+
+static bool write_all(const char* s, size_t len)
+{
+    while (len) {
+        ssize_t n = write(STDOUT_FILENO, s, len);
+        if (n < 0) return false;
+        s += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-d key] [-m key=json] [-r key=newkey] ... < in > out\n", prog);
+    fprintf(stderr, " -d  drop the member\n");
+    fprintf(stderr, " -m  replace the value with json (default \"***\" when =json is left out)\n");
+    fprintf(stderr, " -r  rename the key\n");
+    fprintf(stderr, " key is a name matched at any depth, or an anchored path like $.user.email\n");
+}
+
+int main(int argc, char** argv)
+{
+    static JsonRedactor r;
+    json_redact_init(&r);
+
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        if (a[0] != '-' || !a[1] || a[2] || i + 1 >= argc) { usage(argv[0]); return 1; }
+        char* spec = argv[++i];
+        char* eq = strchr(spec, '=');
+        bool ok;
+        if (eq) *eq = '\0';
+        switch (a[1]) {
+        case 'd': ok = !eq && json_redact_add(&r, spec, JSON_REDACT_DROP, NULL); break;
+        case 'm': ok = json_redact_add(&r, spec, JSON_REDACT_REPLACE, eq ? eq + 1 : "\"***\""); break;
+        case 'r': ok = eq && json_redact_add(&r, spec, JSON_REDACT_RENAME, eq + 1); break;
+        default:  usage(argv[0]); return 1;
+        }
+        if (!ok) { fprintf(stderr, "Bad rule for %s: %s\n", a, spec); return 1; }
+    }
+
+    char* buf = malloc(READ_SIZE);
+    StringBuf out;
+    if (!buf || !stringbuf_init(&out, READ_SIZE * 2)) { perror("malloc"); return 1; }
+
+    int rc = 0;
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, buf, READ_SIZE);
+        if (n < 0) { perror("read"); rc = 2; break; }
+        if (n == 0) {
+            if (!json_redact_finish(&r)) { fprintf(stderr, "Input ends inside a document\n"); rc = 2; }
+            break;
+        }
+        bool ok = json_redact_feed(&r, buf, (uint64_t)n, &out);
+        if (out.size && !write_all(out.data, (size_t)out.size)) { perror("write"); rc = 2; break; }
+        out.size = 0;
+        if (!ok) {
+            fprintf(stderr, "%s at byte %llu (line %u), stopping\n", JsonErrorStr[r.error],
+                    (unsigned long long)r.error_pos, r.line + 1);
+            rc = 2;
+            break;
+        }
+    }
+
+    fprintf(stderr, "%llu dropped, %llu replaced, %llu renamed\n", (unsigned long long)r.dropped,
+            (unsigned long long)r.replaced, (unsigned long long)r.renamed);
+    stringbuf_free(&out);
+    free(buf);
+    json_redact_free(&r);
+    return rc;
+}
@@ -0,0 +1,422 @@
+/* cejson-redact.h – streaming redaction / rename of object members */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_REDACT_H
+#define CEJSON_REDACT_H
+
+#include "cejson.h"
+
+/*
+ * Copies a JSON stream (one document or many, e.g. NDJSON) to a StringBuf
+ * while dropping members, replacing their values or renaming their keys. No
+ * tape is built: a small state machine with the parser's states walks the
+ * input and everything that isn't touched goes out as spans of the input
+ * chunk. Memory is fixed: nesting up to JSON_REDACT_MAX_DEPTH and one held
+ * key of up to JSON_REDACT_KEY_MAX bytes.
+ *
+ * Rules name a key anywhere ("email") or an anchored path ("$.user.email";
+ * arrays are transparent, so "$.users.email" also matches every element of a
+ * users array). Names are compared with the raw, still escaped key bytes, by
+ * key hash first. The first matching rule wins.
+ *
+ *   JSON_REDACT_DROP     the member goes, along with the comma that separated it
+ *   JSON_REDACT_REPLACE  the value becomes the rule's JSON text
+ *   JSON_REDACT_RENAME   the key becomes the rule's name
+ *
+ * Scalars are copied without being validated; structure (brackets, colons,
+ * commas, strings) is checked and a violation stops the stream with
+ * JSON_ERR_UNEXPECTED at error_pos. Output already produced stays in the sink.
+ * The caller drains out between feeds to keep memory flat.
+ */
+
+#ifndef JSON_REDACT_MAX_DEPTH
+#define JSON_REDACT_MAX_DEPTH 1024
+#endif
+#ifndef JSON_REDACT_KEY_MAX
+#define JSON_REDACT_KEY_MAX   256         /* held key bytes, quotes included */
+#endif
+#define JSON_REDACT_WS_MAX    64          /* whitespace kept after a held comma; the rest is dropped */
+
+typedef enum {
+    JSON_REDACT_DROP = 0,
+    JSON_REDACT_REPLACE,
+    JSON_REDACT_RENAME
+} JsonRedactAction;
+
+typedef struct {
+    uint32_t    hash;               /* masked key hash of the last name */
+    uint32_t    path;               /* json_redact_step() chain from the root when anchored */
+    bool        anchored;
+    uint8_t     action;
+    char*       name;               /* last name, for the exact compare */
+    uint32_t    name_len;
+    char*       with;               /* REPLACE: JSON text, RENAME: new key */
+    uint32_t    with_len;
+} JsonRedactRule;
+
+/* Per nesting level */
+#define JSON_REDACT_OBJECT  0x1
+#define JSON_REDACT_EMITTED 0x2     /* a member of this object has been written */
+
+typedef struct {
+    JsonRedactRule* rules;
+    uint32_t    n_rules;
+    uint64_t    bloom;              /* json_key_bloom() of every rule name */
+
+    ParseState  state;              /* PS_IN_NUMBER covers true/false/null too */
+    uint32_t    depth;
+    uint8_t     level[JSON_REDACT_MAX_DEPTH];
+    uint32_t    path[JSON_REDACT_MAX_DEPTH];
+    uint32_t    member_path;        /* path of the member whose value comes next */
+    bool        in_escape;
+    bool        is_key;
+    bool        expect_key;
+    bool        after_comma;
+
+    bool        holding;            /* key bytes go to key[] until the decision */
+    char        key[JSON_REDACT_KEY_MAX];
+    uint32_t    key_len;
+    bool        comma_held;         /* object comma not yet written: the next member may be dropped */
+    char        ws[JSON_REDACT_WS_MAX];
+    uint32_t    ws_len;
+
+    const JsonRedactRule* replace;  /* rule for the value after the colon */
+    bool        quiet;              /* inside a dropped member or a replaced value */
+    bool        quiet_drop;
+    uint32_t    quiet_depth;
+
+    uint64_t    consumed;
+    uint32_t    line;
+    int         error;
+    uint64_t    error_pos;
+
+    uint64_t    dropped, replaced, renamed;
+} JsonRedactor;
+
+static inline uint32_t json_redact_step(uint32_t path, uint32_t hash)
+{
+    return (path ^ hash) * 0x9E3779B1u + 0x7F4A7C15u;
+}
+
+static inline void json_redact_init(JsonRedactor* r)
+{
+    memset(r, 0, sizeof(*r));
+    r->state = PS_NORMAL;
+}
+
+static inline void json_redact_free(JsonRedactor* r)
+{
+    for (uint32_t i = 0; i < r->n_rules; ++i) {
+        free(r->rules[i].name);
+        free(r->rules[i].with);
+    }
+    free(r->rules);
+    r->rules = NULL;
+    r->n_rules = 0;
+}
+
+/* Back to the start of a stream, keeping the rules */
+static inline void json_redact_reset(JsonRedactor* r)
+{
+    JsonRedactRule* rules = r->rules;
+    uint32_t n = r->n_rules;
+    uint64_t bloom = r->bloom;
+    json_redact_init(r);
+    r->rules = rules;
+    r->n_rules = n;
+    r->bloom = bloom;
+}
+
+static inline char* json_redact_dup(const char* s, size_t len)
+{
+    char* d = malloc(len + 1);
+    if (d) { memcpy(d, s, len); d[len] = '\0'; }
+    return d;
+}
+
+/*
+ * Adds a rule. with is the replacement JSON text for REPLACE (NULL means
+ * null; anything but one valid value is refused) and the new raw key for
+ * RENAME. Names may not contain '.' and must fit JSON_REDACT_KEY_MAX.
+ */
+static inline bool json_redact_add(JsonRedactor* r, const char* path, JsonRedactAction action, const char* with)
+{
+    if (!path || !*path) return false;
+    if (action == JSON_REDACT_REPLACE && !with) with = "null";
+    if (action != JSON_REDACT_DROP && (!with || (action == JSON_REDACT_REPLACE && !json_validate(with, strlen(with))))) return false;
+    if (action == JSON_REDACT_RENAME && strlen(with) + 2 > JSON_REDACT_KEY_MAX) return false;
+
+    JsonRedactRule rule = { .action = (uint8_t)action };
+    const char* name = path;
+    if (path[0] == '$') {
+        if (path[1] != '.') return false;
+        rule.anchored = true;
+        name = path + 2;
+        for (const char* dot; (dot = strchr(name, '.')); name = dot + 1) {
+            if (dot == name) return false;
+            rule.path = json_redact_step(rule.path, json_compute_hash_len(name, (size_t)(dot - name)) & JSON_HASH_MASK);
+        }
+    } else if (strchr(path, '.')) {
+        return false;
+    }
+    size_t len = strlen(name);
+    if (!len || len + 2 > JSON_REDACT_KEY_MAX) return false;
+    rule.hash = json_compute_hash_len(name, len) & JSON_HASH_MASK;
+    if (rule.anchored) rule.path = json_redact_step(rule.path, rule.hash);
+    rule.name_len = (uint32_t)len;
+
+    JsonRedactRule* rules = realloc(r->rules, (r->n_rules + 1) * sizeof(JsonRedactRule));
+    if (!rules) return false;
+    r->rules = rules;
+    rule.name = json_redact_dup(name, len);
+    rule.with = with ? json_redact_dup(with, strlen(with)) : NULL;
+    if (!rule.name || (with && !rule.with)) { free(rule.name); free(rule.with); return false; }
+    rule.with_len = with ? (uint32_t)strlen(with) : 0;
+    r->rules[r->n_rules++] = rule;
+    r->bloom |= json_key_bloom(rule.hash);
+    return true;
+}
+
+static inline bool json_redact_put(JsonRedactor* r, StringBuf* out, const char* s, uint64_t len)
+{
+    if (!len || stringbuf_append(out, s, (ssize_t)len)) return true;
+    r->error = JSON_ERR_CAPACITY;
+    return false;
+}
+
+static inline bool json_redact_fail(JsonRedactor* r, uint64_t pos)
+{
+    r->error = JSON_ERR_UNEXPECTED;
+    r->error_pos = r->consumed + pos;
+    return false;
+}
+
+/* The comma and whitespace held before a member that is kept after all */
+static inline bool json_redact_release(JsonRedactor* r, StringBuf* out)
+{
+    bool ok = true;
+    if (r->comma_held) {
+        /* ws is what followed the last held comma: with a run of dropped members before this one,
+           the whitespace after the last dropped member's comma stands in for the run */
+        if (r->level[r->depth - 1] & JSON_REDACT_EMITTED)
+            ok = json_redact_put(r, out, ",", 1) && json_redact_put(r, out, r->ws, r->ws_len);
+        r->comma_held = false;
+        r->ws_len = 0;
+    }
+    r->level[r->depth - 1] |= JSON_REDACT_EMITTED;
+    return ok;
+}
+
+/* More key bytes; a key too long for any rule is let go as it is */
+static inline bool json_redact_hold(JsonRedactor* r, const char* s, uint64_t len, StringBuf* out)
+{
+    if (r->key_len + len <= JSON_REDACT_KEY_MAX) {
+        memcpy(r->key + r->key_len, s, len);
+        r->key_len += (uint32_t)len;
+        return true;
+    }
+    r->holding = false;
+    r->member_path = json_redact_step(r->path[r->depth - 1], JSON_HASH_MASK + 1);
+    return json_redact_release(r, out) && json_redact_put(r, out, r->key, r->key_len) && json_redact_put(r, out, s, len);
+}
+
+/* Key complete in key[] (quotes included): drop, rename or write it */
+static inline bool json_redact_key(JsonRedactor* r, StringBuf* out)
+{
+    const char* name = r->key + 1;
+    uint32_t len = r->key_len - 2;
+    uint32_t hash = json_compute_hash_len(name, len) & JSON_HASH_MASK;
+    r->member_path = json_redact_step(r->path[r->depth - 1], hash);
+    r->holding = false;
+
+    const JsonRedactRule* rule = NULL;
+    uint64_t bits = json_key_bloom(hash);
+    if ((r->bloom & bits) == bits) {
+        for (uint32_t i = 0; i < r->n_rules && !rule; ++i) {
+            const JsonRedactRule* c = &r->rules[i];
+            if (c->hash == hash && c->name_len == len && (!c->anchored || c->path == r->member_path) &&
+                memcmp(c->name, name, len) == 0)
+                rule = c;
+        }
+    }
+
+    if (rule && rule->action == JSON_REDACT_DROP) {
+        r->comma_held = false;
+        r->ws_len = 0;
+        r->quiet = r->quiet_drop = true;
+        r->quiet_depth = r->depth;
+        r->dropped++;
+        return true;
+    }
+    if (!json_redact_release(r, out)) return false;
+    if (rule && rule->action == JSON_REDACT_RENAME) {
+        r->renamed++;
+        return json_redact_put(r, out, "\"", 1) && json_redact_put(r, out, rule->with, rule->with_len) &&
+               json_redact_put(r, out, "\"", 1);
+    }
+    r->replace = rule;
+    return json_redact_put(r, out, r->key, r->key_len);
+}
+
+/* A value ended at pos; a replaced one stops being suppressed there */
+static inline void json_redact_value_done(JsonRedactor* r, uint64_t pos, uint64_t* from)
+{
+    r->state = PS_AFTER_VALUE;
+    r->after_comma = false;
+    if (r->quiet && !r->quiet_drop && r->depth == r->quiet_depth) {
+        r->quiet = false;
+        *from = pos;
+    }
+}
+
+static inline bool json_redact_feed(JsonRedactor* r, const char* s, uint64_t len, StringBuf* out)
+{
+    if (unlikely(r->error)) return false;
+    uint64_t pos = 0, from = 0;
+
+#define JSON_REDACT_FLUSH(to) do { \
+        if (!r->quiet && !json_redact_put(r, out, s + from, (to) - from)) return false; \
+        from = (to); \
+    } while (0)
+
+    while (pos < len) {
+        if (r->state == PS_IN_STRING) {
+            if (r->in_escape) { r->in_escape = false; pos++; continue; }
+            pos += json_scan_string(s + pos, len - pos);
+            if (pos >= len) break;
+            if (s[pos++] == '\\') { r->in_escape = true; continue; }
+            if (!r->is_key) { json_redact_value_done(r, pos, &from); continue; }
+            r->state = PS_EXPECT_COLON;
+            if (r->holding) {
+                if (!json_redact_hold(r, s + from, pos - from, out)) return false;
+                from = pos;
+                if (r->holding && !json_redact_key(r, out)) return false;
+            }
+            continue;
+        }
+
+        if (r->state == PS_IN_NUMBER) {
+            char c = s[pos];
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' || c == 'E') { pos++; continue; }
+            json_redact_value_done(r, pos, &from);
+            continue;
+        }
+
+        uint64_t ws = pos;
+        skip_ws(s, len, &pos, &r->line);
+        if (r->comma_held && pos > ws) {
+            uint64_t n = pos - ws;
+            if (n > JSON_REDACT_WS_MAX - r->ws_len) n = JSON_REDACT_WS_MAX - r->ws_len;
+            memcpy(r->ws + r->ws_len, s + ws, n);
+            r->ws_len += (uint32_t)n;
+            from = pos;
+        }
+        if (pos >= len) break;
+        char c = s[pos];
+
+        if (r->state == PS_EXPECT_COLON) {
+            if (c != ':') return json_redact_fail(r, pos);
+            r->state = PS_NORMAL;
+            pos++;
+            continue;
+        }
+
+        bool object = r->depth && (r->level[r->depth - 1] & JSON_REDACT_OBJECT);
+        if ((c == '}' && object) || (c == ']' && r->depth && !object)) {
+            /* "[1,]", "{"a":1,}" and "{"a":}" */
+            if (r->state == PS_NORMAL && (r->after_comma || (object && !r->expect_key))) return json_redact_fail(r, pos);
+            if (r->quiet && r->quiet_drop && r->depth == r->quiet_depth) { r->quiet = false; from = pos; }
+            r->expect_key = false;
+            r->depth--;
+            pos++;
+            json_redact_value_done(r, pos, &from);
+            continue;
+        }
+
+        if (r->state == PS_AFTER_VALUE) {
+            if (c == ',' && r->depth) {
+                if (r->quiet && r->quiet_drop && r->depth == r->quiet_depth) { r->quiet = false; from = pos; }
+                r->state = PS_NORMAL;
+                r->after_comma = true;
+                if (object) {
+                    r->expect_key = true;
+                    if (!r->quiet) {
+                        JSON_REDACT_FLUSH(pos);
+                        r->comma_held = true;
+                        r->ws_len = 0;
+                    }
+                    from = pos + 1;
+                }
+                pos++;
+                continue;
+            }
+            if (r->depth) return json_redact_fail(r, pos);
+            r->state = PS_NORMAL;           /* next top-level document */
+        }
+
+        if (r->expect_key) {
+            if (c != '"') return json_redact_fail(r, pos);
+            r->expect_key = r->after_comma = false;
+            r->state = PS_IN_STRING;
+            r->is_key = true;
+            if (!r->quiet) {
+                JSON_REDACT_FLUSH(pos);
+                r->holding = true;
+                r->key_len = 0;
+            }
+            pos++;
+            continue;
+        }
+
+        if (r->replace) {
+            JSON_REDACT_FLUSH(pos);
+            if (!json_redact_put(r, out, r->replace->with, r->replace->with_len)) return false;
+            r->replace = NULL;
+            r->quiet = true;
+            r->quiet_drop = false;
+            r->quiet_depth = r->depth;
+            r->replaced++;
+        }
+        r->after_comma = false;
+
+        if (c == '{' || c == '[') {
+            if (r->depth >= JSON_REDACT_MAX_DEPTH) { r->error = JSON_ERR_CAPACITY; r->error_pos = r->consumed + pos; return false; }
+            r->path[r->depth] = !r->depth ? 0 : object ? r->member_path : r->path[r->depth - 1];
+            r->level[r->depth++] = c == '{' ? JSON_REDACT_OBJECT : 0;
+            r->expect_key = c == '{';
+            r->state = PS_NORMAL;
+        } else if (c == '"') {
+            r->state = PS_IN_STRING;
+            r->is_key = false;
+        } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+            r->state = PS_IN_NUMBER;
+        } else {
+            return json_redact_fail(r, pos);
+        }
+        pos++;
+    }
+
+    if (r->holding) {
+        if (!json_redact_hold(r, s + from, len - from, out)) return false;
+    } else {
+        JSON_REDACT_FLUSH(len);
+    }
+#undef JSON_REDACT_FLUSH
+
+    r->consumed += len;
+    return true;
+}
+
+/* End of stream: false if a document was left open */
+static inline bool json_redact_finish(JsonRedactor* r)
+{
+    if (r->error) return false;
+    if (r->depth || r->state == PS_IN_STRING || r->state == PS_EXPECT_COLON) {
+        r->error = JSON_ERR_INCOMPLETE;
+        r->error_pos = r->consumed;
+        return false;
+    }
+    return true;
+}
+
+#endif /* CEJSON_REDACT_H */
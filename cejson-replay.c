@@ -0,0 +1,216 @@
+/* cejson-replay.c – capture the chunking of a live stream, then re-drive the parser with it */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "cejson.h"
+#include "cejson-alloc.h"
+#include "cejson-capture.h"
+
+#define READ_SIZE (64 * 1024)
+
+typedef struct {
+    bool     paced;
+    bool     adaptive;
+    bool     ndjson;
+    uint64_t docs;
+    uint64_t errors;
+} Replay;
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* q-quantile of a sorted array */
+static uint64_t quantile(const uint64_t* v, uint64_t n, double q)
+{
+    if (!n) return 0;
+    uint64_t i = (uint64_t)(q * (double)(n - 1) + 0.5);
+    return v[i];
+}
+
+static int capture(const char* base, bool pass)
+{
+    JsonCapture c;
+    if (!json_capture_open(&c, base)) { perror(base); return 1; }
+    char* buf = malloc(READ_SIZE);
+    if (!buf) { perror("malloc"); return 1; }
+
+    bool ok = true;
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, buf, READ_SIZE);
+        if (n < 0) { perror("read"); ok = false; break; }
+        if (n == 0) break;
+        if (!json_capture_chunk(&c, buf, (uint64_t)n)) { perror(base); ok = false; break; }
+        if (pass && fwrite(buf, 1, (size_t)n, stdout) != (size_t)n) { perror("write"); ok = false; break; }
+    }
+    if (!json_capture_close(&c)) { perror(base); ok = false; }
+    fprintf(stderr, "captured %llu chunks, %llu bytes to %s.data / %s.feeds\n",
+            (unsigned long long)c.chunks, (unsigned long long)c.bytes, base, base);
+    free(buf);
+    return ok ? 0 : 2;
+}
+
+static bool feed(Replay* r, JsonParser* p, const char* s, uint64_t len)
+{
+    return r->adaptive ? json_feed_auto(p, s, len) : json_feed(p, s, len);
+}
+
+/* NDJSON: each newline ends a document, chunk boundaries inside a line are kept */
+static void feed_lines(Replay* r, JsonParser* p, JsonParserBuffers* bufs, const char* s, uint64_t len)
+{
+    while (len) {
+        const char* nl = memchr(s, '\n', (size_t)len);
+        uint64_t n = nl ? (uint64_t)(nl - s) : len;
+        if (n && !p->error) feed(r, p, s, n);
+        if (!nl) return;
+        if (p->error) r->errors++;
+        else if (p->nodes_len || p->state != PS_NORMAL) {
+            if (json_finish(p)) r->docs++;
+            else r->errors++;
+        }
+        json_init_buffers(p, bufs);
+        s += n + 1;
+        len -= n + 1;
+    }
+}
+
+static int replay(const char* base, Replay* r, int iterations)
+{
+    JsonFeedTrace t;
+    if (!json_feedtrace_load(&t, base)) { fprintf(stderr, "Cannot load capture %s.data / %s.feeds\n", base, base); return 1; }
+    if (!t.chunks) { fprintf(stderr, "Empty capture\n"); json_feedtrace_free(&t); return 1; }
+
+    /* worst case one node per two bytes of the longest document */
+    uint64_t longest = t.len;
+    if (r->ndjson) {
+        longest = 0;
+        for (const char *s = t.data, *end = t.data + t.len; s < end; ) {
+            const char* nl = memchr(s, '\n', (size_t)(end - s));
+            const char* e = nl ? nl : end;
+            if ((uint64_t)(e - s) > longest) longest = (uint64_t)(e - s);
+            s = e + 1;
+        }
+    }
+    JsonParserBuffers bufs;
+    if (!json_alloc_parser_buffers(&bufs, longest / 2 + 64, longest / 4 + 64, JSON_ALLOC_DEFAULT)) {
+        perror("json_alloc_parser_buffers");
+        json_feedtrace_free(&t);
+        return 1;
+    }
+
+    uint64_t n = t.chunks * (uint64_t)iterations;
+    uint64_t* lat = malloc(n * sizeof(uint64_t));
+    uint64_t* lag = r->paced ? malloc(n * sizeof(uint64_t)) : NULL;
+    uint64_t* sizes = malloc(t.chunks * sizeof(uint64_t));
+    if (!lat || !sizes || (r->paced && !lag)) { perror("malloc"); return 1; }
+
+    uint64_t busy = 0, k = 0;
+    uint64_t wall = json_capture_now();
+    bool ok = true;
+    for (int it = 0; ok && it < iterations; ++it) {
+        JsonParser p;
+        json_init_buffers(&p, &bufs);
+        const char* s = t.data;
+        uint64_t t0 = json_capture_now();
+
+        for (uint64_t i = 0; i < t.chunks; ++i, ++k) {
+            uint64_t due = t0 + t.arrival_ns[i];
+            if (r->paced) {
+                struct timespec ts = { .tv_sec = (time_t)(due / 1000000000ULL), .tv_nsec = (long)(due % 1000000000ULL) };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {}
+            }
+            uint64_t start = json_capture_now();
+            if (r->ndjson) feed_lines(r, &p, &bufs, s, t.chunk_len[i]);
+            else if (!p.error) feed(r, &p, s, t.chunk_len[i]);
+            uint64_t end = json_capture_now();
+
+            lat[k] = end - start;
+            if (lag) lag[k] = end - due;
+            busy += end - start;
+            s += t.chunk_len[i];
+        }
+
+        if (r->ndjson) {
+            if (p.error) r->errors++;
+            else if (p.nodes_len || p.state != PS_NORMAL) { if (json_finish(&p)) r->docs++; else r->errors++; }
+        } else if (json_finish(&p)) {
+            r->docs++;
+        } else {
+            fprintf(stderr, "Parse failed (%s at %llu), stopping\n", JsonErrorStr[p.error], (unsigned long long)p.error_pos);
+            r->errors++;
+            ok = false;
+        }
+    }
+    wall = json_capture_now() - wall;
+
+    for (uint64_t i = 0; i < t.chunks; ++i) sizes[i] = t.chunk_len[i];
+    qsort(sizes, t.chunks, sizeof(uint64_t), cmp_u64);
+    qsort(lat, k, sizeof(uint64_t), cmp_u64);
+
+    double secs = busy / 1e9;
+    printf("capture:    %llu chunks, %llu bytes over %.3f s\n", (unsigned long long)t.chunks,
+           (unsigned long long)t.len, t.arrival_ns[t.chunks - 1] / 1e9);
+    printf("chunk size: p50 %llu  p99 %llu  max %llu bytes\n", (unsigned long long)quantile(sizes, t.chunks, 0.5),
+           (unsigned long long)quantile(sizes, t.chunks, 0.99), (unsigned long long)sizes[t.chunks - 1]);
+    printf("feed:       p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f us\n", quantile(lat, k, 0.5) / 1e3,
+           quantile(lat, k, 0.99) / 1e3, quantile(lat, k, 0.999) / 1e3, k ? lat[k - 1] / 1e3 : 0.0);
+    if (lag) {
+        qsort(lag, k, sizeof(uint64_t), cmp_u64);
+        printf("arrival->parsed: p50 %.1f  p99 %.1f  max %.1f us\n", quantile(lag, k, 0.5) / 1e3,
+               quantile(lag, k, 0.99) / 1e3, k ? lag[k - 1] / 1e3 : 0.0);
+    }
+    printf("throughput: %.2f MB/s parsing, %.2f MB/s wall (%d pass%s, %s%s)\n",
+           secs > 0 ? (double)t.len * iterations / (1024.0 * 1024.0) / secs : 0.0,
+           wall ? (double)t.len * iterations / (1024.0 * 1024.0) / (wall / 1e9) : 0.0,
+           iterations, iterations == 1 ? "" : "es", r->paced ? "paced" : "as fast as possible",
+           r->adaptive ? ", adaptive" : "");
+    printf("documents:  %llu parsed, %llu failed\n", (unsigned long long)r->docs, (unsigned long long)r->errors);
+
+    free(lat);
+    free(lag);
+    free(sizes);
+    json_free_parser_buffers(&bufs);
+    json_feedtrace_free(&t);
+    return ok && !r->errors ? 0 : 2;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s -c base [-p]                      capture stdin\n", prog);
+    fprintf(stderr, "       %s [-r] [-a] [-n] [-i iterations] base  replay\n", prog);
+    fprintf(stderr, " -c  write each read() of stdin as one chunk to base.data / base.feeds\n");
+    fprintf(stderr, " -p  pass captured bytes through to stdout\n");
+    fprintf(stderr, " -r  paced: feed each chunk at its recorded arrival time\n");
+    fprintf(stderr, " -a  use json_feed_auto()\n");
+    fprintf(stderr, " -n  the stream is NDJSON (one document per line)\n");
+    fprintf(stderr, " -i  replay the capture this many times (default 1)\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* capture_base = NULL;
+    bool pass = false;
+    Replay r = {0};
+    int iterations = 1;
+    int arg_start = 1;
+
+    for (; arg_start < argc && argv[arg_start][0] == '-'; arg_start++) {
+        const char* a = argv[arg_start];
+        if (!strcmp(a, "-c") && arg_start + 1 < argc) capture_base = argv[++arg_start];
+        else if (!strcmp(a, "-p")) pass = true;
+        else if (!strcmp(a, "-r")) r.paced = true;
+        else if (!strcmp(a, "-a")) r.adaptive = true;
+        else if (!strcmp(a, "-n")) r.ndjson = true;
+        else if (!strcmp(a, "-i") && arg_start + 1 < argc) iterations = atoi(argv[++arg_start]);
+        else { usage(argv[0]); return 1; }
+    }
+
+    if (capture_base) return capture(capture_base, pass);
+    if (arg_start != argc - 1 || iterations < 1) { usage(argv[0]); return 1; }
+    return replay(argv[arg_start], &r, iterations);
+}
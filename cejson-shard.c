@@ -0,0 +1,281 @@
+/* cejson-shard.c – split NDJSON into N shard files by the hash of a key path.
+   Blocks are parsed in parallel; each shard file keeps the input order. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cejson.h"
+#include "cejson-alloc.h"
+#include "cejson-ndjson.h"
+#include "cejson-shard.h"
+
+#define BLOCK_SIZE (4 * 1024 * 1024)
+#define MAX_SHARDS 65536
+
+typedef struct Block {
+    struct Block* next;
+    char*         data;
+    uint64_t      len, cap;
+    uint64_t      seq;
+} Block;
+
+typedef struct {
+    pthread_mutex_t mu;
+    pthread_cond_t  has_work;
+    pthread_cond_t  has_free;
+    Block*          work_head;
+    Block*          work_tail;
+    Block*          free;
+    bool            done;
+
+    const JsonProjection* key;
+    JsonShardWriter*      out;
+    atomic_uint_fast64_t  records, failed;
+} Pipeline;
+
+typedef struct {
+    Pipeline*         pl;
+    JsonParserBuffers bufs;
+    JsonShardBatch    batch;
+    uint8_t*          key;
+    uint64_t          key_cap;
+    StringBuf         scratch;
+    pthread_t         tid;
+} Worker;
+
+/* Parses one record and picks its shard; false if it doesn't parse */
+static bool pick_shard(Worker* w, const char* line, uint64_t len, uint32_t* shard)
+{
+    uint64_t need = len / 2 + 64;
+    if (w->bufs.nodes_cap < need) {
+        json_free_parser_buffers(&w->bufs);
+        if (!json_alloc_parser_buffers(&w->bufs, need, need, JSON_ALLOC_DEFAULT)) return false;
+    }
+    if (w->key_cap < len + 16) {
+        free(w->key);
+        w->key_cap = len + 16;
+        if (!(w->key = malloc(w->key_cap))) { w->key_cap = 0; return false; }
+    }
+    JsonParser p;
+    json_init_buffers(&p, &w->bufs);
+    p.quiet = true;                 /* bad lines are counted and sent to shard 0 */
+    if (!json_feed(&p, line, len) || !json_finish(&p)) return false;
+    p.buffer = line;
+    *shard = json_shard_pick(w->pl->key, &p, w->key, &w->scratch, w->batch.n);
+    return true;
+}
+
+/* Routes every line of the block; unparseable lines go to shard 0 so nothing is lost */
+static bool shard_block(Worker* w, const Block* b)
+{
+    Pipeline* pl = w->pl;
+    uint64_t records = 0, failed = 0;
+    const char* s = b->data;
+    const char* end = b->data + b->len;
+    bool ok = true;
+
+    while (s < end) {
+        const char* nl = memchr(s, '\n', (size_t)(end - s));
+        const char* e = nl ? nl : end;
+        const char* t = s;
+        while (t < e && (*t == ' ' || *t == '\t' || *t == '\r')) t++;
+        if (t == e) { s = e + 1; continue; }
+
+        uint64_t len = (uint64_t)(e - s);
+        uint32_t shard = 0;
+        if (!pick_shard(w, s, len, &shard)) failed++;
+        if (!json_shard_route(&w->batch, shard, s, len)) ok = false;
+        records++;
+        s = e + 1;
+    }
+    atomic_fetch_add(&pl->records, records);
+    atomic_fetch_add(&pl->failed, failed);
+    return json_shard_commit(pl->out, b->seq, &w->batch) && ok;
+}
+
+static void* worker_main(void* arg)
+{
+    Worker* w = arg;
+    Pipeline* pl = w->pl;
+    for (;;) {
+        pthread_mutex_lock(&pl->mu);
+        while (!pl->work_head && !pl->done) pthread_cond_wait(&pl->has_work, &pl->mu);
+        Block* b = pl->work_head;
+        if (b) {
+            pl->work_head = b->next;
+            if (!pl->work_head) pl->work_tail = NULL;
+        }
+        pthread_mutex_unlock(&pl->mu);
+        if (!b) break;
+
+        if (!shard_block(w, b)) atomic_fetch_add(&pl->failed, 1);
+
+        pthread_mutex_lock(&pl->mu);
+        b->next = pl->free;
+        pl->free = b;
+        pthread_cond_signal(&pl->has_free);
+        pthread_mutex_unlock(&pl->mu);
+    }
+    return NULL;
+}
+
+/* Reads every input into blocks and queues them; returns false on a read error */
+static bool read_inputs(Pipeline* pl, char** files, int n_files)
+{
+    bool ok = true;
+    uint64_t seq = 0;
+    for (int f = 0; f < (n_files ? n_files : 1); ++f) {
+        const char* path = n_files ? files[f] : "-";
+        int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+        if (fd < 0) { perror(path); ok = false; continue; }
+
+        JsonNdjsonReader r;
+        json_ndjson_reader_init(&r, fd);
+        for (;;) {
+            pthread_mutex_lock(&pl->mu);
+            while (!pl->free) pthread_cond_wait(&pl->has_free, &pl->mu);
+            Block* b = pl->free;
+            pl->free = b->next;
+            pthread_mutex_unlock(&pl->mu);
+
+            JSON_TRACE_BEGIN("read");
+            int64_t n = json_ndjson_read(&r, &b->data, &b->cap);
+            JSON_TRACE_END("read");
+            if (n <= 0) {
+                if (n < 0) { perror(path); ok = false; }
+                pthread_mutex_lock(&pl->mu);
+                b->next = pl->free;
+                pl->free = b;
+                pthread_mutex_unlock(&pl->mu);
+                break;
+            }
+
+            b->len = (uint64_t)n;
+            b->seq = seq++;
+            b->next = NULL;
+            pthread_mutex_lock(&pl->mu);
+            if (pl->work_tail) pl->work_tail->next = b; else pl->work_head = b;
+            pl->work_tail = b;
+            pthread_cond_signal(&pl->has_work);
+            pthread_mutex_unlock(&pl->mu);
+        }
+        json_ndjson_reader_free(&r);
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    return ok;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s -k path -n shards [-o prefix] [-t threads] [-v] [file.ndjson ...]\n", prog);
+    fprintf(stderr, " -k  key path (customer_id, a.b, a[0], ['odd.key'])\n");
+    fprintf(stderr, " -n  number of shards, 1..%d\n", MAX_SHARDS);
+    fprintf(stderr, " -o  output prefix (default shard-); files are <prefix>NNN.ndjson\n");
+    fprintf(stderr, " -t  worker threads (default: online CPUs)\n");
+    fprintf(stderr, " -v  print per-shard record counts to stderr\n");
+    fprintf(stderr, "Reads stdin when no file (or -) is given. Lines that don't parse go to shard 0.\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* key = NULL;
+    const char* prefix = "shard-";
+    long n_shards = 0;
+    bool verbose = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg_start = 1;
+
+    for (; arg_start < argc && argv[arg_start][0] == '-' && argv[arg_start][1]; arg_start++) {
+        if (!strcmp(argv[arg_start], "-k") && arg_start + 1 < argc) key = argv[++arg_start];
+        else if (!strcmp(argv[arg_start], "-n") && arg_start + 1 < argc) n_shards = strtol(argv[++arg_start], NULL, 10);
+        else if (!strcmp(argv[arg_start], "-o") && arg_start + 1 < argc) prefix = argv[++arg_start];
+        else if (!strcmp(argv[arg_start], "-t") && arg_start + 1 < argc) threads = strtol(argv[++arg_start], NULL, 10);
+        else if (!strcmp(argv[arg_start], "-v")) verbose = true;
+        else { usage(argv[0]); return 1; }
+    }
+    if (!key || n_shards < 1 || n_shards > MAX_SHARDS) { usage(argv[0]); return 1; }
+    if (threads < 1) threads = 1;
+
+    JsonProjection proj;
+    if (!json_projection_compile(&proj, &key, 1)) {
+        fprintf(stderr, "Bad key path '%s' at offset %zu\n", key, proj.error_pos);
+        return 1;
+    }
+
+    int* fds = malloc((size_t)n_shards * sizeof(int));
+    if (!fds) { perror("malloc"); return 1; }
+    int width = snprintf(NULL, 0, "%ld", n_shards - 1);
+    for (long i = 0; i < n_shards; ++i) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s%0*ld.ndjson", prefix, width, i);
+        if ((fds[i] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) { perror(path); return 1; }
+    }
+
+    JsonShardWriter out;
+    if (!json_shard_open(&out, fds, (uint32_t)n_shards)) { perror("writer"); return 1; }
+
+    Pipeline pl = { .key = &proj, .out = &out };
+    pthread_mutex_init(&pl.mu, NULL);
+    pthread_cond_init(&pl.has_work, NULL);
+    pthread_cond_init(&pl.has_free, NULL);
+
+    /* two blocks per worker: one being routed, one queued */
+    long n_blocks = 2 * threads + 1;
+    Block* blocks = calloc((size_t)n_blocks, sizeof(Block));
+    if (!blocks) { perror("calloc"); return 1; }
+    for (long i = 0; i < n_blocks; ++i) {
+        blocks[i].cap = BLOCK_SIZE;
+        blocks[i].data = malloc(BLOCK_SIZE);
+        if (!blocks[i].data) { perror("malloc"); return 1; }
+        blocks[i].next = pl.free;
+        pl.free = &blocks[i];
+    }
+
+    Worker* workers = calloc((size_t)threads, sizeof(Worker));
+    if (!workers) { perror("calloc"); return 1; }
+    long started = 0;
+    for (; started < threads; ++started) {
+        Worker* w = &workers[started];
+        w->pl = &pl;
+        if (!json_shard_batch_init(&w->batch, (uint32_t)n_shards) || !stringbuf_init(&w->scratch, 4096)) break;
+        if (pthread_create(&w->tid, NULL, worker_main, w) != 0) break;
+    }
+    if (!started) { perror("pthread_create"); return 1; }
+
+    bool ok = read_inputs(&pl, &argv[arg_start], argc - arg_start);
+
+    pthread_mutex_lock(&pl.mu);
+    pl.done = true;
+    pthread_cond_broadcast(&pl.has_work);
+    pthread_mutex_unlock(&pl.mu);
+    for (long t = 0; t < started; ++t) pthread_join(workers[t].tid, NULL);
+    if (verbose)
+        for (long i = 0; i < n_shards; ++i) fprintf(stderr, "shard %ld: %llu records\n", i, (unsigned long long)out.records[i]);
+    if (!json_shard_close(&out)) { fprintf(stderr, "write: %s\n", strerror(out.error)); ok = false; }
+
+    if (verbose)
+        fprintf(stderr, "%llu records, %llu bad lines, %llu bytes in %llu writes\n",
+                (unsigned long long)atomic_load(&pl.records), (unsigned long long)atomic_load(&pl.failed),
+                (unsigned long long)out.bytes, (unsigned long long)out.writes);
+
+    for (long i = 0; i < n_shards; ++i) close(fds[i]);
+    for (long t = 0; t < threads; ++t) {
+        json_free_parser_buffers(&workers[t].bufs);
+        json_shard_batch_free(&workers[t].batch);
+        stringbuf_free(&workers[t].scratch);
+        free(workers[t].key);
+    }
+    for (long i = 0; i < n_blocks; ++i) free(blocks[i].data);
+    free(blocks);
+    free(workers);
+    free(fds);
+    json_projection_free(&proj);
+    pthread_cond_destroy(&pl.has_free);
+    pthread_cond_destroy(&pl.has_work);
+    pthread_mutex_destroy(&pl.mu);
+    return ok && !atomic_load(&pl.failed) ? 0 : 2;
+}
@@ -0,0 +1,202 @@
+/* cejson-shard.h – route NDJSON records to N shard outputs by the hash of a key path */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_SHARD_H
+#define CEJSON_SHARD_H
+
+#include "cejson.h"
+#include "cejson-ndjson.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * A record's shard comes from its key (a JsonProjection column) encoded with
+ * json_key_encode(), so "a\u0062" and "ab", or 7 and 7.0, land together and
+ * a missing key routes like null. The encoding is hashed with
+ * json_key_hash() and mapped onto [0, n) by a multiply, not a modulo. The
+ * hash is fixed: a key always goes to the same shard for the same n.
+ *
+ * Workers route whole batches into a JsonShardBatch, copying each record's
+ * original bytes into its shard's buffer. json_shard_commit() hands batches to
+ * the JsonShardWriter in sequence order, so every shard file keeps the input
+ * order. The writer holds a pending buffer per shard and issues one writev()
+ * for pending plus the batch once that reaches flush_bytes.
+ *
+ *     JsonShardWriter w;
+ *     json_shard_open(&w, fds, n);
+ *     // per worker: JsonShardBatch b; json_shard_batch_init(&b, n);
+ *     //   json_shard_route(&b, shard, rec, len) ... json_shard_commit(&w, seq, &b);
+ *     json_shard_close(&w);
+ */
+
+#define JSON_SHARD_FLUSH (4 * 1024 * 1024)     /* bytes per shard per write */
+
+/* Shard of an encoded key: the hash's top 32 bits scaled onto [0, n) */
+static inline uint32_t json_shard_of(const uint8_t* key, uint32_t key_len, uint32_t n)
+{
+    return (uint32_t)(((json_key_hash(key, key_len) >> 32) * n) >> 32);
+}
+
+/* Shard of a parsed record by its first projection column. key needs room for the record's length + 16 bytes. */
+static inline uint32_t json_shard_pick(const JsonProjection* pj, JsonParser* p, uint8_t* key, StringBuf* scratch, uint32_t n)
+{
+    const JsonNode* cell[1];
+    json_projection_resolve(pj, p, NULL, cell);
+    return json_shard_of(key, json_key_encode(p, cell[0], key, scratch), n);
+}
+
+/* ---------------------------------------------------------------- */
+/* Batches: one worker's records, split by shard                    */
+/* ---------------------------------------------------------------- */
+
+typedef struct {
+    StringBuf* out;                 /* one per shard, original record bytes with '\n' */
+    uint64_t*  counts;              /* records per shard */
+    uint32_t   n;
+} JsonShardBatch;
+
+static inline void json_shard_batch_free(JsonShardBatch* b)
+{
+    for (uint32_t i = 0; b->out && i < b->n; ++i) stringbuf_free(&b->out[i]);
+    free(b->out);
+    free(b->counts);
+    memset(b, 0, sizeof(*b));
+}
+
+static inline bool json_shard_batch_init(JsonShardBatch* b, uint32_t n)
+{
+    memset(b, 0, sizeof(*b));
+    b->out = calloc(n, sizeof(StringBuf));
+    b->counts = calloc(n, sizeof(uint64_t));
+    if (!b->out || !b->counts) { free(b->out); free(b->counts); return false; }
+    b->n = n;
+    for (uint32_t i = 0; i < n; ++i)
+        if (!stringbuf_init(&b->out[i], 4096)) { json_shard_batch_free(b); return false; }
+    return true;
+}
+
+static inline bool json_shard_route(JsonShardBatch* b, uint32_t shard, const char* rec, uint64_t len)
+{
+    StringBuf* sb = &b->out[shard];
+    if (!stringbuf_reserve(sb, sb->size + (ssize_t)len + 2)) return false;
+    memcpy(sb->data + sb->size, rec, len);
+    sb->size += (ssize_t)len;
+    sb->data[sb->size++] = '\n';
+    sb->data[sb->size] = '\0';
+    b->counts[shard]++;
+    return true;
+}
+
+/* ---------------------------------------------------------------- */
+/* Writer: batches in sequence order, large writes per shard        */
+/* ---------------------------------------------------------------- */
+
+typedef struct {
+    const int*      fds;            /* one per shard, owned by the caller */
+    uint32_t        n;
+    StringBuf*      pending;
+    uint64_t*       records;        /* per shard, committed so far */
+    uint64_t        flush_bytes;
+    uint64_t        bytes, writes;
+
+    pthread_mutex_t mu;
+    pthread_cond_t  turn;
+    uint64_t        next_seq;
+    int             error;          /* first write errno; later commits are dropped */
+} JsonShardWriter;
+
+static inline bool json_shard_open(JsonShardWriter* w, const int* fds, uint32_t n)
+{
+    memset(w, 0, sizeof(*w));
+    w->fds = fds;
+    w->n = n;
+    w->flush_bytes = JSON_SHARD_FLUSH;
+    w->pending = calloc(n, sizeof(StringBuf));
+    w->records = calloc(n, sizeof(uint64_t));
+    if (!n || !w->pending || !w->records) { free(w->pending); free(w->records); return false; }
+    pthread_mutex_init(&w->mu, NULL);
+    pthread_cond_init(&w->turn, NULL);
+    return true;
+}
+
+static inline bool json_shard_writev(JsonShardWriter* w, int fd, struct iovec* iov, int cnt)
+{
+    while (cnt) {
+        ssize_t r = writev(fd, iov, cnt);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            w->error = errno;
+            return false;
+        }
+        w->bytes += (uint64_t)r;
+        w->writes++;
+        while (cnt && (size_t)r >= iov->iov_len) { r -= (ssize_t)iov->iov_len; iov++; cnt--; }
+        if (cnt) { iov->iov_base = (char*)iov->iov_base + r; iov->iov_len -= (size_t)r; }
+    }
+    return true;
+}
+
+/* Pending plus extra bytes of shard i, in one writev() */
+static inline bool json_shard_flush(JsonShardWriter* w, uint32_t i, const StringBuf* extra)
+{
+    struct iovec iov[2];
+    int cnt = 0;
+    StringBuf* p = &w->pending[i];
+    if (p->size) iov[cnt++] = (struct iovec){ p->data, (size_t)p->size };
+    if (extra && extra->size) iov[cnt++] = (struct iovec){ extra->data, (size_t)extra->size };
+    if (p->data) p->size = 0;
+    return json_shard_writev(w, w->fds[i], iov, cnt);
+}
+
+/*
+ * Appends batch seq to the shards once every earlier batch is in, then
+ * empties b for reuse. Each seq must be committed exactly once, from 0 up;
+ * an empty batch still has to be committed to let the next one through.
+ */
+static inline bool json_shard_commit(JsonShardWriter* w, uint64_t seq, JsonShardBatch* b)
+{
+    pthread_mutex_lock(&w->mu);
+    while (w->next_seq != seq) pthread_cond_wait(&w->turn, &w->mu);
+
+    for (uint32_t i = 0; i < w->n && !w->error; ++i) {
+        StringBuf* sb = &b->out[i];
+        if (!sb->size) continue;
+        StringBuf* p = &w->pending[i];
+        if ((uint64_t)(p->size + sb->size) >= w->flush_bytes) {
+            json_shard_flush(w, i, sb);             /* the batch goes out from where it is */
+        } else if (!(p->data || stringbuf_init(p, 64 * 1024)) || !stringbuf_append(p, sb->data, sb->size)) {
+            w->error = ENOMEM;
+        }
+        w->records[i] += b->counts[i];
+    }
+    for (uint32_t i = 0; i < b->n; ++i) {
+        b->out[i].size = 0;
+        b->counts[i] = 0;
+    }
+
+    w->next_seq++;
+    bool ok = !w->error;
+    pthread_cond_broadcast(&w->turn);
+    pthread_mutex_unlock(&w->mu);
+    return ok;
+}
+
+/* Flushes every shard; all batches must be committed */
+static inline bool json_shard_close(JsonShardWriter* w)
+{
+    for (uint32_t i = 0; i < w->n && !w->error; ++i)
+        if (w->pending[i].size) json_shard_flush(w, i, NULL);
+    for (uint32_t i = 0; i < w->n; ++i) if (w->pending[i].data) stringbuf_free(&w->pending[i]);
+    free(w->pending);
+    free(w->records);
+    w->pending = NULL;
+    w->records = NULL;
+    pthread_cond_destroy(&w->turn);
+    pthread_mutex_destroy(&w->mu);
+    return !w->error;
+}
+
+#endif /* CEJSON_SHARD_H */
@@ -0,0 +1,570 @@
+/* cejson-sort.c – external sort of NDJSON by one extracted key. Each record is
+   parsed once; runs of (key, record) pairs are sorted in parallel, spilled to
+   temporary files and k-way merged. Records are emitted byte for byte. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cejson.h"
+#include "cejson-alloc.h"
+#include "cejson-ndjson.h"
+
+#define BLOCK_SIZE      (4 * 1024 * 1024)
+#define DEFAULT_MEMORY  (1024ULL * 1024 * 1024)
+#define IO_BUF          (1024 * 1024)
+
+typedef struct {
+    uint64_t       prefix;          /* first 8 key bytes, big-endian */
+    const uint8_t* key;
+    const char*    rec;             /* without the '\n' */
+    uint32_t       key_len, rec_len;
+    uint64_t       ord;             /* input position, for stability */
+} Entry;
+
+typedef struct Block {
+    struct Block* next;
+    char*         data;
+    uint64_t      len, cap;
+} Block;
+
+typedef struct {
+    const JsonProjection* proj;
+    bool                  reverse;
+} SortCtx;
+
+typedef struct {
+    const SortCtx*    ctx;
+    Entry*            entries;
+    uint64_t          n;
+    uint8_t*          keys;         /* arena for this slice */
+    JsonParserBuffers bufs;
+    uint64_t          failed;
+    pthread_t         tid;
+} Slice;
+
+typedef struct {
+    int      fd;
+    char*    buf;
+    uint64_t len;
+    bool     error;
+} Out;
+
+/* ------------------------------------------------------------------ */
+
+/* Keys are json_key_encode()d, so memcmp() gives the order; ties keep input order */
+static inline int cmp_entry(const Entry* a, const Entry* b, bool reverse)
+{
+    int c = 0;
+    if (a->prefix != b->prefix) c = a->prefix < b->prefix ? -1 : 1;
+    else {
+        uint32_t n = a->key_len < b->key_len ? a->key_len : b->key_len;
+        if (n > 8) c = memcmp(a->key + 8, b->key + 8, n - 8);
+        if (!c && a->key_len != b->key_len) c = a->key_len < b->key_len ? -1 : 1;
+    }
+    if (reverse) c = -c;
+    if (!c) c = a->ord < b->ord ? -1 : a->ord > b->ord;
+    return c;
+}
+
+static int cmp_fwd(const void* a, const void* b) { return cmp_entry(a, b, false); }
+static int cmp_rev(const void* a, const void* b) { return cmp_entry(a, b, true); }
+
+static inline uint64_t key_prefix(const uint8_t* k, uint32_t len)
+{
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < 8; ++i) v = (v << 8) | (i < len ? k[i] : 0);
+    return v;
+}
+
+static bool ensure_buffers(Slice* s, uint64_t line_len)
+{
+    /* worst case is one node per two input bytes ("[1,1,...") */
+    uint64_t need = line_len / 2 + 64;
+    if (s->bufs.nodes_cap >= need) return true;
+    json_free_parser_buffers(&s->bufs);
+    return json_alloc_parser_buffers(&s->bufs, need, need, JSON_ALLOC_DEFAULT);
+}
+
+/* Extracts the key of every record in the slice, then sorts the slice */
+static void* slice_main(void* arg)
+{
+    Slice* s = arg;
+    StringBuf scratch;
+    const JsonNode* cell;
+    uint8_t* k = s->keys;
+    stringbuf_init(&scratch, 4096);
+
+    JSON_TRACE_BEGIN("extract");
+    for (uint64_t i = 0; i < s->n; ++i) {
+        Entry* e = &s->entries[i];
+        JsonParser p;
+        cell = NULL;
+        if (ensure_buffers(s, e->rec_len)) {
+            json_init_buffers(&p, &s->bufs);
+            p.quiet = true;         /* unparseable records sort as a missing key */
+            if (json_feed(&p, e->rec, e->rec_len) && json_finish(&p)) {
+                p.buffer = e->rec;
+                json_projection_resolve(s->ctx->proj, &p, NULL, &cell);
+            } else {
+                s->failed++;
+            }
+        }
+        e->key = k;
+        e->key_len = cell ? json_key_encode(&p, cell, k, &scratch) : (*k = JSON_KEY_NULL, 1);
+        e->prefix = key_prefix(k, e->key_len);
+        k += e->key_len;
+    }
+    JSON_TRACE_END("extract");
+
+    JSON_TRACE_BEGIN("sort");
+    qsort(s->entries, s->n, sizeof(Entry), s->ctx->reverse ? cmp_rev : cmp_fwd);
+    JSON_TRACE_END("sort");
+    stringbuf_free(&scratch);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+
+static void out_flush(Out* o)
+{
+    const char* s = o->buf;
+    while (o->len && !o->error) {
+        ssize_t n = write(o->fd, s, (size_t)o->len);
+        if (n < 0) { o->error = true; break; }
+        s += n;
+        o->len -= (uint64_t)n;
+    }
+    o->len = 0;
+}
+
+static void out_put(Out* o, const void* data, uint64_t len)
+{
+    if (o->len + len > IO_BUF) out_flush(o);
+    if (len > IO_BUF) {
+        Out direct = { .fd = o->fd, .buf = (char*)data, .len = len };
+        out_flush(&direct);
+        o->error |= direct.error;
+        return;
+    }
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+}
+
+/* One record: to the final output as "rec\n", to a run file with its key in front */
+static void emit(Out* o, bool spill, const uint8_t* key, uint32_t key_len, const char* rec, uint32_t rec_len)
+{
+    if (spill) {
+        uint32_t hdr[2] = { key_len, rec_len };
+        out_put(o, hdr, sizeof(hdr));
+        out_put(o, key, key_len);
+        out_put(o, rec, rec_len);
+    } else {
+        out_put(o, rec, rec_len);
+        out_put(o, "\n", 1);
+    }
+}
+
+/* Min-heap of cursor indexes, ordered by the entry each cursor points at */
+typedef struct {
+    uint32_t* idx;
+    uint32_t  n;
+    int (*less)(void* ctx, uint32_t a, uint32_t b);
+    void*     ctx;
+} Heap;
+
+static void heap_down(Heap* h, uint32_t i)
+{
+    for (;;) {
+        uint32_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < h->n && h->less(h->ctx, h->idx[l], h->idx[m])) m = l;
+        if (r < h->n && h->less(h->ctx, h->idx[r], h->idx[m])) m = r;
+        if (m == i) return;
+        uint32_t t = h->idx[i]; h->idx[i] = h->idx[m]; h->idx[m] = t;
+        i = m;
+    }
+}
+
+static void heap_init(Heap* h)
+{
+    for (uint32_t i = h->n / 2; i-- > 0; ) heap_down(h, i);
+}
+
+/* Pops the top; the caller has already advanced it if it has more */
+static void heap_fix_top(Heap* h, bool exhausted)
+{
+    if (exhausted) h->idx[0] = h->idx[--h->n];
+    if (h->n) heap_down(h, 0);
+}
+
+/* --- merging the sorted slices of one run --- */
+
+typedef struct {
+    Slice*    slices;
+    uint64_t* pos;
+    bool      reverse;
+} SliceMerge;
+
+static int slice_less(void* ctx, uint32_t a, uint32_t b)
+{
+    SliceMerge* m = ctx;
+    return cmp_entry(&m->slices[a].entries[m->pos[a]], &m->slices[b].entries[m->pos[b]], m->reverse) < 0;
+}
+
+static void write_run(Out* o, bool spill, Slice* slices, uint32_t n_slices, bool reverse)
+{
+    uint64_t pos[n_slices ? n_slices : 1];
+    uint32_t idx[n_slices ? n_slices : 1];
+    SliceMerge m = { slices, pos, reverse };
+    Heap h = { idx, 0, slice_less, &m };
+
+    for (uint32_t i = 0; i < n_slices; ++i) {
+        pos[i] = 0;
+        if (slices[i].n) idx[h.n++] = i;
+    }
+    heap_init(&h);
+    while (h.n) {
+        uint32_t t = h.idx[0];
+        const Entry* e = &slices[t].entries[pos[t]];
+        emit(o, spill, e->key, e->key_len, e->rec, e->rec_len);
+        heap_fix_top(&h, ++pos[t] == slices[t].n);
+    }
+}
+
+/* --- merging spilled runs --- */
+
+typedef struct {
+    int      fd;
+    char*    buf;
+    uint64_t cap, pos, len;
+    Entry    cur;
+    bool     done;
+} RunReader;
+
+static bool run_fill(RunReader* r, uint64_t need)
+{
+    if (r->len - r->pos >= need) return true;
+    memmove(r->buf, r->buf + r->pos, (size_t)(r->len - r->pos));
+    r->len -= r->pos;
+    r->pos = 0;
+    if (need > r->cap) {
+        char* mem = realloc(r->buf, need);
+        if (!mem) return false;
+        r->buf = mem;
+        r->cap = need;
+    }
+    while (r->len < need) {
+        ssize_t n = read(r->fd, r->buf + r->len, (size_t)(r->cap - r->len));
+        if (n <= 0) return false;
+        r->len += (uint64_t)n;
+    }
+    return true;
+}
+
+/* Loads the next record into r->cur; false at the end of the run */
+static bool run_next(RunReader* r, uint64_t ord)
+{
+    uint32_t hdr[2];
+    if (!run_fill(r, sizeof(hdr))) return false;
+    memcpy(hdr, r->buf + r->pos, sizeof(hdr));
+    if (!run_fill(r, sizeof(hdr) + (uint64_t)hdr[0] + hdr[1])) return false;
+    const char* s = r->buf + r->pos + sizeof(hdr);
+    r->cur = (Entry){ .key = (const uint8_t*)s, .key_len = hdr[0], .rec = s + hdr[0], .rec_len = hdr[1], .ord = ord };
+    r->cur.prefix = key_prefix(r->cur.key, r->cur.key_len);
+    r->pos += sizeof(hdr) + hdr[0] + hdr[1];
+    return true;
+}
+
+typedef struct {
+    RunReader* runs;
+    bool       reverse;
+} RunMerge;
+
+static int run_less(void* ctx, uint32_t a, uint32_t b)
+{
+    RunMerge* m = ctx;
+    return cmp_entry(&m->runs[a].cur, &m->runs[b].cur, m->reverse) < 0;
+}
+
+static bool merge_runs(Out* o, int* fds, uint32_t n_runs, bool reverse)
+{
+    RunReader* runs = calloc(n_runs, sizeof(RunReader));
+    uint32_t* idx = malloc(n_runs * sizeof(uint32_t));
+    bool ok = runs && idx;
+    RunMerge m = { runs, reverse };
+    Heap h = { idx, 0, run_less, &m };
+
+    for (uint32_t i = 0; ok && i < n_runs; ++i) {
+        runs[i].fd = fds[i];
+        runs[i].cap = IO_BUF;
+        runs[i].buf = malloc(IO_BUF);
+        if (!runs[i].buf || lseek(fds[i], 0, SEEK_SET) < 0) { ok = false; break; }
+        /* runs are in input order, so the run number breaks ties stably */
+        if (run_next(&runs[i], i)) idx[h.n++] = i;
+    }
+    if (ok) {
+        heap_init(&h);
+        while (h.n) {
+            uint32_t t = h.idx[0];
+            emit(o, false, NULL, 0, runs[t].cur.rec, runs[t].cur.rec_len);
+            heap_fix_top(&h, !run_next(&runs[t], t));
+        }
+    }
+    for (uint32_t i = 0; runs && i < n_runs; ++i) free(runs[i].buf);
+    free(runs);
+    free(idx);
+    return ok;
+}
+
+/* ------------------------------------------------------------------ */
+
+static uint64_t parse_size(const char* s)
+{
+    char* end;
+    double v = strtod(s, &end);
+    switch (*end) {
+    case 'k': case 'K': v *= 1024; break;
+    case 'm': case 'M': v *= 1024 * 1024; break;
+    case 'g': case 'G': v *= 1024 * 1024 * 1024; break;
+    default: break;
+    }
+    return v > 0 ? (uint64_t)v : 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s -k key [-r] [-S size] [-T tmpdir] [-t threads] [-v] [file.ndjson ...]\n", prog);
+    fprintf(stderr, " -k  key path (a.b, a[0], ['odd.key'])\n");
+    fprintf(stderr, " -r  descending order\n");
+    fprintf(stderr, " -S  memory for one run, e.g. 512M (default 1G)\n");
+    fprintf(stderr, " -T  directory for run files (default $TMPDIR or /tmp)\n");
+    fprintf(stderr, " -t  worker threads (default: online CPUs)\n");
+    fprintf(stderr, " -v  print record / run counts to stderr\n");
+    fprintf(stderr, "Order: missing/null < false < true < numbers < strings < objects/arrays; stable.\n");
+}
+
+typedef struct {
+    SortCtx  ctx;
+    uint32_t threads;
+    Slice*   slices;
+    Entry*   entries;
+    uint64_t n, cap;
+    uint64_t bytes;
+    Block*   blocks;                /* the current run's input */
+    Block*   free;
+    uint64_t ord, failed;
+} Sorter;
+
+static bool add_entries(Sorter* s, Block* b)
+{
+    const char* p = b->data;
+    const char* end = b->data + b->len;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        const char* e = nl ? nl : end;
+        const char* t = p;
+        while (t < e && (*t == ' ' || *t == '\t' || *t == '\r')) t++;
+        if (t < e) {
+            if (s->n == s->cap) {
+                uint64_t ncap = s->cap ? s->cap * 2 : 65536;
+                Entry* mem = realloc(s->entries, ncap * sizeof(Entry));
+                if (!mem) return false;
+                s->entries = mem;
+                s->cap = ncap;
+            }
+            s->entries[s->n++] = (Entry){ .rec = p, .rec_len = (uint32_t)(e - p), .ord = s->ord++ };
+        }
+        p = e + 1;
+    }
+    return true;
+}
+
+/* Sorts the buffered run and writes it to fd (spill) or the output */
+static bool finish_run(Sorter* s, Out* o, bool spill)
+{
+    uint32_t t = s->threads;
+    if ((uint64_t)t > s->n) t = s->n ? (uint32_t)s->n : 1;
+    uint64_t per = (s->n + t - 1) / t;
+    bool ok = true;
+
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < t; ++i) {
+        Slice* sl = &s->slices[i];
+        uint64_t lo = i * per < s->n ? i * per : s->n;
+        uint64_t hi = lo + per < s->n ? lo + per : s->n;
+        sl->ctx = &s->ctx;
+        sl->entries = s->entries + lo;
+        sl->n = hi - lo;
+        sl->failed = 0;
+        uint64_t need = 16;
+        for (uint64_t k = lo; k < hi; ++k) need += s->entries[k].rec_len + 16;
+        sl->keys = malloc(need);
+        if (!sl->keys) { ok = false; break; }
+        if (pthread_create(&sl->tid, NULL, slice_main, sl) != 0) { slice_main(sl); sl->tid = 0; }
+        started++;
+    }
+    for (uint32_t i = 0; i < started; ++i) {
+        if (s->slices[i].tid) pthread_join(s->slices[i].tid, NULL);
+        s->failed += s->slices[i].failed;
+    }
+
+    if (ok) {
+        JSON_TRACE_BEGIN(spill ? "spill" : "write");
+        write_run(o, spill, s->slices, t, s->ctx.reverse);
+        out_flush(o);
+        JSON_TRACE_END(spill ? "spill" : "write");
+        ok = !o->error;
+    }
+    for (uint32_t i = 0; i < started; ++i) { free(s->slices[i].keys); s->slices[i].keys = NULL; }
+
+    /* recycle the run's blocks */
+    while (s->blocks) {
+        Block* b = s->blocks;
+        s->blocks = b->next;
+        b->next = s->free;
+        s->free = b;
+    }
+    s->n = 0;
+    s->bytes = 0;
+    return ok;
+}
+
+static int make_run_file(const char* dir)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/cejson-sort-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);
+    return fd;
+}
+
+int main(int argc, char** argv)
+{
+    const char* key = NULL;
+    const char* tmpdir = getenv("TMPDIR");
+    uint64_t memory = DEFAULT_MEMORY;
+    bool reverse = false, verbose = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg_start = 1;
+
+    for (; arg_start < argc && argv[arg_start][0] == '-' && argv[arg_start][1]; arg_start++) {
+        if (!strcmp(argv[arg_start], "-k") && arg_start + 1 < argc) key = argv[++arg_start];
+        else if (!strcmp(argv[arg_start], "-r")) reverse = true;
+        else if (!strcmp(argv[arg_start], "-v")) verbose = true;
+        else if (!strcmp(argv[arg_start], "-S") && arg_start + 1 < argc) memory = parse_size(argv[++arg_start]);
+        else if (!strcmp(argv[arg_start], "-T") && arg_start + 1 < argc) tmpdir = argv[++arg_start];
+        else if (!strcmp(argv[arg_start], "-t") && arg_start + 1 < argc) threads = strtol(argv[++arg_start], NULL, 10);
+        else { usage(argv[0]); return 1; }
+    }
+    if (!key || !memory) { usage(argv[0]); return 1; }
+    if (threads < 1) threads = 1;
+    if (!tmpdir || !*tmpdir) tmpdir = "/tmp";
+
+    JsonProjection proj;
+    if (!json_projection_compile(&proj, &key, 1)) {
+        fprintf(stderr, "Bad key path '%s' at offset %zu\n", key, proj.error_pos);
+        return 1;
+    }
+
+    Sorter s = { .ctx = { &proj, reverse }, .threads = (uint32_t)threads };
+    s.slices = calloc((size_t)threads, sizeof(Slice));
+    char* obuf = malloc(IO_BUF);
+    if (!s.slices || !obuf) { perror("malloc"); return 1; }
+    Out out = { .fd = STDOUT_FILENO, .buf = obuf };
+
+    int* runs = NULL;
+    uint32_t n_runs = 0, runs_cap = 0;
+    bool ok = true;
+    int n_files = argc - arg_start;
+
+    for (int f = 0; ok && f < (n_files ? n_files : 1); ++f) {
+        const char* path = n_files ? argv[arg_start + f] : "-";
+        int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+        if (fd < 0) { perror(path); ok = false; break; }
+
+        JsonNdjsonReader r;
+        json_ndjson_reader_init(&r, fd);
+        for (;;) {
+            Block* b = s.free;
+            if (b) s.free = b->next;
+            else if ((b = calloc(1, sizeof(Block)))) { b->cap = BLOCK_SIZE; b->data = malloc(BLOCK_SIZE); }
+            if (!b || !b->data) { perror("malloc"); ok = false; free(b); break; }
+
+            JSON_TRACE_BEGIN("read");
+            int64_t n = json_ndjson_read(&r, &b->data, &b->cap);
+            JSON_TRACE_END("read");
+            if (n <= 0) {
+                if (n < 0) { perror(path); ok = false; }
+                b->next = s.free;
+                s.free = b;
+                break;
+            }
+            b->len = (uint64_t)n;
+            b->next = s.blocks;
+            s.blocks = b;
+            if (!add_entries(&s, b)) { perror("malloc"); ok = false; break; }
+            s.bytes += b->cap;
+
+            if (s.bytes >= memory) {
+                int rfd = make_run_file(tmpdir);
+                if (rfd < 0) { perror(tmpdir); ok = false; break; }
+                if (n_runs == runs_cap) {
+                    runs_cap = runs_cap ? runs_cap * 2 : 16;
+                    int* mem = realloc(runs, runs_cap * sizeof(int));
+                    if (!mem) { perror("realloc"); ok = false; close(rfd); break; }
+                    runs = mem;
+                }
+                runs[n_runs++] = rfd;
+                out.fd = rfd;
+                ok = finish_run(&s, &out, true);
+                if (!ok) perror("run file");
+                if (!ok) break;
+            }
+        }
+        json_ndjson_reader_free(&r);
+        if (fd != STDIN_FILENO) close(fd);
+    }
+
+    out.fd = STDOUT_FILENO;
+    if (ok && !n_runs) {
+        ok = finish_run(&s, &out, false);                 /* everything fit: no spill */
+    } else if (ok) {
+        if (s.n) {
+            int rfd = make_run_file(tmpdir);
+            int* mem = rfd >= 0 ? realloc(runs, (n_runs + 1) * sizeof(int)) : NULL;
+            if (!mem) { perror("run file"); ok = false; if (rfd >= 0) close(rfd); }
+            else {
+                runs = mem;
+                runs[n_runs++] = rfd;
+                out.fd = rfd;
+                ok = finish_run(&s, &out, true);
+                out.fd = STDOUT_FILENO;
+            }
+        }
+        if (ok) {
+            JSON_TRACE_BEGIN("merge");
+            ok = merge_runs(&out, runs, n_runs, reverse);
+            out_flush(&out);
+            ok = ok && !out.error;
+            JSON_TRACE_END("merge");
+        }
+        if (!ok) perror("merge");
+    }
+
+    if (verbose)
+        fprintf(stderr, "%llu records, %llu unparseable, %u runs\n",
+                (unsigned long long)s.ord, (unsigned long long)s.failed, n_runs);
+
+    for (uint32_t i = 0; i < n_runs; ++i) close(runs[i]);
+    free(runs);
+    for (uint32_t i = 0; i < (uint32_t)threads; ++i) json_free_parser_buffers(&s.slices[i].bufs);
+    free(s.slices);
+    while (s.blocks) { Block* b = s.blocks; s.blocks = b->next; free(b->data); free(b); }
+    while (s.free)   { Block* b = s.free;   s.free = b->next;   free(b->data); free(b); }
+    free(s.entries);
+    free(obuf);
+    json_projection_free(&proj);
+    return ok ? 0 : 2;
+}
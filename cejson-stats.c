@@ -0,0 +1,548 @@
+/* cejson-stats.c – document shape profiler: parses files or NDJSON in parallel
+   and prints a compact JSON report built and serialized with cejson itself */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include "cejson.h"
+#include "cejson-alloc.h"
+
+#define HIST_BINS       33          /* log2 buckets: 0, 1, 2-3, 4-7, ... */
+#define DEPTH_BINS      64
+#define NUMLEN_BINS     33
+#define KEY_TABLE_MAX   65536       /* distinct keys tracked per table */
+#define KEY_HLL_REGS    64          /* per-key value cardinality sketch */
+#define DOC_HLL_REGS    1024        /* distinct keys overall */
+#define TOP_KEYS        32
+#define NDJSON_UNIT     (1024 * 1024)
+
+typedef struct {
+    char*    name;
+    uint32_t len;
+    uint32_t hash;
+    uint64_t count;
+    uint8_t  hll[KEY_HLL_REGS];
+} KeyStat;
+
+typedef struct {
+    KeyStat* slots;
+    uint64_t cap, len;
+    uint64_t untracked;             /* key occurrences dropped once the table was full */
+} KeyTable;
+
+typedef struct {
+    uint64_t docs, failed, bytes, nodes;
+    uint64_t types[8];
+    uint64_t depth[DEPTH_BINS];
+    uint64_t max_depth;
+    uint64_t str_len[HIST_BINS];
+    uint64_t str_escaped, escapes;
+    uint64_t num_len[NUMLEN_BINS];
+    uint64_t arr_size[HIST_BINS];
+    uint64_t obj_size[HIST_BINS];
+    uint8_t  key_hll[DOC_HLL_REGS];
+    KeyTable keys;
+} Stats;
+
+/* One unit of work: a whole file, or a run of complete NDJSON lines */
+typedef struct {
+    const char* data;
+    uint64_t    len;
+    const char* path;               /* file mode: read by the worker */
+} Unit;
+
+typedef struct {
+    Unit*           units;
+    uint64_t        n_units;
+    atomic_uint_fast64_t next;
+    bool            ndjson;
+} Work;
+
+/* Open container while walking a tape: subtree end and the next key slot */
+typedef struct { uint32_t end, slot; bool obj; } Frame;
+
+typedef struct {
+    Work*             work;
+    Stats             st;
+    JsonParserBuffers bufs;
+    Frame*            frames;       /* sized like the tape, reused across documents */
+    pthread_t         tid;
+} Worker;
+
+/* ------------------------------------------------------------------ */
+
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+static inline uint32_t log2_bin(uint64_t v)
+{
+    return v ? 64 - (uint32_t)__builtin_clzll(v) : 0;
+}
+
+static inline void hll_add(uint8_t* regs, uint32_t bits, uint64_t h)
+{
+    uint32_t idx = (uint32_t)(h >> (64 - bits));
+    uint64_t rest = (h << bits) | (1ULL << (bits - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > regs[idx]) regs[idx] = rank;
+}
+
+static double hll_estimate(const uint8_t* regs, uint32_t m)
+{
+    double sum = 0.0, alpha = m >= 128 ? 0.7213 / (1.0 + 1.079 / m) : m == 64 ? 0.709 : 0.697;
+    uint32_t zeros = 0;
+    for (uint32_t i = 0; i < m; ++i) {
+        sum += 1.0 / (double)(1ULL << regs[i]);
+        zeros += regs[i] == 0;
+    }
+    double e = alpha * m * m / sum;
+    if (e <= 2.5 * m && zeros) e = m * log((double)m / zeros);
+    return e;
+}
+
+static KeyStat* key_slot(KeyTable* t, const char* name, uint32_t len, uint32_t hash)
+{
+    if (t->len * 2 >= t->cap) {
+        if (t->len >= KEY_TABLE_MAX) {
+            /* full: only existing keys are updated */
+            for (uint64_t i = hash & (t->cap - 1); t->slots[i].name; i = (i + 1) & (t->cap - 1))
+                if (t->slots[i].hash == hash && t->slots[i].len == len && !memcmp(t->slots[i].name, name, len))
+                    return &t->slots[i];
+            return NULL;
+        }
+        uint64_t cap = t->cap ? t->cap * 2 : 256;
+        KeyStat* slots = calloc(cap, sizeof(KeyStat));
+        if (!slots) return NULL;
+        for (uint64_t i = 0; i < t->cap; ++i) {
+            if (!t->slots[i].name) continue;
+            uint64_t j = t->slots[i].hash & (cap - 1);
+            while (slots[j].name) j = (j + 1) & (cap - 1);
+            slots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->cap = cap;
+    }
+
+    uint64_t i = hash & (t->cap - 1);
+    for (; t->slots[i].name; i = (i + 1) & (t->cap - 1))
+        if (t->slots[i].hash == hash && t->slots[i].len == len && !memcmp(t->slots[i].name, name, len))
+            return &t->slots[i];
+
+    KeyStat* k = &t->slots[i];
+    k->name = malloc(len + 1);
+    if (!k->name) return NULL;
+    memcpy(k->name, name, len);
+    k->name[len] = '\0';
+    k->len = len;
+    k->hash = hash;
+    t->len++;
+    return k;
+}
+
+static void key_table_free(KeyTable* t)
+{
+    for (uint64_t i = 0; i < t->cap; ++i) free(t->slots[i].name);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/* ------------------------------------------------------------------ */
+
+static uint64_t value_hash(JsonParser* p, const JsonNode* v)
+{
+    if (v->type == JSON_STRING || v->type == JSON_NUMBER_INT || v->type == JSON_NUMBER_FLOAT)
+        return mix64(((uint64_t)v->type << 32) ^ json_compute_hash_len(p->buffer + v->offset, v->len) ^ ((uint64_t)v->len << 40));
+    return mix64(v->type);
+}
+
+static void count_value(Stats* st, JsonParser* p, const JsonNode* n, uint64_t depth)
+{
+    st->types[n->type]++;
+    st->depth[depth < DEPTH_BINS ? depth : DEPTH_BINS - 1]++;
+    if (depth > st->max_depth) st->max_depth = depth;
+
+    switch (n->type) {
+        case JSON_STRING: {
+            st->str_len[log2_bin(n->len)]++;
+            const char* s = p->buffer + n->offset;
+            if (memchr(s, '\\', n->len)) {
+                st->str_escaped++;
+                for (uint32_t i = 0; i < n->len; ++i)
+                    if (s[i] == '\\') { st->escapes++; i++; }
+            }
+            break;
+        }
+        case JSON_NUMBER_INT:
+        case JSON_NUMBER_FLOAT:
+            st->num_len[n->len < NUMLEN_BINS ? n->len : NUMLEN_BINS - 1]++;
+            break;
+        case JSON_ARRAY:  st->arr_size[log2_bin(n->children)]++; break;
+        case JSON_OBJECT: st->obj_size[log2_bin(n->children)]++; break;
+    }
+}
+
+/* Linear walk of the preorder tape, tracking depth and which strings are keys */
+static void profile_doc(Stats* st, JsonParser* p, Frame* frames)
+{
+    JSON_TRACE_SCOPE("profile");
+    uint64_t depth = 0;
+    const JsonNode* nodes = p->nodes;
+
+    for (uint32_t i = 0; i < p->nodes_len; ++i) {
+        while (depth && frames[depth - 1].end <= i) depth--;
+
+        uint32_t v = i;
+        if (depth && frames[depth - 1].obj && frames[depth - 1].slot == i) {
+            const JsonNode* k = &nodes[i];
+            v = i + 1;
+            KeyStat* ks = key_slot(&st->keys, p->buffer + k->offset, k->len, k->hash);
+            if (ks) {
+                ks->count++;
+                hll_add(ks->hll, 6, value_hash(p, &nodes[v]));
+            } else {
+                st->keys.untracked++;
+            }
+            hll_add(st->key_hll, 10, mix64(((uint64_t)k->len << 32) | k->hash));
+        }
+
+        const JsonNode* n = &nodes[v];
+        bool container = (n->type == JSON_OBJECT || n->type == JSON_ARRAY);
+        count_value(st, p, n, depth);
+        if (depth) frames[depth - 1].slot = v + 1 + (container ? n->hash : 0);
+        if (container) frames[depth++] = (Frame){ .end = v + 1 + n->hash, .slot = v + 1, .obj = n->type == JSON_OBJECT };
+        i = v;
+    }
+
+    st->nodes += p->nodes_len;
+    st->docs++;
+}
+
+static bool ensure_buffers(Worker* w, uint64_t doc_len)
+{
+    /* worst case is one node per two input bytes ("[1,1,...") */
+    uint64_t need = doc_len / 2 + 64;
+    if (w->bufs.nodes_cap >= need) return true;
+    json_free_parser_buffers(&w->bufs);
+    json_free_large(w->frames, w->bufs.nodes_cap * sizeof(Frame));
+    w->frames = json_alloc_large(need * sizeof(Frame), JSON_ALLOC_DEFAULT);
+    if (!w->frames) return false;
+    if (json_alloc_parser_buffers(&w->bufs, need, need, JSON_ALLOC_DEFAULT)) return true;
+    json_free_large(w->frames, need * sizeof(Frame));
+    w->frames = NULL;
+    return false;
+}
+
+static void parse_one(Worker* w, const char* doc, uint64_t len)
+{
+    JsonParser p;
+    if (!ensure_buffers(w, len)) { w->st.failed++; return; }
+    json_init_buffers(&p, &w->bufs);
+    p.quiet = true;                 /* counted in st.failed */
+    if (!json_feed(&p, doc, len) || !json_finish(&p)) { w->st.failed++; return; }
+    p.buffer = doc;
+    profile_doc(&w->st, &p, w->frames);
+}
+
+static char* read_file(const char* path, uint64_t* len)
+{
+    JSON_TRACE_SCOPE("read");
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long n = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* buf = n >= 0 ? json_alloc_large((size_t)n + 1, JSON_ALLOC_DEFAULT) : NULL;
+    if (buf && fread(buf, 1, (size_t)n, fp) != (size_t)n) { json_free_large(buf, (size_t)n + 1); buf = NULL; }
+    fclose(fp);
+    if (buf) { buf[n] = '\0'; *len = (uint64_t)n; }
+    return buf;
+}
+
+static void* worker_main(void* arg)
+{
+    Worker* w = arg;
+    Work* work = w->work;
+
+    for (;;) {
+        uint64_t u = atomic_fetch_add(&work->next, 1);
+        if (u >= work->n_units) break;
+        Unit* unit = &work->units[u];
+
+        if (!work->ndjson) {
+            uint64_t len;
+            char* buf = read_file(unit->path, &len);
+            if (!buf) { fprintf(stderr, "Failed to read %s\n", unit->path); w->st.failed++; continue; }
+            w->st.bytes += len;
+            parse_one(w, buf, len);
+            json_free_large(buf, len + 1);
+            continue;
+        }
+
+        const char* s = unit->data;
+        const char* end = unit->data + unit->len;
+        w->st.bytes += unit->len;
+        while (s < end) {
+            const char* nl = memchr(s, '\n', (size_t)(end - s));
+            const char* e = nl ? nl : end;
+            const char* t = s;
+            while (t < e && (*t == ' ' || *t == '\t' || *t == '\r')) t++;
+            if (t < e) parse_one(w, s, (uint64_t)(e - s));
+            s = e + 1;
+        }
+    }
+    return NULL;
+}
+
+static void merge_stats(Stats* into, Stats* from)
+{
+    into->docs += from->docs; into->failed += from->failed;
+    into->bytes += from->bytes; into->nodes += from->nodes;
+    into->str_escaped += from->str_escaped; into->escapes += from->escapes;
+    if (from->max_depth > into->max_depth) into->max_depth = from->max_depth;
+    for (int i = 0; i < 8; ++i) into->types[i] += from->types[i];
+    for (int i = 0; i < DEPTH_BINS; ++i) into->depth[i] += from->depth[i];
+    for (int i = 0; i < HIST_BINS; ++i) {
+        into->str_len[i] += from->str_len[i];
+        into->arr_size[i] += from->arr_size[i];
+        into->obj_size[i] += from->obj_size[i];
+    }
+    for (int i = 0; i < NUMLEN_BINS; ++i) into->num_len[i] += from->num_len[i];
+    for (int i = 0; i < DOC_HLL_REGS; ++i)
+        if (from->key_hll[i] > into->key_hll[i]) into->key_hll[i] = from->key_hll[i];
+
+    into->keys.untracked += from->keys.untracked;
+    for (uint64_t i = 0; i < from->keys.cap; ++i) {
+        KeyStat* k = &from->keys.slots[i];
+        if (!k->name) continue;
+        KeyStat* d = key_slot(&into->keys, k->name, k->len, k->hash);
+        if (!d) { into->keys.untracked += k->count; continue; }
+        d->count += k->count;
+        for (int r = 0; r < KEY_HLL_REGS; ++r)
+            if (k->hll[r] > d->hll[r]) d->hll[r] = k->hll[r];
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Report                                                             */
+
+static void set_int(JsonParser* p, JsonNode* obj, const char* key, int64_t v)
+{
+    JsonNode* k = json_create_string(p, key);
+    json_object_set(p, obj, k, json_create_int(p, v));
+}
+
+static void set_float(JsonParser* p, JsonNode* obj, const char* key, double v)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.4f", v);
+    JsonNode* k = json_create_string(p, key);
+    json_object_set(p, obj, k, json_create_float(p, strtod(buf, NULL)));
+}
+
+static void set_hist(JsonParser* p, JsonNode* obj, const char* key, const uint64_t* h, int bins)
+{
+    int n = bins;
+    while (n > 0 && !h[n - 1]) n--;          /* trailing empty buckets are noise */
+    JsonNode* k = json_create_string(p, key);
+    JsonNode* arr = json_create_array(p);
+    for (int i = 0; i < n; ++i) json_array_append(p, arr, json_create_int(p, (int64_t)h[i]));
+    json_object_set(p, obj, k, arr);
+}
+
+static int cmp_key_count(const void* a, const void* b)
+{
+    const KeyStat* x = *(KeyStat* const*)a;
+    const KeyStat* y = *(KeyStat* const*)b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static void build_report(JsonParser* p, Stats* st, uint64_t files, double secs)
+{
+    JSON_TRACE_SCOPE("report");
+    static const char* const type_names[8] = { "null", "true", "false", "int", "float", "string", "array", "object" };
+    JsonNode* root = json_create_object(p);
+
+    set_int(p, root, "files", (int64_t)files);
+    set_int(p, root, "documents", (int64_t)st->docs);
+    set_int(p, root, "failed", (int64_t)st->failed);
+    set_int(p, root, "bytes", (int64_t)st->bytes);
+    set_int(p, root, "nodes", (int64_t)st->nodes);
+    set_float(p, root, "nodes_per_byte", st->bytes ? (double)st->nodes / st->bytes : 0.0);
+    set_float(p, root, "seconds", secs);
+
+    JsonNode* k = json_create_string(p, "types");
+    JsonNode* types = json_create_object(p);
+    for (int i = 0; i < 8; ++i) set_int(p, types, type_names[i], (int64_t)st->types[i]);
+    json_object_set(p, root, k, types);
+
+    k = json_create_string(p, "depth");
+    JsonNode* depth = json_create_object(p);
+    set_int(p, depth, "max", (int64_t)st->max_depth);
+    set_hist(p, depth, "nodes_at_depth", st->depth, DEPTH_BINS);
+    json_object_set(p, root, k, depth);
+
+    k = json_create_string(p, "strings");
+    JsonNode* strs = json_create_object(p);
+    set_hist(p, strs, "length_log2", st->str_len, HIST_BINS);
+    set_int(p, strs, "with_escapes", (int64_t)st->str_escaped);
+    set_int(p, strs, "escapes", (int64_t)st->escapes);
+    set_float(p, strs, "escaped_ratio", st->types[JSON_STRING] ? (double)st->str_escaped / st->types[JSON_STRING] : 0.0);
+    json_object_set(p, root, k, strs);
+
+    k = json_create_string(p, "numbers");
+    JsonNode* nums = json_create_object(p);
+    set_hist(p, nums, "length", st->num_len, NUMLEN_BINS);
+    json_object_set(p, root, k, nums);
+
+    k = json_create_string(p, "containers");
+    JsonNode* cont = json_create_object(p);
+    set_hist(p, cont, "array_size_log2", st->arr_size, HIST_BINS);
+    set_hist(p, cont, "object_size_log2", st->obj_size, HIST_BINS);
+    json_object_set(p, root, k, cont);
+
+    JsonNode* keys_k = json_create_string(p, "keys");
+    JsonNode* keys = json_create_object(p);
+    set_int(p, keys, "distinct_estimate", (int64_t)(hll_estimate(st->key_hll, DOC_HLL_REGS) + 0.5));
+    set_int(p, keys, "tracked", (int64_t)st->keys.len);
+    set_int(p, keys, "untracked_occurrences", (int64_t)st->keys.untracked);
+
+    KeyStat** order = malloc((st->keys.len + 1) * sizeof(KeyStat*));
+    uint64_t n = 0;
+    for (uint64_t i = 0; order && i < st->keys.cap; ++i)
+        if (st->keys.slots[i].name) order[n++] = &st->keys.slots[i];
+    if (order) qsort(order, n, sizeof(KeyStat*), cmp_key_count);
+
+    k = json_create_string(p, "top");
+    JsonNode* top = json_create_array(p);
+    for (uint64_t i = 0; i < n && i < TOP_KEYS; ++i) {
+        JsonNode* e = json_create_object(p);
+        JsonNode* kn = json_create_string(p, "key");
+        json_object_set(p, e, kn, json_create_stringn(p, order[i]->name, order[i]->len));
+        set_int(p, e, "count", (int64_t)order[i]->count);
+        set_int(p, e, "value_cardinality", (int64_t)(hll_estimate(order[i]->hll, KEY_HLL_REGS) + 0.5));
+        json_array_append(p, top, e);
+    }
+    free(order);
+    json_object_set(p, keys, k, top);
+    json_object_set(p, root, keys_k, keys);
+}
+
+/* ------------------------------------------------------------------ */
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-n] [-p] [-t threads] <file1.json> [file2.json ...]\n", prog);
+    fprintf(stderr, " -n  inputs are NDJSON (one document per line)\n");
+    fprintf(stderr, " -p  pretty-print the report\n");
+    fprintf(stderr, " -t  worker threads (default: online CPUs)\n");
+}
+
+int main(int argc, char** argv)
+{
+    bool ndjson = false, pretty = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg_start = 1;
+
+    for (; arg_start < argc && argv[arg_start][0] == '-'; arg_start++) {
+        if (!strcmp(argv[arg_start], "-n")) ndjson = true;
+        else if (!strcmp(argv[arg_start], "-p")) pretty = true;
+        else if (!strcmp(argv[arg_start], "-t") && arg_start + 1 < argc) threads = strtol(argv[++arg_start], NULL, 10);
+        else { usage(argv[0]); return 1; }
+    }
+    if (arg_start >= argc) { usage(argv[0]); return 1; }
+    if (threads < 1) threads = 1;
+
+    int n_files = argc - arg_start;
+    char** files = &argv[arg_start];
+    char** file_data = calloc(n_files, sizeof(char*));
+    uint64_t* file_len = calloc(n_files, sizeof(uint64_t));
+    Work work = { 0 };
+    uint64_t units_cap = n_files;
+    work.units = calloc(units_cap, sizeof(Unit));
+    work.ndjson = ndjson;
+    if (!file_data || !file_len || !work.units) { perror("calloc"); return 1; }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /* NDJSON files are read up front and cut at line boundaries into ~1 MB units */
+    for (int f = 0; f < n_files; ++f) {
+        if (!ndjson) { work.units[work.n_units++] = (Unit){ .path = files[f] }; continue; }
+        file_data[f] = read_file(files[f], &file_len[f]);
+        if (!file_data[f]) { fprintf(stderr, "Failed to read %s\n", files[f]); continue; }
+        const char* s = file_data[f];
+        const char* end = s + file_len[f];
+        while (s < end) {
+            const char* cut = s + NDJSON_UNIT < end ? s + NDJSON_UNIT : end;
+            const char* nl = cut < end ? memchr(cut, '\n', (size_t)(end - cut)) : NULL;
+            const char* e = nl ? nl + 1 : end;
+            if (work.n_units == units_cap) {
+                units_cap *= 2;
+                Unit* u = realloc(work.units, units_cap * sizeof(Unit));
+                if (!u) { perror("realloc"); return 1; }
+                work.units = u;
+            }
+            work.units[work.n_units++] = (Unit){ .data = s, .len = (uint64_t)(e - s) };
+            s = e;
+        }
+    }
+
+    Worker* workers = calloc((size_t)threads, sizeof(Worker));
+    if (!workers) { perror("calloc"); return 1; }
+    long started = 0;
+    for (; started < threads; ++started) {
+        workers[started].work = &work;
+        if (pthread_create(&workers[started].tid, NULL, worker_main, &workers[started]) != 0) break;
+    }
+    if (!started) worker_main(&workers[0]);     /* no threads available: do it inline */
+    threads = started ? started : 1;
+
+    Stats total = { 0 };
+    for (long t = 0; t < threads; ++t) {
+        if (started) pthread_join(workers[t].tid, NULL);
+        merge_stats(&total, &workers[t].st);
+        key_table_free(&workers[t].st.keys);
+        json_free_large(workers[t].frames, workers[t].bufs.nodes_cap * sizeof(Frame));
+        json_free_parser_buffers(&workers[t].bufs);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    /* report: ~30 nodes per top key plus a few hundred for the fixed part */
+    uint64_t cap = 1024 + TOP_KEYS * 32 + DEPTH_BINS + 4 * HIST_BINS;
+    JsonNode* rnodes = malloc(cap * sizeof(JsonNode));
+    JsonParser rp;
+    json_init(&rp, rnodes, cap, NULL, 0, NULL);
+    build_report(&rp, &total, (uint64_t)n_files, secs);
+
+    StringBuf sb;
+    stringbuf_init(&sb, 64 * 1024);
+    json_serialize(&rp, pretty, &sb);
+    printf("%s\n", stringbuf_cstr(&sb));
+    stringbuf_free(&sb);
+    json_free_tree(&rp, json_root(&rp));
+    free(rnodes);
+
+    fprintf(stderr, "%llu documents, %.2f MB in %.3f sec (%.2f MB/s, %ld threads)\n",
+            (unsigned long long)total.docs, total.bytes / (1024.0 * 1024.0), secs,
+            secs > 0 ? total.bytes / (1024.0 * 1024.0) / secs : 0.0, threads);
+
+    key_table_free(&total.keys);
+    for (int f = 0; f < n_files; ++f) if (file_data[f]) json_free_large(file_data[f], file_len[f] + 1);
+    free(file_data);
+    free(file_len);
+    free(work.units);
+    free(workers);
+    return total.failed ? 2 : 0;
+}
@@ -0,0 +1,284 @@
+/* cejson-template.h – precompiled JSON output templates with typed holes */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_TEMPLATE_H
+#define CEJSON_TEMPLATE_H
+
+#include "cejson.h"
+
+/*
+ * A template is JSON text with placeholders in value positions:
+ *
+ *     {"id": $1, "name": $2:str, "tags": $3:raw, "score": $4:float}
+ *
+ * $N is argument N (1-based, may repeat). An optional :int, :float, :str,
+ * :raw or :bool suffix types the hole; untyped holes take any value, and null
+ * fits every hole. A $ inside a string is just a character.
+ *
+ * json_template_compile() checks the template once (holes replaced by null
+ * must parse as one JSON value) and splits it into static byte runs and holes.
+ * json_template_render() then appends run, value, run, value... to a
+ * StringBuf: no tree, no keys, no per-node work. Integers are formatted two
+ * digits at a time, strings are escaped with an 8-byte scan for the bytes that
+ * need it, raw values are copied as they are (the caller vouches for them).
+ */
+
+typedef enum {
+    JSON_TPL_ANY = 0,
+    JSON_TPL_INT,
+    JSON_TPL_FLOAT,
+    JSON_TPL_STR,
+    JSON_TPL_RAW,
+    JSON_TPL_BOOL,
+    JSON_TPL_NULL
+} JsonTplType;
+
+typedef struct {
+    JsonTplType type;
+    union {
+        int64_t i;
+        double  d;
+        bool    b;
+        struct { const char* s; size_t len; } str;      /* STR (unescaped UTF-8) and RAW (JSON text) */
+    };
+} JsonTplValue;
+
+/* Static bytes text[off..off+len), then argument arg (0 for the trailing run) */
+typedef struct {
+    uint32_t off, len;
+    uint16_t arg;
+    uint8_t  type;
+} JsonTplOp;
+
+typedef struct {
+    char*      text;
+    uint32_t   text_len;
+    JsonTplOp* ops;
+    uint32_t   n_ops;
+    uint32_t   n_args;              /* highest $N used */
+    size_t     error_pos;           /* placeholder syntax errors; SIZE_MAX if the JSON itself is invalid */
+} JsonTemplate;
+
+static inline JsonTplValue json_tpl_int(int64_t v)      { return (JsonTplValue){ .type = JSON_TPL_INT, .i = v }; }
+static inline JsonTplValue json_tpl_float(double v)     { return (JsonTplValue){ .type = JSON_TPL_FLOAT, .d = v }; }
+static inline JsonTplValue json_tpl_bool(bool v)        { return (JsonTplValue){ .type = JSON_TPL_BOOL, .b = v }; }
+static inline JsonTplValue json_tpl_null(void)          { return (JsonTplValue){ .type = JSON_TPL_NULL }; }
+static inline JsonTplValue json_tpl_strn(const char* s, size_t len) { return (JsonTplValue){ .type = JSON_TPL_STR, .str = { s, len } }; }
+static inline JsonTplValue json_tpl_str(const char* s)  { return json_tpl_strn(s, strlen(s)); }
+static inline JsonTplValue json_tpl_raw(const char* s, size_t len)  { return (JsonTplValue){ .type = JSON_TPL_RAW, .str = { s, len } }; }
+
+static inline void json_template_free(JsonTemplate* t)
+{
+    free(t->text);
+    free(t->ops);
+    memset(t, 0, sizeof(*t));
+}
+
+static inline JsonTplType json_tpl_parse_type(const char* s, size_t len)
+{
+    static const char* const names[] = { "", "int", "float", "str", "raw", "bool" };
+    for (int i = 1; i < 6; ++i)
+        if (strlen(names[i]) == len && memcmp(names[i], s, len) == 0) return (JsonTplType)i;
+    return JSON_TPL_ANY;
+}
+
+static inline bool json_template_compile(JsonTemplate* t, const char* src, size_t len)
+{
+    memset(t, 0, sizeof(*t));
+    if (len > UINT32_MAX / 3) return false;
+    /* text holds the static runs; check holds the template with holes as " null ", 6 bytes for a hole of at least 2 */
+    char* check = malloc(len * 3 + 1);
+    t->text = malloc(len + 1);
+    t->ops = malloc((len / 2 + 1) * sizeof(JsonTplOp));
+    if (!check || !t->text || !t->ops) { free(check); json_template_free(t); return false; }
+
+    size_t check_len = 0, run = 0;
+    bool in_string = false, escape = false;
+    for (size_t i = 0; i < len; ) {
+        char c = src[i];
+        if (in_string || c != '$') {
+            if (in_string) {
+                if (escape) escape = false;
+                else if (c == '\\') escape = true;
+                else if (c == '"') in_string = false;
+            } else if (c == '"') {
+                in_string = true;
+            }
+            t->text[t->text_len++] = c;
+            check[check_len++] = c;
+            i++;
+            continue;
+        }
+
+        size_t at = i++;
+        uint32_t n = 0;
+        while (i < len && src[i] >= '0' && src[i] <= '9' && n <= UINT16_MAX) n = n * 10 + (uint32_t)(src[i++] - '0');
+        if (n == 0 || n > UINT16_MAX) { t->error_pos = at; goto fail; }
+        JsonTplType type = JSON_TPL_ANY;
+        if (i < len && src[i] == ':') {
+            size_t k = ++i;
+            while (i < len && src[i] >= 'a' && src[i] <= 'z') i++;
+            if ((type = json_tpl_parse_type(src + k, i - k)) == JSON_TPL_ANY) { t->error_pos = k; goto fail; }
+        }
+
+        t->ops[t->n_ops++] = (JsonTplOp){ .off = (uint32_t)run, .len = (uint32_t)(t->text_len - run), .arg = (uint16_t)n, .type = (uint8_t)type };
+        run = t->text_len;
+        if (n > t->n_args) t->n_args = n;
+        memcpy(check + check_len, " null ", 6);
+        check_len += 6;
+    }
+    t->ops[t->n_ops++] = (JsonTplOp){ .off = (uint32_t)run, .len = (uint32_t)(t->text_len - run) };
+
+    if (!json_validate(check, check_len)) { t->error_pos = SIZE_MAX; goto fail; }
+    free(check);
+    return true;
+
+fail:
+    free(check);
+    {
+        size_t pos = t->error_pos;
+        json_template_free(t);
+        t->error_pos = pos;
+    }
+    return false;
+}
+
+/* Room for n more bytes; returns where they go */
+static inline char* json_tpl_room(StringBuf* sb, size_t n)
+{
+    return stringbuf_reserve(sb, sb->size + (ssize_t)n) ? sb->data + sb->size : NULL;
+}
+
+static inline void json_tpl_commit(StringBuf* sb, char* end)
+{
+    sb->size = end - sb->data;
+    sb->data[sb->size] = '\0';
+}
+
+static inline char* json_tpl_u64(char* out, uint64_t v)
+{
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[20];
+    char* e = tmp + sizeof(tmp);
+    char* q = e;
+    while (v >= 100) {
+        q -= 2;
+        memcpy(q, pairs + 2 * (v % 100), 2);
+        v /= 100;
+    }
+    if (v >= 10) { q -= 2; memcpy(q, pairs + 2 * v, 2); }
+    else *--q = (char)('0' + v);
+    memcpy(out, q, (size_t)(e - q));
+    return out + (e - q);
+}
+
+static inline bool json_tpl_int64(StringBuf* sb, int64_t v)
+{
+    char* o = json_tpl_room(sb, 20);
+    if (!o) return false;
+    if (v < 0) *o++ = '-';
+    json_tpl_commit(sb, json_tpl_u64(o, v < 0 ? 0 - (uint64_t)v : (uint64_t)v));
+    return true;
+}
+
+/* Shortest of %.15g / %.17g that round-trips, like json_create_float(); integral values take the integer path */
+static inline bool json_tpl_double(StringBuf* sb, double d)
+{
+    if (d != d || d - d != 0) return stringbuf_append(sb, "null", 4);
+    if (d > -1e15 && d < 1e15 && d == (double)(int64_t)d) return json_tpl_int64(sb, (int64_t)d);
+    char* o = json_tpl_room(sb, 32);
+    if (!o) return false;
+    int n = snprintf(o, 32, "%.15g", d);
+    if (strtod(o, NULL) != d) n = snprintf(o, 32, "%.17g", d);
+    json_tpl_commit(sb, o + n);
+    return true;
+}
+
+/* Appends s as a quoted JSON string. Plain runs are found 8 bytes at a time and copied whole. */
+static inline bool json_tpl_escape(StringBuf* sb, const char* s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    if (!stringbuf_append_char(sb, '"')) return false;
+    size_t i = 0;
+    while (i < len) {
+        /* worst case every byte becomes \u00XX; reserve per slice to keep that bounded */
+        size_t end = len - i > 4096 ? i + 4096 : len;
+        char* o = json_tpl_room(sb, (end - i) * 6);
+        if (!o) return false;
+        while (i < end) {
+            size_t j = i;
+            for (; j + 8 <= end; j += 8) {
+                uint64_t v;
+                memcpy(&v, s + j, 8);
+                if (json_swar_eq(v, '"') | json_swar_eq(v, '\\') | json_swar_ctrl(v)) break;
+            }
+            while (j < end && s[j] != '"' && s[j] != '\\' && (uint8_t)s[j] >= 0x20) j++;
+            memcpy(o, s + i, j - i);
+            o += j - i;
+            if ((i = j) == end) break;
+
+            uint8_t c = (uint8_t)s[i++];
+            *o++ = '\\';
+            switch (c) {
+            case '"':  *o++ = '"';  break;
+            case '\\': *o++ = '\\'; break;
+            case '\n': *o++ = 'n';  break;
+            case '\r': *o++ = 'r';  break;
+            case '\t': *o++ = 't';  break;
+            case '\b': *o++ = 'b';  break;
+            case '\f': *o++ = 'f';  break;
+            default:
+                memcpy(o, "u00", 3);
+                o[3] = hex[c >> 4];
+                o[4] = hex[c & 15];
+                o += 5;
+                break;
+            }
+        }
+        json_tpl_commit(sb, o);
+    }
+    return stringbuf_append_char(sb, '"');
+}
+
+static inline bool json_tpl_value(StringBuf* sb, JsonTplType hole, const JsonTplValue* v)
+{
+    if (v->type == JSON_TPL_NULL) return stringbuf_append(sb, "null", 4);
+    if (hole != JSON_TPL_ANY && hole != v->type && !(hole == JSON_TPL_FLOAT && v->type == JSON_TPL_INT)) return false;
+    switch (v->type) {
+    case JSON_TPL_INT:   return json_tpl_int64(sb, v->i);
+    case JSON_TPL_FLOAT: return json_tpl_double(sb, v->d);
+    case JSON_TPL_STR:   return json_tpl_escape(sb, v->str.s, v->str.len);
+    case JSON_TPL_RAW:   return v->str.len && stringbuf_append(sb, v->str.s, (ssize_t)v->str.len);
+    case JSON_TPL_BOOL:  return v->b ? stringbuf_append(sb, "true", 4) : stringbuf_append(sb, "false", 5);
+    default:             return false;
+    }
+}
+
+/*
+ * Appends the template filled with args[0..n_args) to out. On a missing
+ * argument or a value that doesn't fit its hole, out is left as it was and
+ * false is returned.
+ */
+static inline bool json_template_render(const JsonTemplate* t, const JsonTplValue* args, uint32_t n_args, StringBuf* out)
+{
+    if (!t->ops || n_args < t->n_args) return false;
+    ssize_t mark = out->size;
+    if (!stringbuf_reserve(out, out->size + t->text_len + 24 * (t->n_ops - 1))) return false;
+
+    for (uint32_t i = 0; i < t->n_ops; ++i) {
+        const JsonTplOp* op = &t->ops[i];
+        if (op->len && !stringbuf_append(out, t->text + op->off, op->len)) goto fail;
+        if (op->arg && !json_tpl_value(out, (JsonTplType)op->type, &args[op->arg - 1])) goto fail;
+    }
+    return true;
+
+fail:
+    out->size = mark;
+    out->data[mark] = '\0';
+    return false;
+}
+
+#endif /* CEJSON_TEMPLATE_H */
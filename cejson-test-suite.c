@@ -10,7 +10,24 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 #include "cejson.h"
+#include "cejson-path.h"
+#include "cejson-alloc.h"
+#define JSON_NDJSON_CHUNK 256       /* small chunks: exercise multi-part batches and backpressure */
+#include "cejson-ndjson.h"
+#include "cejson-export.h"
+#include "cejson-join.h"
+#include "cejson-utf.h"
+#include "cejson-capture.h"
+#include "cejson-template.h"
+#include "cejson-redact.h"
+#include "cejson-pipeline.h"
+#include "cejson-udp.h"
+#include "cejson-http.h"
+#include "cejson-shard.h"
+#include <netinet/in.h>
+#include <sys/wait.h>
 
 #define NODE_CAP  65536
 #define STACK_CAP 4096
@@ -19,6 +36,10 @@ static JsonNode nodes[NODE_CAP];
 static uint32_t stack[STACK_CAP];
 static uint8_t expecting_key[STACK_CAP];
 
+#ifndef CEJSON_BIN_DIR
+#define CEJSON_BIN_DIR "../bin"     /* the suite runs from tests/ */
+#endif
+
 static int tests_run = 0;
 static int tests_failed = 0;
 
@@ -245,6 +266,1216 @@ static void create_tree_test()
 }
 
 
+static void test_jsonpath()
+{
+    const char* json =
+        "{\"store\":{\"items\":[{\"sku\":\"a1\",\"price\":5},{\"sku\":\"b2\",\"price\":12.5},"
+        "{\"sku\":\"c3\",\"price\":30,\"tag\":\"sku\"}],"
+        "\"sub\":{\"items\":[{\"sku\":\"d4\",\"price\":11}]}},\"name\":\"sku\"}";
+    JsonParser p;
+    JsonPath jp;
+    JsonNodeVec out = {0};
+    char tmp[64];
+
+    ASSERT(parse_full(json, &p), "jsonpath document");
+
+    ASSERT(json_path_compile(&jp, "$..items[?(@.price > 10)].sku"), "compile filter query");
+    ASSERT(json_path_eval(&jp, &p, NULL, &out) == 3, "three items over 10");
+    ASSERT(strcmp(json_str(&p, &p.nodes[out.idx[0]], tmp, sizeof(tmp)), "b2") == 0, "first match b2");
+    ASSERT(strcmp(json_str(&p, &p.nodes[out.idx[2]], tmp, sizeof(tmp)), "d4") == 0, "last match d4");
+    json_path_free(&jp);
+
+    ASSERT(json_path_compile(&jp, "$..sku"), "compile descendant");
+    ASSERT(json_path_eval(&jp, &p, NULL, &out) == 4, "string values named sku are not keys");
+    json_path_free(&jp);
+
+    ASSERT(json_path_compile(&jp, "$.store.items[-1]['tag']"), "compile index + bracket name");
+    ASSERT(json_path_eval(&jp, &p, NULL, &out) == 1, "negative index");
+    json_path_free(&jp);
+
+    ASSERT(json_path_compile(&jp, "$.store.items[0:2].*"), "compile slice + wildcard");
+    ASSERT(json_path_eval(&jp, &p, NULL, &out) == 4, "slice wildcard values");
+    json_path_free(&jp);
+
+    ASSERT(json_path_compile(&jp, "$..[?(@.sku == 'c3')]"), "compile descendant filter");
+    ASSERT(json_path_eval(&jp, &p, NULL, &out) == 1, "string equality filter");
+    json_path_free(&jp);
+
+    ASSERT(!json_path_compile(&jp, "$.store[?(@.price >)]"), "bad filter rejected");
+
+    json_nodevec_free(&out);
+}
+
+static void test_path_index()
+{
+    const char* json = "{\"a\":{\"b\":{\"c\":42}},\"flags\":[{\"on\":true},{\"on\":false}],\"x.y\":1}";
+    JsonParser p;
+    JsonPathIndex ix;
+    uint64_t h;
+
+    ASSERT(parse_full(json, &p), "path index document");
+    ASSERT(json_path_index_build(&ix, &p), "build path index");
+    ASSERT(ix.len == p.nodes_len - 7, "one entry per value, keys excluded");
+
+    JsonNode* n = json_path_index_get(&ix, &p, "a.b.c");
+    int64_t v = 0;
+    ASSERT(n && n->type == JSON_NUMBER_INT && json_as_i64(&p, n, &v) && v == 42, "a.b.c == 42");
+    ASSERT(json_path_index_get(&ix, &p, "$") == &p.nodes[0], "root path");
+    ASSERT(json_path_index_get(&ix, &p, "flags[1].on")->type == JSON_FALSE, "array element path");
+    ASSERT(json_path_index_get(&ix, &p, "$['x.y']") != NULL, "quoted key with a dot");
+    ASSERT(json_path_index_get(&ix, &p, "a.b.d") == NULL, "missing path");
+    ASSERT(json_path_index_get(&ix, &p, "flags[2].on") == NULL, "index out of range");
+
+    ASSERT(json_path_index_hash("a.b.c", &h) && json_path_index_find(&ix, &p, h) == n, "precomputed hash");
+    ASSERT(!json_path_index_hash("a..b", &h), "malformed path");
+    json_path_index_free(&ix);
+
+    /* "a2" and "cp" share a tape key hash */
+    ASSERT(parse_full("{\"a2\":1,\"cp\":{\"x\":2}}", &p), "colliding keys document");
+    ASSERT(json_path_index_build(&ix, &p), "build path index with colliding keys");
+    n = json_path_index_get(&ix, &p, "a2");
+    ASSERT(n && json_as_i64(&p, n, &v) && v == 1, "a2 == 1");
+    n = json_path_index_get(&ix, &p, "cp.x");
+    ASSERT(n && json_as_i64(&p, n, &v) && v == 2, "cp.x == 2");
+    ASSERT(json_path_index_get(&ix, &p, "a2.x") == NULL, "no a2.x");
+
+    json_path_index_free(&ix);
+}
+
+static void test_key_bloom()
+{
+    const char* json = "{\"id\":1,\"name\":\"x\",\"inner\":{\"deep\":true},\"empty\":{}}";
+    JsonParser p;
+
+    ASSERT(parse_full(json, &p), "bloom document");
+    ASSERT(p.nodes[0].bloom != 0, "object carries a key signature");
+    ASSERT((p.nodes[0].bloom & json_key_bloom(json_compute_hash("inner"))) == json_key_bloom(json_compute_hash("inner")), "present key bits set");
+
+    JsonNode* inner = json_get_object_value(&p, json_root(&p), "inner");
+    ASSERT(inner && inner->type == JSON_OBJECT && inner->bloom == json_key_bloom(json_compute_hash("deep")), "nested object signature");
+    ASSERT(json_get_object_value(&p, inner, "deep")->type == JSON_TRUE, "lookup through signature");
+    ASSERT(json_get_object_value(&p, json_root(&p), "missing") == NULL, "absent key");
+
+    JsonNode* empty = json_get_object_value(&p, json_root(&p), "empty");
+    ASSERT(empty && empty->bloom == 0 && json_get_object_value(&p, empty, "id") == NULL, "empty object");
+}
+
+static void test_relayout()
+{
+    const char* json = "{\"big\":{\"x\":[1,[2,3],{\"y\":4}],\"z\":{}},\"list\":[true,null,\"s\"],\"k\":{\"deep\":{\"k\":5}}}";
+    JsonParser p;
+    StringBuf before, after;
+    JsonPath jp;
+    JsonNodeVec out = {0};
+    JsonPathIndex ix;
+
+    ASSERT(parse_full(json, &p), "relayout document");
+    p.buf_len = strlen(json);
+    uint64_t n = p.nodes_len;
+    stringbuf_init(&before, 4096);
+    stringbuf_init(&after, 4096);
+    json_serialize(&p, false, &before);
+
+    ASSERT(json_relayout(&p, JSON_LAYOUT_BFS), "relayout to BFS");
+    ASSERT(p.layout == JSON_LAYOUT_BFS && p.nodes_len == n && p.nodes != nodes, "new owned tape");
+    ASSERT(p.nodes[1].type == JSON_STRING && p.nodes[3].type == JSON_STRING && p.nodes[5].type == JSON_STRING, "root keys packed");
+    json_serialize(&p, false, &after);
+    ASSERT(strcmp(stringbuf_cstr(&before), stringbuf_cstr(&after)) == 0, "BFS tape serializes identically");
+
+    JsonNode* x = json_get_object_value(&p, json_get_object_value(&p, json_root(&p), "big"), "x");
+    ASSERT(x && x->type == JSON_ARRAY && json_get_array_element(&p, x, 2)->type == JSON_OBJECT, "accessors on BFS tape");
+    ASSERT(json_get_object_value(&p, json_get_array_element(&p, x, 2), "y")->type == JSON_NUMBER_INT, "nested lookup on BFS tape");
+
+    ASSERT(json_path_compile(&jp, "$..k"), "compile descendant");
+    ASSERT(json_path_eval(&jp, &p, NULL, &out) == 2, "descendant search on BFS tape");
+    json_path_free(&jp);
+
+    ASSERT(json_path_index_build(&ix, &p), "path index on BFS tape");
+    ASSERT(json_path_index_get(&ix, &p, "big.x[1][0]")->type == JSON_NUMBER_INT, "path index lookup on BFS tape");
+    json_path_index_free(&ix);
+
+    ASSERT(json_relayout(&p, JSON_LAYOUT_PREORDER), "relayout back to preorder");
+    ASSERT(p.nodes_len == n && memcmp(p.nodes, nodes, n * sizeof(JsonNode)) == 0, "round trip restores the parser tape");
+
+    json_release(&p);
+    json_nodevec_free(&out);
+    stringbuf_free(&before);
+    stringbuf_free(&after);
+}
+
+static void test_extract()
+{
+    const char* json = "{\"junk\":[1,2,3,4,5,6,7,8],\"keep\":{\"id\":77,\"ratio\":0.25,\"tags\":[\"a\",\"b\"],\"ok\":true}}";
+    char* src = strdup(json);
+    JsonParser p, doc;
+    StringBuf sb;
+    int64_t id = 0;
+    double ratio = 0;
+
+    ASSERT(parse_full(src, &p), "extract source document");
+    JsonNode* keep = json_get_object_value(&p, json_root(&p), "keep");
+    ASSERT(json_extract(&p, keep, &doc), "extract subtree");
+    ASSERT(doc.nodes_len == (uint64_t)keep->hash + 1, "only the subtree nodes are copied");
+    ASSERT(doc.buf_len < strlen(json) / 2, "only referenced bytes are copied");
+
+    memset(src, 'x', strlen(json));   /* the big source can go away now */
+    free(src);
+    memset(nodes, 0, sizeof(JsonNode) * p.nodes_len);
+
+    ASSERT(json_as_i64(&doc, json_get_object_value(&doc, json_root(&doc), "id"), &id) && id == 77, "number survives");
+    ASSERT(json_as_f64(&doc, json_get_object_value(&doc, json_root(&doc), "ratio"), &ratio) && ratio == 0.25, "float survives");
+    stringbuf_init(&sb, 1024);
+    json_serialize(&doc, false, &sb);
+    ASSERT(strcmp(stringbuf_cstr(&sb), "{\"id\":77,\"ratio\":0.25,\"tags\":[\"a\",\"b\"],\"ok\":true}") == 0, "extracted document serializes");
+    stringbuf_free(&sb);
+    json_release(&doc);
+    ASSERT(doc.nodes == NULL && doc.buffer == NULL, "release clears the document");
+}
+
+static void test_freeze()
+{
+    const char* json = "[{\"brand\":\"acme\",\"status\":\"active\",\"qty\":3},"
+                       "{\"brand\":\"acme\",\"status\":\"active\",\"qty\":3},"
+                       "{\"brand\":\"zeta\",\"status\":\"active\",\"qty\":12}]";
+    char* src = strdup(json);
+    JsonParser p;
+    JsonStrDict dict = {0};
+    JsonFreezeStats st;
+    StringBuf sb;
+    int64_t qty = 0;
+    char tmp[32];
+
+    ASSERT(parse_full(src, &p), "freeze document");
+    ASSERT(json_freeze(&p, &dict, &st), "freeze");
+    ASSERT(st.strings == 18 && st.new_strings == 8, "duplicates share one entry");
+    ASSERT(st.source_bytes == strlen(json) && st.ratio > 2.0, "compression reported");
+    ASSERT(p.buffer == NULL && p.frozen, "source released");
+    memset(src, 'x', strlen(json));
+    free(src);
+
+    JsonNode* a = json_get_object_value(&p, json_get_array_element(&p, json_root(&p), 0), "brand");
+    JsonNode* b = json_get_object_value(&p, json_get_array_element(&p, json_root(&p), 1), "brand");
+    ASSERT(a && b && a->strval == b->strval, "equal strings point at the same entry");
+    ASSERT(strcmp(json_str(&p, a, tmp, sizeof(tmp)), "acme") == 0, "string readable after freeze");
+    ASSERT(json_as_i64(&p, json_get_object_value(&p, json_get_array_element(&p, json_root(&p), 2), "qty"), &qty) && qty == 12, "number readable after freeze");
+
+    stringbuf_init(&sb, 1024);
+    json_serialize(&p, false, &sb);
+    ASSERT(strcmp(stringbuf_cstr(&sb), json) == 0, "frozen document serializes");
+    stringbuf_free(&sb);
+
+    ASSERT(parse_full(json, &p) && json_freeze(&p, &dict, &st), "second document shares the dictionary");
+    ASSERT(st.new_strings == 0 && st.added_bytes == 0, "nothing new to store");
+    json_strdict_free(&dict);
+}
+
+static void test_large_alloc()
+{
+    JsonParser p;
+    JsonParserBuffers bufs;
+    const char* json = "{\"a\":[1,2,{\"b\":null}]}";
+
+    char* big = json_alloc_large(3 * JSON_HUGE_PAGE + 123, JSON_ALLOC_DEFAULT);
+    ASSERT(big != NULL, "large allocation");
+    memset(big, 0xab, 3 * JSON_HUGE_PAGE + 123);
+    json_free_large(big, 3 * JSON_HUGE_PAGE + 123);
+
+    ASSERT(json_alloc_parser_buffers(&bufs, 1 << 18, 1024, JSON_ALLOC_DEFAULT), "parser buffers");
+    json_init_buffers(&p, &bufs);
+    ASSERT(json_feed(&p, json, strlen(json)) && json_finish(&p) && p.nodes_len == 8, "parse into large buffers");
+    json_free_parser_buffers(&bufs);
+}
+
+typedef struct {
+    JsonNdjsonWriter* w;
+    _Atomic uint64_t* next;
+    uint64_t batches;
+} NdjsonProducer;
+
+/* batch b holds b % 7 records {"b":b,"i":i}, alternately serialized and raw */
+static void* ndjson_producer(void* arg)
+{
+    NdjsonProducer* pr = arg;
+    JsonNode tnodes[16];
+    uint32_t tstack[8];
+    uint8_t tkey[8];
+    JsonNdjsonLocal l;
+    char line[64];
+
+    json_ndjson_local_init(&l, pr->w);
+    for (uint64_t b; (b = atomic_fetch_add(pr->next, 1)) < pr->batches; ) {
+        json_ndjson_begin(&l, b);
+        for (uint64_t i = 0; i < b % 7; ++i) {
+            int n = snprintf(line, sizeof(line), "{\"b\":%" PRIu64 ",\"i\":%" PRIu64 "}", b, i);
+            if (i & 1) { json_ndjson_write_raw(&l, line, (uint64_t)n); continue; }
+            JsonParser tp;
+            json_init(&tp, tnodes, 16, tstack, 8, tkey);
+            json_feed(&tp, line, (uint64_t)n);
+            json_finish(&tp);
+            json_ndjson_write(&l, &tp, NULL);
+        }
+        json_ndjson_end(&l);
+    }
+    json_ndjson_local_free(&l);
+    return NULL;
+}
+
+static void ndjson_check(unsigned flags)
+{
+    JsonParser p;
+    const uint64_t batches = 300;
+    FILE* f = tmpfile();
+    JsonNdjsonWriter w;
+    _Atomic uint64_t next = 0;
+    NdjsonProducer pr = { &w, &next, batches };
+    pthread_t t[4];
+
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+    json_ndjson_open(&w, fileno(f), flags);
+    for (int i = 0; i < 4; ++i) pthread_create(&t[i], NULL, ndjson_producer, &pr);
+    for (int i = 0; i < 4; ++i) pthread_join(t[i], NULL);
+    bool closed = json_ndjson_close(&w);
+
+    uint64_t expect = 0;
+    for (uint64_t b = 0; b < batches; ++b) expect += b % 7;
+
+    rewind(f);
+    char line[64];
+    uint64_t lines = 0, sum = 0, last = 0;
+    bool sorted = true;
+    while (fgets(line, sizeof(line), f)) {
+        uint64_t b, i;
+        if (sscanf(line, "{\"b\":%" SCNu64 ",\"i\":%" SCNu64 "}", &b, &i) != 2) break;
+        uint64_t key = b * 8 + i;
+        if (lines && key <= last) sorted = false;
+        last = key;
+        sum += b;
+        lines++;
+    }
+    fclose(f);
+
+    uint64_t bsum = 0;
+    for (uint64_t b = 0; b < batches; ++b) bsum += b * (b % 7);
+    ASSERT(closed && w.records == expect && lines == expect && sum == bsum, "ndjson writer emits every record once");
+    if (flags & JSON_NDJSON_ORDERED) ASSERT(sorted, "ordered ndjson writer keeps batch order");
+}
+
+static void test_ndjson_writer()
+{
+    ndjson_check(JSON_NDJSON_ORDERED);
+    ndjson_check(0);
+}
+
+static void test_export_rows()
+{
+    JsonParser p;
+    JsonProjection pj;
+    StringBuf sb, scratch;
+    const JsonNode* cells[5];
+    const char* cols[] = { "id", "user.name", "tags[1]", "$.user", "id" };
+    const char* json = "{\"tags\":[\"a\",\"b\\tc\"],\"id\":7,\"skip\":{\"id\":1},"
+                       "\"user\":{\"name\":\"q\\\"x,\\u00e9\"}}";
+
+    ASSERT(json_projection_compile(&pj, cols, 5), "compile projection");
+    json_projection_free(&pj);
+    ASSERT(!json_projection_compile(&pj, (const char*[]){ "a..b" }, 1) && pj.bad_column == 0, "reject descendant step");
+    json_projection_compile(&pj, cols, 5);
+    ASSERT(parse_full(json, &p), "parse export record");
+    p.buf_len = strlen(json);
+
+    stringbuf_init(&sb, 256);
+    stringbuf_init(&scratch, 256);
+    ASSERT(json_export_row(&sb, &pj, &p, NULL, JSON_EXPORT_CSV, cells, &scratch) &&
+           strcmp(stringbuf_cstr(&sb), "7,\"q\"\"x,\xc3\xa9\",\"b\tc\",\"{\"\"name\"\":\"\"q\\\"\"x,\\u00e9\"\"}\",7\n") == 0,
+           "csv row quotes, unescapes and repeats columns");
+    stringbuf_clear(&sb);
+    ASSERT(json_export_row(&sb, &pj, &p, NULL, JSON_EXPORT_TSV, cells, &scratch) &&
+           strcmp(stringbuf_cstr(&sb), "7\tq\"x,\xc3\xa9\tb\\tc\t{\"name\":\"q\\\\\"x,\\\\u00e9\"}\t7\n") == 0,
+           "tsv row escapes tabs and backslashes");
+    stringbuf_clear(&sb);
+    ASSERT(json_export_header(&sb, cols, 2, JSON_EXPORT_CSV) && strcmp(stringbuf_cstr(&sb), "id,user.name\n") == 0, "csv header");
+
+    stringbuf_free(&scratch);
+    stringbuf_free(&sb);
+    json_projection_free(&pj);
+}
+
+static void test_join_splice()
+{
+    JsonParser p;
+    JsonProjection key;
+    JsonJoinTable t;
+    StringBuf sb, scratch;
+    uint8_t k[64];
+    const char* build[] = { "{\"id\":2,\"n\":\"b\",\"o\":{\"x\":[1]}}", "{\"id\":1,\"n\":\"a\"}",
+                            "{\"id\":2.0,\"n\":\"c\"}", "[1]" };
+    const char* probe = "{ \"uid\": 2 }";
+
+    json_projection_compile(&key, (const char*[]){ "id" }, 1);
+    json_join_init(&t, &key, NULL, 0);
+    for (int i = 0; i < 4; ++i) json_join_add(&t, build[i], strlen(build[i]));
+    ASSERT(json_join_seal(&t) && t.n == 3 && t.failed == 1, "join table indexes objects only");
+
+    ASSERT(parse_full(probe, &p), "parse probe record");
+    p.buf_len = strlen(probe);
+    stringbuf_init(&sb, 256);
+    stringbuf_init(&scratch, 64);
+    uint32_t len = json_key_encode(&p, json_get_object_value(&p, &p.nodes[0], "uid"), k, &scratch);
+    uint64_t h = json_join_hash(k, len);
+    uint32_t r = json_join_find(&t, k, len, h);
+    ASSERT(r == 0 && json_join_splice(&sb, &p, &t, r), "find first match in build order");
+    r = json_join_next(&t, r, k, len, h);
+    ASSERT(r == 2 && json_join_splice(&sb, &p, &t, r), "2 and 2.0 share a key");
+    ASSERT(json_join_next(&t, r, k, len, h) == JSON_JOIN_NONE, "no third match");
+    ASSERT(strcmp(stringbuf_cstr(&sb), "{ \"uid\": 2 ,\"n\":\"b\",\"o\":{\"x\":[1]}}\n{ \"uid\": 2 ,\"n\":\"c\"}\n") == 0,
+           "splice copies members verbatim");
+
+    stringbuf_free(&scratch);
+    stringbuf_free(&sb);
+    json_join_free(&t);
+    json_projection_free(&key);
+}
+
+/* UTF-8 text re-encoded as UTF-16/32; returns the byte length */
+static size_t utf_encode(const char* s, JsonEncoding enc, bool bom, uint8_t* out)
+{
+    size_t n = 0;
+    bool be = enc == JSON_ENC_UTF16BE || enc == JSON_ENC_UTF32BE;
+    int w = enc == JSON_ENC_UTF32LE || enc == JSON_ENC_UTF32BE ? 4 : 2;
+    for (uint32_t cp = bom ? 0xFEFF : 0; ; ) {
+        if (cp) {
+            uint32_t units[2] = { cp, 0 };
+            int k = 1;
+            if (w == 2 && cp >= 0x10000) { units[0] = 0xD800 + ((cp - 0x10000) >> 10); units[1] = 0xDC00 + (cp & 0x3FF); k = 2; }
+            for (int u = 0; u < k; ++u)
+                for (int b = 0; b < w; ++b) out[n++] = (uint8_t)(units[u] >> (8 * (be ? w - 1 - b : b)));
+        }
+        unsigned char c = (unsigned char)*s;
+        if (!c) break;
+        int len = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+        cp = len == 1 ? c : c & (0x7F >> len);
+        for (int i = 1; i < len; ++i) cp = cp << 6 | (s[i] & 0x3F);
+        s += len;
+    }
+    return n;
+}
+
+static void test_utf_transcode()
+{
+    JsonParser p;
+    JsonTranscoder* t = malloc(sizeof(*t));
+    StringBuf keep;
+    static uint8_t raw[1024];
+    const char* json = "{\"k\":\"\xc3\xa9\xf0\x9f\x98\x80\",\"pad\":\"                                                \",\"a\":[1,true]}";
+    const JsonEncoding encs[] = { JSON_ENC_UTF16LE, JSON_ENC_UTF16BE, JSON_ENC_UTF32LE, JSON_ENC_UTF32BE, JSON_ENC_UTF8 };
+
+    stringbuf_init(&keep, 256);
+    for (int e = 0; e < 5; ++e) {
+        for (int bom = 0; bom < 2; ++bom) {
+            size_t n = encs[e] == JSON_ENC_UTF8 ? strlen(json) : utf_encode(json, encs[e], bom, raw);
+            if (encs[e] == JSON_ENC_UTF8) memcpy(raw, json, n);
+            for (size_t step = 1; step <= n; step = step * 3 + 2) {
+                json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+                json_utf_init(t, JSON_ENC_DETECT, &keep);
+                stringbuf_clear(&keep);
+                bool ok = true;
+                for (size_t off = 0; ok && off < n; off += step)
+                    ok = json_utf_feed(t, &p, raw + off, off + step > n ? n - off : step);
+                ok = ok && json_utf_finish(t, &p);
+                if (!ok || t->enc != encs[e] || t->replaced || strcmp(stringbuf_cstr(&keep), json) != 0) {
+                    ASSERT(false, "transcoded document matches the UTF-8 text");
+                    goto done;
+                }
+            }
+        }
+    }
+    ASSERT(true, "UTF-16/32 LE/BE with and without BOM, any chunking");
+    ASSERT(p.nodes[0].type == JSON_OBJECT && json_get_object_value(&p, &p.nodes[0], "a")->type == JSON_ARRAY,
+           "parse over transcoded text");
+
+    /* a lone high surrogate, and one dangling at the end of input */
+    const uint8_t bad[] = { 0xFF, 0xFE, '"', 0, 0x00, 0xD8, 'x', 0, '"', 0, 0x3D, 0xD8 };
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+    json_utf_init(t, JSON_ENC_DETECT, &keep);
+    stringbuf_clear(&keep);
+    json_utf_feed(t, &p, bad, sizeof(bad));
+    ASSERT(!json_utf_finish(t, &p) && t->replaced == 2 &&
+           strcmp(stringbuf_cstr(&keep), "\"\xef\xbf\xbdx\"\xef\xbf\xbd") == 0, "unpaired surrogates become U+FFFD");
+done:
+    stringbuf_free(&keep);
+    free(t);
+}
+
+static void test_feed_auto()
+{
+    JsonParser p, q;
+    StringBuf sb;
+    JsonNode* ref = malloc(8192 * sizeof(JsonNode));
+    stringbuf_init(&sb, 64 * 1024);
+
+    /* indented, with long strings: both fast paths, and the same tape as the plain loop */
+    stringbuf_append(&sb, "[\n", 2);
+    for (int i = 0; i < 400; ++i) {
+        char item[160];
+        int n = snprintf(item, sizeof(item), "%s        {\n            \"text\": \"a fairly long string value number %d with\\tone escape\"\n        }",
+                         i ? ",\n" : "", i);
+        stringbuf_append(&sb, item, n);
+    }
+    stringbuf_append(&sb, "\n]", 2);
+    const char* doc = stringbuf_cstr(&sb);
+    uint64_t len = (uint64_t)sb.size;
+
+    json_init(&q, ref, 8192, stack, STACK_CAP, expecting_key);
+    json_feed(&q, doc, len);
+    json_finish(&q);
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+    bool ok = true;
+    for (uint64_t off = 0; ok && off < len; off += 1000)
+        ok = json_feed_auto(&p, doc + off, off + 1000 > len ? len - off : 1000);
+    ok = ok && json_finish(&p);
+    p.buffer = doc;
+    p.buf_len = len;
+    ASSERT(ok && p.sample.samples == 1 && p.scan == (JSON_SCAN_STRINGS | JSON_SCAN_WS), "indented long strings pick both fast paths");
+    ASSERT(p.nodes_len == q.nodes_len && memcmp(p.nodes, ref, p.nodes_len * sizeof(JsonNode)) == 0 && p.line == q.line,
+           "fast paths leave the tape unchanged");
+
+    /* compact numbers stay on the plain loop */
+    stringbuf_clear(&sb);
+    stringbuf_append_char(&sb, '[');
+    for (int i = 0; i < 4000; ++i) {
+        char num[32];
+        int n = snprintf(num, sizeof(num), "%s%d.%d", i ? "," : "", i, i % 7);
+        stringbuf_append(&sb, num, n);
+    }
+    stringbuf_append_char(&sb, ']');
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+    p.scan = JSON_SCAN_STRINGS;
+    ASSERT(json_feed_auto(&p, stringbuf_cstr(&sb), (uint64_t)sb.size) && json_finish(&p) && p.scan == 0,
+           "numeric input goes back to the plain loop");
+
+    stringbuf_free(&sb);
+    free(ref);
+}
+
+static void test_feed_capture()
+{
+    JsonParser p;
+    JsonCapture c;
+    JsonFeedTrace t;
+    char base[64];
+    const char* chunks[] = { "{\"a\":", "", "[1,2,", "3]}" };
+    snprintf(base, sizeof(base), "/tmp/cejson-test-capture-%d", (int)getpid());
+
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+    ASSERT(json_capture_open(&c, base), "open capture");
+    for (int i = 0; i < 4; ++i) json_capture_feed(&c, &p, chunks[i], strlen(chunks[i]));
+    ASSERT(json_capture_close(&c) && json_finish(&p) && c.chunks == 4, "capture while parsing");
+
+    ASSERT(json_feedtrace_load(&t, base) && t.chunks == 4 && t.len == 13 && strcmp(t.data, "{\"a\":[1,2,3]}") == 0,
+           "load capture");
+    ASSERT(t.chunk_len[0] == 5 && t.chunk_len[1] == 0 && t.chunk_len[3] == 3 && t.arrival_ns[0] == 0 &&
+           t.arrival_ns[3] >= t.arrival_ns[2], "chunk lengths and arrival times");
+    json_feedtrace_free(&t);
+
+    char path[80];
+    snprintf(path, sizeof(path), "%s.data", base);
+    FILE* f = fopen(path, "ab");
+    fputc('x', f);
+    fclose(f);
+    ASSERT(!json_feedtrace_load(&t, base), "reject data that doesn't match the feeds");
+    remove(path);
+    snprintf(path, sizeof(path), "%s.feeds", base);
+    remove(path);
+}
+
+static void test_builder_raw()
+{
+    JsonParser p;
+    StringBuf sb;
+    static const char blob[] = "{\"sku\":\"A-1\",\"price\":9.5,\"tags\":[\"x\"]}";
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+
+    JsonNode* root = json_create_object(&p);
+    JsonNode* k = json_create_string(&p, "product");
+    json_object_set(&p, root, k, json_create_raw(&p, blob, strlen(blob)));
+    k = json_create_string(&p, "more");
+    JsonNode* list = json_create_array(&p);
+    json_array_append(&p, list, json_create_raw_ex(&p, "[1, 2]", 6, JSON_RAW_COPY | JSON_RAW_VALIDATE));
+    json_array_append(&p, list, json_create_int(&p, 3));
+    json_object_set(&p, root, k, list);
+
+    stringbuf_init(&sb, 256);
+    json_serialize(&p, false, &sb);
+    ASSERT(strcmp(stringbuf_cstr(&sb), "{\"product\":{\"sku\":\"A-1\",\"price\":9.5,\"tags\":[\"x\"]},\"more\":[[1, 2],3]}") == 0,
+           "raw fragments are spliced verbatim");
+    ASSERT(json_get_object_value(&p, root, "more")->type == JSON_ARRAY, "siblings after a raw node");
+
+    uint64_t used = p.nodes_len;
+    ASSERT(!json_create_raw_ex(&p, "{\"a\":", 5, JSON_RAW_VALIDATE) && !json_create_raw_ex(&p, "1 2", 3, JSON_RAW_VALIDATE) &&
+           p.nodes_len == used, "validation rejects partial and multiple values");
+
+    stringbuf_free(&sb);
+    json_free_tree(&p, root);
+}
+
+static void test_template_render()
+{
+    JsonParser p;
+    JsonTemplate t;
+    StringBuf sb;
+    static const char src[] = "{\"id\": $1:int, \"name\": $2:str, \"tags\": $3:raw, \"price\": \"$4\", \"score\": $4:float, \"again\": $1}";
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+
+    ASSERT(json_template_compile(&t, src, strlen(src)) && t.n_args == 4, "template compiles");
+    JsonTplValue args[4] = { json_tpl_int(INT64_MIN), json_tpl_str("a \"q\"\\\n\x01 long enough for the wide scan"),
+                             json_tpl_raw("[1,2]", 5), json_tpl_int(7) };
+    stringbuf_init(&sb, 16);
+    ASSERT(json_template_render(&t, args, 4, &sb), "template renders");
+    ASSERT(strcmp(stringbuf_cstr(&sb), "{\"id\": -9223372036854775808, \"name\": \"a \\\"q\\\"\\\\\\n\\u0001 long enough for the wide scan\", "
+                  "\"tags\": [1,2], \"price\": \"$4\", \"score\": 7, \"again\": -9223372036854775808}") == 0,
+           "holes filled, strings escaped, $ inside a string kept");
+    ASSERT(parse_full(stringbuf_cstr(&sb), &p), "rendered output parses");
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+
+    ssize_t size = sb.size;
+    args[3] = json_tpl_float(0.1);
+    args[1] = json_tpl_null();
+    ASSERT(json_template_render(&t, args, 4, &sb) && strstr(sb.data + size, "\"name\": null") &&
+           strstr(sb.data + size, "\"score\": 0.1"), "null fits any hole, floats round-trip");
+    size = sb.size;
+    args[0] = json_tpl_str("7");
+    ASSERT(!json_template_render(&t, args, 4, &sb) && sb.size == size && sb.data[size] == '\0', "type mismatch leaves the buffer alone");
+    ASSERT(!json_template_render(&t, args, 3, &sb), "missing arguments rejected");
+    json_template_free(&t);
+
+    ASSERT(!json_template_compile(&t, "{\"a\": $1:num}", 13) && t.error_pos == 9, "unknown hole type");
+    ASSERT(!json_template_compile(&t, "[$0]", 4) && t.error_pos == 1, "holes are 1-based");
+    ASSERT(!json_template_compile(&t, "{\"a\": $1", 8) && t.error_pos == SIZE_MAX, "template must be valid JSON");
+    ASSERT(!json_template_compile(&t, "[$1$2]", 6) && t.error_pos == SIZE_MAX, "adjacent holes rejected");
+
+    /* nothing but holes: the null-filled check text is 3x the template */
+    JsonTplValue big[1] = { json_tpl_float(1e300) };
+    ASSERT(json_template_compile(&t, "$1", 2) && t.n_ops == 2, "lone hole compiles");
+    stringbuf_clear(&sb);
+    ASSERT(json_template_render(&t, big, 1, &sb) && strtod(sb.data, NULL) == 1e300, "huge float takes the %g path");
+    json_template_free(&t);
+    stringbuf_free(&sb);
+}
+
+static void test_redact_stream()
+{
+    JsonParser p;
+    static JsonRedactor r;
+    StringBuf whole, bytes;
+    static const char in[] =
+        "{\"ssn\":\"1\", \"a\":{\"email\":\"e@x\",\"list\":[{\"ssn\":{\"deep\":[1]}},2]}, \"user\":{\"mail\":\"m\",\"ssn\":3}, \"mail\":true}\n"
+        "[{\"ssn\":1}, \"ssn\", -1.5e3]\n";
+    static const char want[] =
+        "{\"a\":{\"email\":\"***\",\"list\":[{},2]}, \"user\":{\"email\":\"m\"}, \"mail\":true}\n"
+        "[{}, \"ssn\", -1.5e3]\n";
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+
+    json_redact_init(&r);
+    ASSERT(json_redact_add(&r, "ssn", JSON_REDACT_DROP, NULL) && json_redact_add(&r, "email", JSON_REDACT_REPLACE, "\"***\"") &&
+           json_redact_add(&r, "$.user.mail", JSON_REDACT_RENAME, "email"), "rules added");
+    ASSERT(!json_redact_add(&r, "email", JSON_REDACT_REPLACE, "{") && !json_redact_add(&r, "a.b", JSON_REDACT_DROP, NULL),
+           "bad replacement and unanchored paths refused");
+
+    stringbuf_init(&whole, 256);
+    stringbuf_init(&bytes, 256);
+    ASSERT(json_redact_feed(&r, in, strlen(in), &whole) && json_redact_finish(&r) && strcmp(whole.data, want) == 0,
+           "drop, replace and anchored rename in one pass");
+    ASSERT(r.dropped == 4 && r.replaced == 1 && r.renamed == 1, "counters");
+
+    json_redact_reset(&r);
+    bool ok = true;
+    for (size_t i = 0; in[i]; ++i) ok = ok && json_redact_feed(&r, in + i, 1, &bytes);
+    ASSERT(ok && json_redact_finish(&r) && strcmp(bytes.data, want) == 0, "byte-at-a-time feed gives the same output");
+
+    json_redact_reset(&r);
+    ASSERT(!json_redact_feed(&r, "{\"a\":1,}", 8, &bytes) && r.error == JSON_ERR_UNEXPECTED && r.error_pos == 7, "trailing comma");
+    json_redact_reset(&r);
+    ASSERT(json_redact_feed(&r, "{\"a\":[1", 7, &bytes) && !json_redact_finish(&r) && r.error == JSON_ERR_INCOMPLETE, "unclosed document");
+
+    stringbuf_free(&whole);
+    stringbuf_free(&bytes);
+    json_redact_free(&r);
+}
+
+static void test_nest_compact()
+{
+    JsonParser p, q;
+    static JsonNest nest;
+    static JsonNode qnodes[NODE_CAP];
+    static const char doc[] = "{\"a\":{\"b\":[[1,{\"c\":[]}],{\"d\":{}},[[[]]]],\"e\":{\"f\":[{\"g\":1},{\"h\":[2,[3]]}]}},\"i\":[{}]}";
+
+    ASSERT(parse_full(doc, &p), "standard nesting");
+    json_init_nest(&q, qnodes, NODE_CAP, &nest);
+    ASSERT(json_feed(&q, doc, strlen(doc)) && json_finish(&q) && q.nodes_len == p.nodes_len &&
+           memcmp(qnodes, nodes, p.nodes_len * sizeof(JsonNode)) == 0, "compact nesting builds the same tape");
+    ASSERT(nest.parents_len == 0, "every stored parent index popped again");
+
+    /* 10^6 levels: 4 bits each, nothing sized ahead */
+    const uint64_t depth = 1000000;
+    char* deep = malloc(depth * 6 + 8);
+    JsonNode* big = malloc((depth * 2 + 1) * sizeof(JsonNode));
+    ASSERT(deep && big, "allocate the deep document and its tape");
+    if (!deep || !big) { free(deep); free(big); json_nest_free(&nest); return; }
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < depth; ++i) {
+        if (i % 2) { memcpy(deep + n, "{\"k\":", 5); n += 5; }
+        else deep[n++] = '[';
+    }
+    deep[n++] = '1';
+    for (uint64_t i = depth; i-- > 0; ) deep[n++] = i % 2 ? '}' : ']';
+    json_init_nest(&q, big, depth * 2 + 1, &nest);
+    bool ok = true;
+    for (uint64_t pos = 0; ok && pos < n; pos += 4096) ok = json_feed(&q, deep + pos, n - pos < 4096 ? n - pos : 4096);
+    ASSERT(ok && json_finish(&q) && big[0].hash == depth * 3 / 2 && big[0].len == n, "10^6 levels deep");
+    ASSERT(nest.levels_cap * 4 / 8 <= depth && nest.parents_cap <= 256, "nesting memory stays compact");
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+    ASSERT(!json_feed(&p, deep, n) && p.error == JSON_ERR_CAPACITY, "fixed stack still reports its limit");
+    free(big);
+    free(deep);
+    json_nest_free(&nest);
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+}
+
+static void test_tape_file()
+{
+    JsonParser p, q;
+    static JsonNest nest;
+    JsonTape t;
+    char doc[8192];
+    size_t n = 0;
+    doc[n++] = '[';
+    for (int i = 0; i < 600 && n < sizeof(doc) - 16; ++i) n += (size_t)snprintf(doc + n, sizeof(doc) - n, "%s{\"k\":%d}", i ? "," : "", i);
+    doc[n++] = ']';
+    doc[n] = '\0';
+    ASSERT(n < sizeof(doc) - 16, "600 elements fit the document buffer");
+
+    ASSERT(parse_full(doc, &p), "reference parse");
+    ASSERT(json_tape_open(&t, NULL, 4096) && t.extent == 512, "tape file opened, extent rounded to whole pages");
+    json_init_nest(&q, NULL, 0, &nest);
+    json_tape_attach(&q, &t);
+    bool ok = true;
+    for (size_t pos = 0; ok && pos < n; pos += 100) ok = json_feed(&q, doc + pos, n - pos < 100 ? n - pos : 100);
+    ASSERT(ok && json_finish(&q) && t.grows >= 2 && q.nodes == t.nodes, "tape grows past its first extent");
+    json_tape_parsed(&t);
+    q.buffer = doc;
+    q.buf_len = n;
+    ASSERT(q.nodes_len == p.nodes_len && memcmp(q.nodes, p.nodes, p.nodes_len * sizeof(JsonNode)) == 0,
+           "same tape as an in-memory parse");
+    int64_t v = 0;
+    ASSERT(json_as_i64(&q, json_get_object_value(&q, json_get_array_element(&q, json_root(&q), 599), "k"), &v) && v == 599,
+           "accessors read through the mapping");
+    json_tape_close(&t);
+    json_nest_free(&nest);
+}
+
+struct pipe_writer { int fd; const char* s; size_t len; };
+
+static void* pipe_writer_run(void* arg)
+{
+    struct pipe_writer* w = arg;
+    for (size_t off = 0; off < w->len; ) {
+        size_t n = w->len - off < 10000 ? w->len - off : 10000;      /* odd sizes: short reads on the other end */
+        ssize_t k = write(w->fd, w->s + off, n);
+        if (k <= 0) break;
+        off += (size_t)k;
+    }
+    close(w->fd);
+    return NULL;
+}
+
+static void test_pipe_parse()
+{
+    JsonParser p, q;
+    size_t cap = 700 * 1024, n = 0;
+    char* doc = malloc(cap + 1);
+    char* text = malloc(cap + 1);
+    ASSERT(doc && text, "allocate the pipeline document");
+    if (!doc || !text) { free(doc); free(text); return; }
+    doc[n++] = '[';
+    for (int i = 0; n < cap - 200; ++i)
+        n += (size_t)sprintf(doc + n, "%s\n  {\"id\": %d,\t\"s\": \"a \\\"quoted\\\" \\\\ run %d\"}", i ? "," : "", i, i);
+    n += (size_t)sprintf(doc + n, "\n]\n");
+
+    /* the index alone, one chunk */
+    uint64_t words = (n + 63) / 64;
+    uint64_t* m = malloc(words * 3 * sizeof(uint64_t));
+    ASSERT(m, "allocate the index bitmaps");
+    if (!m) { free(doc); free(text); return; }
+    json_pipe_index(doc, n, m, m + words, m + 2 * words);
+    JsonChunkIndex ix = { m, m + words, m + 2 * words };
+    static JsonNode a[100000], b[100000];
+    static uint32_t sa[64], sb[64];
+    static uint8_t ka[64], kb[64];
+    json_init(&q, a, 100000, sa, 64, ka);
+    ASSERT(json_feed_indexed(&q, doc, n, &ix) && json_finish(&q), "indexed feed");
+    json_init(&p, b, 100000, sb, 64, kb);
+    ASSERT(json_feed(&p, doc, n) && json_finish(&p), "reference feed");
+    ASSERT(q.nodes_len == p.nodes_len && memcmp(a, b, p.nodes_len * sizeof(JsonNode)) == 0 && q.line == p.line,
+           "same tape and line count as json_feed");
+    free(m);
+
+    /* both stages, reading a pipe fed in odd-sized writes */
+    int fds[2];
+    pthread_t wt;
+    ASSERT(pipe(fds) == 0, "pipe");
+    struct pipe_writer w = { fds[1], doc, n };
+    pthread_create(&wt, NULL, pipe_writer_run, &w);
+    JsonPipeline pl;
+    json_init(&q, a, 100000, sa, 64, ka);
+    ASSERT(json_pipe_start(&pl, fds[0], text, cap), "pipeline started");
+    bool ok = json_pipe_parse(&pl, &q);
+    pthread_join(wt, NULL);
+    close(fds[0]);
+    ASSERT(ok && pl.text_len == n && q.buf_len == n && memcmp(text, doc, n) == 0, "pipeline read the whole stream");
+    ASSERT(q.nodes_len == p.nodes_len && memcmp(a, b, p.nodes_len * sizeof(JsonNode)) == 0, "pipeline tape matches");
+    int64_t v = 0;
+    JsonNode* last = json_get_array_element(&q, json_root(&q), json_root(&q)->children - 1);
+    ASSERT(json_as_i64(&q, json_get_object_value(&q, last, "id"), &v) && v == (int64_t)json_root(&q)->children - 1,
+           "accessors read the pipeline's text");
+
+    /* a stream bigger than the text buffer */
+    ASSERT(pipe(fds) == 0, "pipe");
+    w = (struct pipe_writer){ fds[1], doc, n };
+    pthread_create(&wt, NULL, pipe_writer_run, &w);
+    json_init(&q, a, 100000, sa, 64, ka);
+    ASSERT(json_pipe_start(&pl, fds[0], text, n / 2) && !json_pipe_parse(&pl, &q) && pl.error == ENOBUFS,
+           "overflow reported as ENOBUFS");
+    while (read(fds[0], text, cap) > 0) {}     /* let the writer finish */
+    close(fds[0]);
+    pthread_join(wt, NULL);
+
+    free(doc);
+    free(text);
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+}
+
+typedef struct { uint32_t n; int64_t sum; uint32_t children; bool from_loopback; } UdpSeen;
+
+static void udp_seen(JsonParser* p, const JsonUdpDoc* docs, uint32_t n, void* ctx)
+{
+    UdpSeen* s = ctx;
+    for (uint32_t i = 0; i < n; ++i) {
+        int64_t v = 0;
+        if (docs[i].root->type != JSON_OBJECT) continue;
+        if (json_as_i64(p, json_get_object_value(p, docs[i].root, "v"), &v)) s->sum += v;
+        JsonNode* list = json_get_object_value(p, docs[i].root, "list");
+        if (list) s->children += list->children;
+        const struct sockaddr_in* a = (const struct sockaddr_in*)docs[i].from;
+        s->from_loopback = a->sin_family == AF_INET && a->sin_addr.s_addr == htonl(INADDR_LOOPBACK);
+    }
+    s->n += n;
+}
+
+static void test_udp_batch()
+{
+    JsonParser p;
+    int rx = socket(AF_INET, SOCK_DGRAM, 0), tx = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t alen = sizeof(addr);
+    ASSERT(rx >= 0 && tx >= 0 && bind(rx, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+           getsockname(rx, (struct sockaddr*)&addr, &alen) == 0, "loopback socket");
+
+    static JsonUdpIngest u;
+    bool ready = json_udp_init(&u, rx, 8, 500);
+    ASSERT(ready && u.slot == 512, "slab of 8 slots, rounded to 64 bytes");
+    if (!ready) { close(rx); close(tx); return; }
+    char msg[1024];
+    for (int i = 1; i <= 5; ++i) {
+        int n = sprintf(msg, "{\"id\": \"agent-%d\", \"v\": %d}", i, i);
+        sendto(tx, msg, (size_t)n, 0, (struct sockaddr*)&addr, sizeof(addr));
+    }
+    sendto(tx, "{\"v\": 100", 9, 0, (struct sockaddr*)&addr, sizeof(addr));
+    memset(msg, ' ', 600);
+    sendto(tx, msg, 600, 0, (struct sockaddr*)&addr, sizeof(addr));
+    size_t n = (size_t)snprintf(msg, sizeof(msg), "{\"v\": 10, \"list\": [");
+    for (int i = 0; i < 150 && n < sizeof(msg); ++i) n += (size_t)snprintf(msg + n, sizeof(msg) - n, "%s%d", i ? "," : "", i % 10);
+    if (n < sizeof(msg)) n += (size_t)snprintf(msg + n, sizeof(msg) - n, "]}");
+    ASSERT(n < sizeof(msg), "150-element datagram fits the message buffer");
+    sendto(tx, msg, n, 0, (struct sockaddr*)&addr, sizeof(addr));
+
+    UdpSeen seen = { 0 };
+    ASSERT(json_udp_poll(&u, MSG_DONTWAIT, udp_seen, &seen) == 8 && u.batches == 1, "one syscall for the batch");
+    ASSERT(seen.n == 6 && seen.sum == 25 && seen.children == 150 && seen.from_loopback, "handler sees every good document");
+    ASSERT(u.bad == 1 && u.truncated == 1 && u.nodes_cap > 8 * 16, "bad and oversized datagrams counted, tape grew");
+
+    JsonNode* tape = u.nodes;
+    sendto(tx, "[1]", 3, 0, (struct sockaddr*)&addr, sizeof(addr));
+    sendto(tx, "{\"v\": -3}", 9, 0, (struct sockaddr*)&addr, sizeof(addr));
+    seen = (UdpSeen){ 0 };
+    ASSERT(json_udp_poll(&u, MSG_DONTWAIT, udp_seen, &seen) == 2 && seen.n == 2 && seen.sum == -3 && u.nodes == tape,
+           "next batch reuses the tape");
+    ASSERT(json_udp_poll(&u, MSG_DONTWAIT, udp_seen, &seen) == 0 && seen.n == 2, "nothing waiting");
+
+    json_udp_free(&u);
+    close(rx);
+    close(tx);
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+}
+
+static void test_http_chunked()
+{
+    JsonParser p, q;
+    const char* doc = "{\"user\": \"a fairly long name that will straddle chunks\", \"ids\": [1, 22, 333, 4444], \"ok\": true}";
+    size_t doc_len = strlen(doc);
+
+    /* chunks of 1..9 bytes with an extension here and there, two trailers, then the next request */
+    char wire[4096];
+    size_t n = 0, at = 0;
+    for (int k = 0; at < doc_len; ++k) {
+        size_t c = (size_t)(k % 9) + 1;
+        if (c > doc_len - at) c = doc_len - at;
+        n += (size_t)snprintf(wire + n, sizeof(wire) - n, k % 4 == 3 ? "%zX;ext=\"x\"\r\n" : "%zx\r\n", c);
+        memcpy(wire + n, doc + at, c);
+        n += c;
+        at += c;
+        memcpy(wire + n, "\r\n", 2);
+        n += 2;
+    }
+    n += (size_t)snprintf(wire + n, sizeof(wire) - n, "0\r\nX-Sum: 1\r\nX-More: 2\r\n\r\nGET /next");
+    ASSERT(n < sizeof(wire), "framed body fits the wire buffer");
+
+    ASSERT(parse_full(doc, &p), "reference parse");
+    static JsonNode qn[256];
+    static uint32_t qs[16];
+    static uint8_t qk[16];
+    for (size_t step = 1; step <= 7; step += 3) {          /* receive buffers split inside size lines, CRLFs and payload */
+        JsonHttpChunked h;
+        json_http_init(&h, true);
+        json_init(&q, qn, 256, qs, 16, qk);
+        int64_t used = 0;
+        size_t pos = 0;
+        while (pos < n && h.state != JSON_HTTP_DONE) {
+            size_t len = n - pos < step ? n - pos : step;
+            used = json_http_feed(&h, &q, wire + pos, len);
+            if (used < 0) break;
+            pos += (size_t)used;
+        }
+        ASSERT(used >= 0 && json_http_finish(&h, &q) && h.body_len == doc_len && strcmp(wire + pos, "GET /next") == 0,
+               "de-framed, stops at the next request");
+        ASSERT(q.nodes_len == p.nodes_len && memcmp(qn, p.nodes, p.nodes_len * sizeof(JsonNode)) == 0, "same tape as the unframed body");
+
+        StringBuf scratch;
+        stringbuf_init(&scratch, 16);
+        JsonNode* user = json_get_object_value(&p, json_root(&p), "user");
+        const char* t = json_http_node_text(&h, &qn[user - p.nodes], &scratch);
+        ASSERT(t && memcmp(t, "a fairly long name that will straddle chunks", user->len) == 0 && t == scratch.data,
+               "straddling value copied to scratch");
+        const char* one = json_http_text(&h, 60, 1, &scratch);
+        ASSERT(one && one > wire && one < wire + n && *one == doc[60], "single-chunk text points into the receive buffer");
+        char* flat = malloc(h.body_len + 1);
+        ASSERT(flat, "allocate the flattened body");
+        if (flat) {
+            json_http_flatten(&h, &q, flat);
+            ASSERT(memcmp(flat, doc, doc_len) == 0, "flattened body");
+            free(flat);
+        }
+        stringbuf_free(&scratch);
+        json_http_free(&h);
+    }
+
+    JsonHttpChunked h;
+    json_http_init(&h, false);
+    json_init(&q, qn, 256, qs, 16, qk);
+    ASSERT(json_http_feed(&h, &q, "3\r\n[1]\r\n0\r\n\r\n", 13) == 13 && json_http_finish(&h, &q) && q.nodes_len == 2 && !h.segs_len,
+           "whole body in one buffer, no segments kept");
+    json_http_reset(&h);
+    json_init(&q, qn, 256, qs, 16, qk);
+    ASSERT(json_http_feed(&h, &q, "3\r\n[1]0\r\n", 9) < 0 && h.error == JSON_HTTP_ERR_FRAMING, "missing CRLF after data");
+    json_http_reset(&h);
+    ASSERT(json_http_feed(&h, &q, "zz\r\n", 4) < 0 && h.error == JSON_HTTP_ERR_FRAMING, "bad chunk size");
+    json_http_reset(&h);
+    ASSERT(json_http_feed(&h, &q, "10000000000000000\r\n", 19) < 0 && h.error == JSON_HTTP_ERR_SIZE, "oversized chunk size");
+    json_http_reset(&h);
+    json_init(&q, qn, 256, qs, 16, qk);
+    ASSERT(json_http_feed(&h, &q, "2\r\n[1", 5) == 5 && !json_http_finish(&h, &q), "body cut short");
+    json_http_free(&h);
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+}
+
+typedef struct { JsonShardWriter* w; JsonShardBatch* b; } ShardCommit;
+
+static void* shard_commit_later(void* arg)
+{
+    ShardCommit* c = arg;
+    json_shard_commit(c->w, 1, c->b);      /* waits for batch 0 */
+    return NULL;
+}
+
+static void test_shard_route()
+{
+    JsonParser p;
+    const char* key = "customer_id";
+    JsonProjection pj;
+    ASSERT(json_projection_compile(&pj, &key, 1), "key path");
+
+    FILE* files[3];
+    int fds[3];
+    for (int i = 0; i < 3; ++i) { files[i] = tmpfile(); fds[i] = fileno(files[i]); }
+    JsonShardWriter w;
+    ASSERT(json_shard_open(&w, fds, 3), "writer");
+    w.flush_bytes = 256;                    /* exercise both the pending and the direct writev paths */
+
+    JsonShardBatch b[2];
+    json_shard_batch_init(&b[0], 3);
+    json_shard_batch_init(&b[1], 3);
+    uint8_t k[256];
+    StringBuf scratch;
+    stringbuf_init(&scratch, 64);
+    uint32_t first[5];
+    bool same = true;
+    for (int r = 0; r < 200; ++r) {
+        char rec[128];
+        int c = r % 5;
+        int n = c == 3 ? sprintf(rec, "{\"seq\": %d, \"customer_id\": 3.0}", r)
+              : c == 4 ? sprintf(rec, "{\"seq\": %d}", r)
+                       : sprintf(rec, "{\"seq\": %d, \"customer_id\": \"c\\u00%d%d\"}", r, 3, c);
+        same = same && parse_full(rec, &p);
+        uint32_t sh = json_shard_pick(&pj, &p, k, &scratch, 3);
+        if (r < 5) first[c] = sh;
+        same = same && sh == first[c];
+        json_shard_route(&b[r < 100 ? 0 : 1], sh, rec, (uint64_t)n);
+    }
+    ASSERT(same, "records parse, a key always picks the same shard");
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+    ASSERT(parse_full("{\"customer_id\": \"c0\"}", &p) && json_shard_pick(&pj, &p, k, &scratch, 3) == first[0], "escaped and plain keys agree");
+    ASSERT(parse_full("{\"customer_id\": 3}", &p) && json_shard_pick(&pj, &p, k, &scratch, 3) == first[3], "3 and 3.0 agree");
+    ASSERT(parse_full("{\"customer_id\": null}", &p) && json_shard_pick(&pj, &p, k, &scratch, 3) == first[4], "missing routes like null");
+
+    /* batch 1 is committed first from another thread and must land after batch 0 */
+    pthread_t t;
+    ShardCommit later = { &w, &b[1] };
+    pthread_create(&t, NULL, shard_commit_later, &later);
+    ASSERT(json_shard_commit(&w, 0, &b[0]), "commit batch 0");
+    pthread_join(t, NULL);
+    ASSERT(w.next_seq == 2 && w.records[0] + w.records[1] + w.records[2] == 200, "both batches committed");
+    ASSERT(json_shard_close(&w) && w.bytes > 0, "pending output flushed");
+
+    uint64_t total = 0;
+    bool ordered = true, keyed = true;
+    for (int i = 0; i < 3; ++i) {
+        char line[256];
+        int last = -1;
+        rewind(files[i]);
+        while (fgets(line, sizeof(line), files[i])) {
+            int seq = atoi(line + 8);
+            ordered = ordered && seq > last;
+            keyed = keyed && first[seq % 5] == (uint32_t)i;
+            last = seq;
+            total++;
+        }
+        fclose(files[i]);
+    }
+    ASSERT(total == 200 && ordered && keyed, "every shard holds its keys in input order");
+
+    json_shard_batch_free(&b[0]);
+    json_shard_batch_free(&b[1]);
+    stringbuf_free(&scratch);
+    json_projection_free(&pj);
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+}
+
+static void test_builder_nested()
+{
+    JsonParser p;
+    StringBuf sb;
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+
+    JsonNode* root = json_create_object(&p);
+    JsonNode* k = json_create_string(&p, "inner");
+    JsonNode* inner = json_create_object(&p);
+    JsonNode* ik = json_create_string(&p, "list");
+    JsonNode* list = json_create_array(&p);
+    json_array_append(&p, list, json_create_int(&p, 1));
+    json_array_append(&p, list, json_create_float(&p, 0.5));
+    json_object_set(&p, inner, ik, list);
+    json_object_set(&p, root, k, inner);
+    JsonNode* k2 = json_create_string(&p, "after");
+    json_object_set(&p, root, k2, json_create_bool(&p, true));
+
+    stringbuf_init(&sb, 256);
+    json_serialize(&p, false, &sb);
+    ASSERT(strcmp(stringbuf_cstr(&sb), "{\"inner\":{\"list\":[1,0.5]},\"after\":true}") == 0, "nested builder serializes");
+    ASSERT(json_get_object_value(&p, root, "after")->type == JSON_TRUE, "sibling after nested container");
+    ASSERT(p.stack_len == 0, "builder leaves the parse stack alone");
+    stringbuf_free(&sb);
+    json_free_tree(&p, root);
+}
+
+/* Runs a tool through the shell and collects its stdout. Returns its exit status, -1 if it didn't exit. */
+static int run_tool(const char* cmd, StringBuf* out)
+{
+    FILE* f = popen(cmd, "r");
+    if (!f) return -1;
+    char buf[65536];
+    size_t n;
+    out->size = 0;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) stringbuf_append(out, buf, (ssize_t)n);
+    int st = pclose(f);
+    return st != -1 && WIFEXITED(st) ? WEXITSTATUS(st) : -1;
+}
+
+static int64_t report_i64(const JsonPathIndex* ix, JsonParser* p, const char* path)
+{
+    int64_t v = -1;
+    JsonNode* n = json_path_index_get(ix, p, path);
+    return n && json_as_i64(p, n, &v) ? v : -1;
+}
+
+static bool report_str(const JsonPathIndex* ix, JsonParser* p, const char* path, const char* want)
+{
+    JsonNode* n = json_path_index_get(ix, p, path);
+    return n && n->type == JSON_STRING && n->len == strlen(want) && memcmp(p->buffer + n->offset, want, n->len) == 0;
+}
+
+static void test_stats_report()
+{
+    JsonParser p;
+    JsonPathIndex ix = { 0 };
+    StringBuf out;
+    char path[256], cmd[1024];
+
+    snprintf(path, sizeof(path), "/tmp/cejson-test-stats-%d.ndjson", (int)getpid());
+    FILE* f = fopen(path, "w");
+    ASSERT(f, "create stats input");
+    if (!f) return;
+    fputs("{\"a\":1,\"b\":[true,null,\"x\"]}\n{\"a\":2.5,\"b\":{\"c\":\"y\\\\n\"}}\n\n{\"a\":3}\nnot json\n", f);
+    fputc('{', f);                                  /* 2000 more distinct keys for the estimate */
+    for (int i = 0; i < 2000; ++i) fprintf(f, "%s\"k%d\":%d", i ? "," : "", i, i);
+    fputs("}\n", f);
+    fclose(f);
+
+    stringbuf_init(&out, 4096);
+    snprintf(cmd, sizeof(cmd), CEJSON_BIN_DIR "/cejson-stats -n -t 2 %s 2>/dev/null", path);
+    ASSERT(run_tool(cmd, &out) == 2, "cejson-stats runs, exit status flags the bad line");
+    ASSERT(parse_full(stringbuf_cstr(&out), &p) && json_path_index_build(&ix, &p), "report is JSON");
+
+    ASSERT(report_i64(&ix, &p, "documents") == 4 && report_i64(&ix, &p, "failed") == 1, "documents and failures counted");
+    ASSERT(report_i64(&ix, &p, "types.null") == 1 && report_i64(&ix, &p, "types.true") == 1 &&
+           report_i64(&ix, &p, "types.false") == 0 && report_i64(&ix, &p, "types.int") == 2002 &&
+           report_i64(&ix, &p, "types.float") == 1 && report_i64(&ix, &p, "types.string") == 2 &&
+           report_i64(&ix, &p, "types.array") == 1 && report_i64(&ix, &p, "types.object") == 5,
+           "type counts, keys excluded");
+    ASSERT(report_i64(&ix, &p, "depth.max") == 2 && report_i64(&ix, &p, "depth.nodes_at_depth[0]") == 4 &&
+           report_i64(&ix, &p, "depth.nodes_at_depth[1]") == 2005 && report_i64(&ix, &p, "depth.nodes_at_depth[2]") == 4 &&
+           json_path_index_get(&ix, &p, "depth.nodes_at_depth[3]") == NULL,
+           "depth histogram, trailing empty bins dropped");
+    ASSERT(report_i64(&ix, &p, "strings.with_escapes") == 1 && report_i64(&ix, &p, "strings.escapes") == 1, "escapes counted");
+    int64_t distinct = report_i64(&ix, &p, "keys.distinct_estimate");
+    ASSERT(distinct > 2003 * 9 / 10 && distinct < 2003 * 11 / 10 && report_i64(&ix, &p, "keys.tracked") == 2003,
+           "HyperLogLog key estimate within 10%");
+    ASSERT(report_str(&ix, &p, "keys.top[0].key", "a") && report_i64(&ix, &p, "keys.top[0].count") == 3 &&
+           report_i64(&ix, &p, "keys.top[0].value_cardinality") == 3 &&
+           report_str(&ix, &p, "keys.top[1].key", "b") && report_i64(&ix, &p, "keys.top[1].count") == 2,
+           "top keys by count with value cardinality");
+
+    json_path_index_free(&ix);
+    stringbuf_free(&out);
+    unlink(path);
+    json_init(&p, nodes, NODE_CAP, stack, STACK_CAP, expecting_key);
+}
+
+/* Sort key of a test record: null/missing < false < true < numbers < strings, then input order */
+typedef struct { int cls; double num; char str[4]; int i; char text[40]; } SortRec;
+
+static int sort_rec_key(const SortRec* a, const SortRec* b)
+{
+    if (a->cls != b->cls) return a->cls < b->cls ? -1 : 1;
+    if (a->cls == 3 && a->num != b->num) return a->num < b->num ? -1 : 1;
+    return a->cls == 4 ? strcmp(a->str, b->str) : 0;
+}
+
+static int sort_rec_fwd(const void* a, const void* b)
+{
+    int c = sort_rec_key(a, b);
+    return c ? c : ((const SortRec*)a)->i - ((const SortRec*)b)->i;
+}
+
+static int sort_rec_rev(const void* a, const void* b)
+{
+    int c = -sort_rec_key(a, b);
+    return c ? c : ((const SortRec*)a)->i - ((const SortRec*)b)->i;
+}
+
+static bool sort_expect(const StringBuf* out, SortRec* recs, int n, int (*cmp)(const void*, const void*))
+{
+    qsort(recs, (size_t)n, sizeof(SortRec), cmp);
+    ssize_t at = 0;
+    for (int i = 0; i < n; ++i) {
+        size_t len = strlen(recs[i].text);
+        if (at + (ssize_t)len + 1 > out->size || memcmp(out->data + at, recs[i].text, len) != 0 || out->data[at + len] != '\n')
+            return false;
+        at += (ssize_t)len + 1;
+    }
+    return at == out->size;
+}
+
+static void test_sort_tool()
+{
+    JsonParser p;
+    enum { N = 20000, FILES = 5 };
+    SortRec* recs = malloc(N * sizeof(SortRec));
+    StringBuf out, log;
+    char base[128], files[FILES * 160], cmd[2048];
+    ASSERT(recs, "allocate sort records");
+    if (!recs) return;
+
+    /* every key type, many ties; five input files so a small -S spills a run per file */
+    snprintf(base, sizeof(base), "/tmp/cejson-test-sort-%d", (int)getpid());
+    size_t fl = 0;
+    for (int f = 0; f < FILES; ++f) {
+        char path[160];
+        snprintf(path, sizeof(path), "%s.%d.ndjson", base, f);
+        fl += (size_t)snprintf(files + fl, sizeof(files) - fl, " %s", path);
+        FILE* fp = fopen(path, "w");
+        ASSERT(fp, "create sort input");
+        if (!fp) { free(recs); return; }
+        for (int i = f * (N / FILES); i < (f + 1) * (N / FILES); ++i) {
+            SortRec* r = &recs[i];
+            memset(r, 0, sizeof(*r));
+            r->i = i;
+            switch (i % 7) {
+                case 0: snprintf(r->text, sizeof(r->text), "{\"i\":%d}", i); break;
+                case 1: snprintf(r->text, sizeof(r->text), "{\"k\":null,\"i\":%d}", i); break;
+                case 2: r->cls = 1; snprintf(r->text, sizeof(r->text), "{\"k\":false,\"i\":%d}", i); break;
+                case 3: r->cls = 2; snprintf(r->text, sizeof(r->text), "{\"k\":true,\"i\":%d}", i); break;
+                case 4: r->cls = 3; r->num = i * 31 % 50; snprintf(r->text, sizeof(r->text), "{\"k\":%d,\"i\":%d}", i * 31 % 50, i); break;
+                case 5: r->cls = 3; r->num = i * 17 % 50 + 0.5; snprintf(r->text, sizeof(r->text), "{\"k\":%d.5,\"i\":%d}", i * 17 % 50, i); break;
+                default: r->cls = 4; snprintf(r->str, sizeof(r->str), "s%02d", i * 13 % 50);
+                         snprintf(r->text, sizeof(r->text), "{\"k\":\"%s\",\"i\":%d}", r->str, i); break;
+            }
+            fprintf(fp, "%s\n", r->text);
+        }
+        fclose(fp);
+    }
+
+    stringbuf_init(&out, 1 << 20);
+    stringbuf_init(&log, 256);
+    snprintf(cmd, sizeof(cmd), CEJSON_BIN_DIR "/cejson-sort -k k -t 2%s 2>/dev/null", files);
+    ASSERT(run_tool(cmd, &out) == 0 && sort_expect(&out, recs, N, sort_rec_fwd), "ascending, mixed types, ties in input order");
+
+    snprintf(cmd, sizeof(cmd), CEJSON_BIN_DIR "/cejson-sort -k k -r -t 2%s 2>/dev/null", files);
+    ASSERT(run_tool(cmd, &out) == 0 && sort_expect(&out, recs, N, sort_rec_rev), "descending, ties still in input order");
+
+    snprintf(cmd, sizeof(cmd), CEJSON_BIN_DIR "/cejson-sort -k k -S 64K -v -t 2%s 2>%s.log", files, base);
+    ASSERT(run_tool(cmd, &out) == 0 && sort_expect(&out, recs, N, sort_rec_fwd), "spilled runs merge in order");
+    snprintf(cmd, sizeof(cmd), "cat %s.log", base);
+    ASSERT(run_tool(cmd, &log) == 0 && strstr(stringbuf_cstr(&log), "5 runs"), "one run per input block with -S 64K");
+
+    snprintf(cmd, sizeof(cmd), CEJSON_BIN_DIR "/cejson-sort -k k -r -S 64K -t 2%s 2>/dev/null", files);
+    ASSERT(run_tool(cmd, &out) == 0 && sort_expect(&out, recs, N, sort_rec_rev), "spilled runs merge in descending order");
+
+    snprintf(cmd, sizeof(cmd), "rm -f%s %s.log", files, base);
+    run_tool(cmd, &log);
+    stringbuf_free(&log);
+    stringbuf_free(&out);
+    free(recs);
+}
+
 int main(void)
 {
     printf("=== cejson.h Test Suite ===\n");
@@ -261,6 +1492,31 @@ int main(void)
     RUN_TEST(test_value_extraction);
     RUN_TEST(test_real_world_files);
     RUN_TEST(create_tree_test);
+    RUN_TEST(test_jsonpath);
+    RUN_TEST(test_path_index);
+    RUN_TEST(test_key_bloom);
+    RUN_TEST(test_relayout);
+    RUN_TEST(test_extract);
+    RUN_TEST(test_freeze);
+    RUN_TEST(test_large_alloc);
+    RUN_TEST(test_builder_nested);
+    RUN_TEST(test_stats_report);
+    RUN_TEST(test_builder_raw);
+    RUN_TEST(test_template_render);
+    RUN_TEST(test_redact_stream);
+    RUN_TEST(test_nest_compact);
+    RUN_TEST(test_tape_file);
+    RUN_TEST(test_pipe_parse);
+    RUN_TEST(test_udp_batch);
+    RUN_TEST(test_http_chunked);
+    RUN_TEST(test_shard_route);
+    RUN_TEST(test_ndjson_writer);
+    RUN_TEST(test_export_rows);
+    RUN_TEST(test_sort_tool);
+    RUN_TEST(test_join_splice);
+    RUN_TEST(test_utf_transcode);
+    RUN_TEST(test_feed_auto);
+    RUN_TEST(test_feed_capture);
 
     printf("============================\n");
     printf("Tests run: %d | Failed: %d\n", tests_run, tests_failed);
@@ -0,0 +1,161 @@
+/* cejson-trace.h – optional phase tracing, dumped as a Chrome trace-event file */
+/* (C) 2025 Roger Davenport */
+/* LGPL 2.1 license */
+#ifndef CEJSON_TRACE_H
+#define CEJSON_TRACE_H
+
+/*
+ * Compiled out unless CEJSON_TRACE is defined. When enabled, every
+ * JSON_TRACE_SCOPE("name") records a begin event where it appears and an end
+ * event when the enclosing block is left (any return path), into a ring owned
+ * by the calling thread: no locks, no shared cache lines on the hot path.
+ * JSON_TRACE_BEGIN/END do the same for phases that don't map onto a block.
+ *
+ * At exit the rings are written to $CEJSON_TRACE_FILE (default
+ * cejson-trace.json) in Chrome trace-event format, serialized with cejson
+ * itself. Open it in chrome://tracing or https://ui.perfetto.dev.
+ */
+
+#ifndef CEJSON_TRACE
+
+#define JSON_TRACE_SCOPE(name)  do {} while (0)
+#define JSON_TRACE_BEGIN(name)  do {} while (0)
+#define JSON_TRACE_END(name)    do {} while (0)
+
+#else
+
+#include <stdatomic.h>
+#include <time.h>
+
+#ifndef JSON_TRACE_RING
+#define JSON_TRACE_RING 65536           /* events kept per thread; the oldest are overwritten */
+#endif
+
+typedef struct {
+    const char* name;                   /* string literal */
+    uint64_t    ts_ns;
+    char        ph;                     /* 'B' or 'E' */
+} JsonTraceEvent;
+
+typedef struct JsonTraceRing {
+    JsonTraceEvent        ev[JSON_TRACE_RING];
+    _Atomic uint64_t      head;
+    uint32_t              tid;
+    struct JsonTraceRing* next;
+} JsonTraceRing;
+
+static _Atomic(JsonTraceRing*) json_trace_rings;
+static _Atomic uint32_t        json_trace_next_tid;
+static _Atomic bool            json_trace_registered;
+static _Thread_local JsonTraceRing* json_trace_ring;
+
+static inline void json_trace_dump(void);
+
+static inline uint64_t json_trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline JsonTraceRing* json_trace_thread_ring(void)
+{
+    JsonTraceRing* r = calloc(1, sizeof(JsonTraceRing));
+    if (!r) return NULL;
+    r->tid = atomic_fetch_add(&json_trace_next_tid, 1) + 1;
+
+    /* lock-free push onto the global list; rings live until exit */
+    JsonTraceRing* head = atomic_load(&json_trace_rings);
+    do { r->next = head; } while (!atomic_compare_exchange_weak(&json_trace_rings, &head, r));
+
+    if (!atomic_exchange(&json_trace_registered, true)) atexit(json_trace_dump);
+    return r;
+}
+
+static inline void json_trace_record(const char* name, char ph)
+{
+    JsonTraceRing* r = json_trace_ring;
+    if (unlikely(!r) && !(r = json_trace_ring = json_trace_thread_ring())) return;
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    r->ev[h % JSON_TRACE_RING] = (JsonTraceEvent){ .name = name, .ts_ns = json_trace_now(), .ph = ph };
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+static inline void json_trace_scope_end(const char** name) { json_trace_record(*name, 'E'); }
+
+#define JSON_TRACE_CAT2(a, b) a##b
+#define JSON_TRACE_CAT(a, b)  JSON_TRACE_CAT2(a, b)
+#define JSON_TRACE_SCOPE(name) \
+    const char* JSON_TRACE_CAT(json_trace_scope_, __LINE__) __attribute__((cleanup(json_trace_scope_end))) = (name); \
+    json_trace_record((name), 'B')
+#define JSON_TRACE_BEGIN(name)  json_trace_record((name), 'B')
+#define JSON_TRACE_END(name)    json_trace_record((name), 'E')
+
+#endif /* CEJSON_TRACE */
+
+#endif /* CEJSON_TRACE_H */
+
+/*
+ * The dump needs the builder and serializer, so it is compiled once cejson.h
+ * is complete (cejson.h includes this file again at its end).
+ */
+#if defined(CEJSON_TRACE) && defined(CEJSON_H_COMPLETE) && !defined(CEJSON_TRACE_DUMP)
+#define CEJSON_TRACE_DUMP
+
+static inline void json_trace_dump(void)
+{
+    uint64_t events = 0, t0 = UINT64_MAX;
+    for (JsonTraceRing* r = atomic_load(&json_trace_rings); r; r = r->next) {
+        uint64_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+        uint64_t n = h < JSON_TRACE_RING ? h : JSON_TRACE_RING;
+        events += n;
+        for (uint64_t i = h - n; i < h; ++i)
+            if (r->ev[i % JSON_TRACE_RING].ts_ns < t0) t0 = r->ev[i % JSON_TRACE_RING].ts_ns;
+    }
+    if (!events) return;
+
+    /* 11 nodes per event (object + 5 pairs) plus the wrapper */
+    uint64_t cap = events * 11 + 8;
+    JsonNode* nodes = malloc(cap * sizeof(JsonNode));
+    if (!nodes) return;
+    JsonParser p;
+    json_init(&p, nodes, cap, NULL, 0, NULL);
+
+    JsonNode* root = json_create_object(&p);
+    JsonNode* unit_k = json_create_string(&p, "displayTimeUnit");
+    json_object_set(&p, root, unit_k, json_create_string(&p, "ns"));
+    JsonNode* ev_k = json_create_string(&p, "traceEvents");
+    JsonNode* arr = json_create_array(&p);
+
+    for (JsonTraceRing* r = atomic_load(&json_trace_rings); r; r = r->next) {
+        uint64_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+        uint64_t n = h < JSON_TRACE_RING ? h : JSON_TRACE_RING;
+        for (uint64_t i = h - n; i < h; ++i) {
+            const JsonTraceEvent* e = &r->ev[i % JSON_TRACE_RING];
+            char ph[2] = { e->ph, '\0' };
+            JsonNode* o = json_create_object(&p);
+            JsonNode* k;
+            k = json_create_string(&p, "name"); json_object_set(&p, o, k, json_create_string(&p, e->name));
+            k = json_create_string(&p, "ph");   json_object_set(&p, o, k, json_create_string(&p, ph));
+            k = json_create_string(&p, "ts");   json_object_set(&p, o, k, json_create_float(&p, (e->ts_ns - t0) / 1000.0));
+            k = json_create_string(&p, "pid");  json_object_set(&p, o, k, json_create_int(&p, 1));
+            k = json_create_string(&p, "tid");  json_object_set(&p, o, k, json_create_int(&p, r->tid));
+            json_array_append(&p, arr, o);
+        }
+    }
+    json_object_set(&p, root, ev_k, arr);
+
+    const char* path = getenv("CEJSON_TRACE_FILE");
+    FILE* out = fopen(path && *path ? path : "cejson-trace.json", "wb");
+    StringBuf sb;
+    if (out && stringbuf_init(&sb, 0)) {
+        json_serialize(&p, false, &sb);
+        fwrite(sb.data, 1, (size_t)sb.size, out);
+        stringbuf_free(&sb);
+    }
+    if (out) fclose(out);
+    json_free_tree(&p, root);
+    free(nodes);
+}
+
+#endif